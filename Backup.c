@@ -0,0 +1,832 @@
+#include "Backup.h"
+#include "DirIter.h"
+#include "Lz.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void BackupBlobName(const char *dir, ULONG checksum, ULONG size, char *buffer)
+{
+    char name[20];
+    
+    sprintf(name, "%08lx-%08lx", checksum, size);
+    strcpy(buffer, dir);
+    AddPart(buffer, name, MAX_PATH);
+}
+
+// The index keys backups by full path, so a file is found again whatever
+// form its name took. A file that is not there is named through its
+// directory.
+void BackupPathName(const char *path, char *buffer)
+{
+    char dir[MAX_PATH];
+    BOOL named = FALSE;
+    BPTR lock;
+    
+    if ((lock = Lock(path, ACCESS_READ)))
+    {
+        named = NameFromLock(lock, buffer, MAX_PATH);
+        UnLock(lock);
+    }
+    else if (PathPart(path) - path < MAX_PATH)
+    {
+        strncpy(dir, path, PathPart(path) - path);
+        dir[PathPart(path) - path] = '\0';
+        if ((lock = Lock(dir, ACCESS_READ)))
+        {
+            named = NameFromLock(lock, buffer, MAX_PATH) &&
+                    AddPart(buffer, FilePart(path), MAX_PATH);
+            UnLock(lock);
+        }
+    }
+    
+    if (!named)
+    {
+        strncpy(buffer, path, MAX_PATH - 1);
+        buffer[MAX_PATH - 1] = '\0';
+    }
+}
+
+static BOOL Exists(const char *path)
+{
+    BPTR lock;
+    
+    if ((lock = Lock(path, ACCESS_READ)))
+    {
+        UnLock(lock);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Find or create the public semaphore guarding the stores
+static struct SignalSemaphore *GetStoreSemaphore(void)
+{
+    struct SignalSemaphore *sem;
+    struct BackupSemaphore *bs;
+    
+    Forbid();
+    if (!(sem = FindSemaphore(BACKUP_SEMAPHORE_NAME)))
+    {
+        // Never freed, another process may find it at any time
+        if ((bs = AllocMem(sizeof(struct BackupSemaphore), MEMF_PUBLIC|MEMF_CLEAR)))
+        {
+            strcpy(bs->name, BACKUP_SEMAPHORE_NAME);
+            bs->sem.ss_Link.ln_Name = bs->name;
+            bs->sem.ss_Link.ln_Pri = 0;
+            AddSemaphore(&bs->sem);
+            sem = &bs->sem;
+        }
+    }
+    Permit();
+    
+    if (!sem)
+        SetIoErr(ERROR_NO_FREE_STORE);
+    return sem;
+}
+
+// Either form of a blob will do
+static BOOL HaveBlob(const char *blob)
+{
+    char packed[MAX_PATH + sizeof(BACKUP_PACKED)];
+    
+    strcpy(packed, blob);
+    strcat(packed, BACKUP_PACKED);
+    return Exists(blob) || Exists(packed);
+}
+
+// Creates the store and any missing parent directories
+static BOOL MakeStore(const char *dir)
+{
+    char path[MAX_PATH];
+    char *p;
+    BPTR lock;
+    
+    if (Exists(dir) || strlen(dir) >= MAX_PATH)
+        return Exists(dir);
+    
+    strcpy(path, dir);
+    if (!(p = strchr(path, ':')))
+        p = path;
+    
+    for (; *p; p++)
+    {
+        if (p[1] == '/' || p[1] == '\0')
+        {
+            char c = p[1];
+    
+            p[1] = '\0';
+            if (!Exists(path) && (lock = CreateDir(path)))
+                UnLock(lock);
+            p[1] = c;
+        }
+    }
+    return Exists(dir);
+}
+
+// A prune writes the new index beside the old one and renames it over;
+// finish that here if it was interrupted
+static void IndexPath(const char *dir, char *buffer)
+{
+    char pruned[MAX_PATH];
+    
+    strcpy(buffer, dir);
+    AddPart(buffer, BACKUP_INDEX, MAX_PATH);
+    strcpy(pruned, dir);
+    AddPart(pruned, BACKUP_INDEX_NEW, MAX_PATH);
+    
+    if (!Exists(buffer) && Exists(pruned))
+        Rename(pruned, buffer);
+}
+
+static BOOL WriteEntry(BPTR fh, ULONG checksum, ULONG size, const struct DateStamp *date,
+                       const char *path)
+{
+    return FPrintf(fh, "B|%08lx|%lu|%ld|%ld|%ld|%s\n", checksum, size, date->ds_Days,
+                   date->ds_Minute, date->ds_Tick, (LONG)path) >= 0;
+}
+
+static BOOL AppendIndex(const char *dir, ULONG checksum, ULONG size, const char *original)
+{
+    struct DateStamp now;
+    char index[MAX_PATH];
+    BPTR fh;
+    BOOL ok;
+    
+    IndexPath(dir, index);
+    
+    if (!(fh = Open(index, MODE_READWRITE)))
+        return FALSE;
+    
+    DateStamp(&now);
+    ok = Seek(fh, 0, OFFSET_END) != -1 && WriteEntry(fh, checksum, size, &now, original);
+    
+    if (!Close(fh))
+        ok = FALSE;
+    return ok;
+}
+
+// Back up file as the content installed at original. With move set the
+// file is not needed afterwards: it is renamed into the store when that
+// is on the same volume, or deleted once stored.
+static BOOL AddToStore(struct CopyEngine *ce, const char *dir, const char *file,
+                       const char *original, BOOL move)
+{
+    char blob[MAX_PATH];
+    char temp[MAX_PATH];
+    char name[MAX_PATH];
+    ULONG checksum, size;
+    
+    if (!MakeStore(dir) || !ChecksumEngineFile(ce, file, &checksum, &size))
+        return FALSE;
+    
+    BackupBlobName(dir, checksum, size, blob);
+    
+    if (!HaveBlob(blob))
+    {
+        if (!move || !Rename(file, blob))
+        {
+            strcpy(temp, dir);
+            AddPart(temp, BACKUP_TEMP, sizeof(temp));
+    
+            // Renamed into place only when complete, and only if the file
+            // did not change since it was hashed
+            if (!CopyEngineFile(ce, file, temp))
+                return FALSE;
+    
+            if (ce->checksum != checksum || !Rename(temp, blob))
+            {
+                DeleteFile(temp);
+                if (!HaveBlob(blob))
+                    return FALSE;
+            }
+        }
+    }
+    
+    BackupPathName(original, name);
+    if (!AppendIndex(dir, checksum, size, name))
+        return FALSE;
+    
+    if (move)
+        DeleteFile(file);
+    
+    return TRUE;
+}
+
+static BOOL ParseEntry(char *line, struct BackupEntry *e)
+{
+    char *p = line + 2;
+    
+    if (line[0] != 'B' || line[1] != '|')
+        return FALSE;
+    
+    e->checksum = strtoul(p, &p, 16);
+    if (*p++ != '|') return FALSE;
+    e->size = strtoul(p, &p, 10);
+    if (*p++ != '|') return FALSE;
+    e->date.ds_Days = strtol(p, &p, 10);
+    if (*p++ != '|') return FALSE;
+    e->date.ds_Minute = strtol(p, &p, 10);
+    if (*p++ != '|') return FALSE;
+    e->date.ds_Tick = strtol(p, &p, 10);
+    if (*p++ != '|' || strlen(p) >= MAX_PATH) return FALSE;
+    
+    strcpy(e->path, p);
+    return TRUE;
+}
+
+static BPTR OpenIndex(const char *dir)
+{
+    char index[MAX_PATH];
+    BPTR fh;
+    
+    IndexPath(dir, index);
+    if ((fh = Open(index, MODE_OLDFILE)))
+        SetVBuf(fh, NULL, BUF_FULL, 4096);
+    return fh;
+}
+
+// Next well-formed entry; overlong lines and a last line cut short are
+// skipped
+static BOOL NextEntry(BPTR fh, struct BackupEntry *e)
+{
+    char line[BACKUP_MAX_LINE];
+    char *nl;
+    
+    while (FGets(fh, line, sizeof(line)))
+    {
+        if (!(nl = strchr(line, '\n')))
+            continue;
+        *nl = '\0';
+    
+        if (ParseEntry(line, e))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// Newest backup of path with skip 0, the one before with 1 and so on.
+// One pass over the index, keeping the last skip + 1 matches; the blob
+// directory is never scanned.
+static BOOL SearchIndex(const char *dir, const char *path, ULONG skip, struct BackupEntry *entry)
+{
+    struct BackupEntry e;
+    struct BackupEntry *ring;
+    char name[MAX_PATH];
+    ULONG found = 0;
+    BPTR fh;
+    
+    BackupPathName(path, name);
+    if (!(ring = AllocVec((skip + 1) * sizeof(struct BackupEntry), MEMF_ANY)))
+        return FALSE;
+    
+    if ((fh = OpenIndex(dir)))
+    {
+        while (NextEntry(fh, &e))
+        {
+            if (stricmp(e.path, name) == 0)
+                ring[found++ % (skip + 1)] = e;
+        }
+        Close(fh);
+    }
+    
+    if (found > skip)
+        *entry = ring[(found - 1 - skip) % (skip + 1)];
+    
+    FreeVec(ring);
+    return found > skip;
+}
+
+// Copies a backup to dest, unpacking a compressed blob on the way. The
+// result must match the checksum the backup was stored under.
+static BOOL CopyFromStore(struct CopyEngine *ce, const char *dir, const struct BackupEntry *entry,
+                          const char *dest)
+{
+    struct LzCoder *lz;
+    char blob[MAX_PATH + sizeof(BACKUP_PACKED)];
+    ULONG checksum = 0, size = 0;
+    BPTR from, to;
+    BOOL ok = FALSE;
+    
+    BackupBlobName(dir, entry->checksum, entry->size, blob);
+    
+    if (Exists(blob))
+    {
+        ok = CopyEngineFile(ce, blob, dest);
+        checksum = ce->checksum;
+        size = entry->size;
+    }
+    else if ((lz = CreateLzCoder()))
+    {
+        strcat(blob, BACKUP_PACKED);
+        if ((from = Open(blob, MODE_OLDFILE)))
+        {
+            if ((to = Open(dest, MODE_NEWFILE)))
+            {
+                ok = LzUnpackFile(lz, from, to, &checksum, &size);
+                if (!Close(to))
+                    ok = FALSE;
+            }
+            Close(from);
+        }
+        DeleteLzCoder(lz);
+    }
+    
+    if (ok && (checksum != entry->checksum || size != entry->size))
+    {
+        DeleteFile(dest);
+        ok = FALSE;
+    }
+    return ok;
+}
+
+// Names of the blobs not yet compressed, read before any is replaced
+static char (*ListRawBlobs(const char *dir, ULONG *count))[BACKUP_BLOB_NAME]
+{
+    struct DirIter *it;
+    struct ExAllData *ed;
+    char (*names)[BACKUP_BLOB_NAME] = NULL;
+    char (*more)[BACKUP_BLOB_NAME];
+    ULONG max = 0;
+    BPTR lock;
+    
+    *count = 0;
+    
+    if (!(lock = Lock(dir, ACCESS_READ)))
+        return NULL;
+    
+    if ((it = CreateDirIter(BACKUP_RAW_PATTERN, DIRITER_BUFFER_SIZE)))
+    {
+        if (StartDirIter(it, lock))
+        {
+            while ((ed = NextDirEntry(it)))
+            {
+                if (ed->ed_Type >= 0)
+                    continue;
+    
+                if (*count == max)
+                {
+                    max = max ? max * 2 : 64;
+                    if (!(more = AllocVec(max * BACKUP_BLOB_NAME, MEMF_ANY)))
+                        break;
+                    if (names)
+                    {
+                        memcpy(more, names, *count * BACKUP_BLOB_NAME);
+                        FreeVec(names);
+                    }
+                    names = more;
+                }
+                strcpy(names[(*count)++], (char *)ed->ed_Name);
+            }
+            EndDirIter(it);
+        }
+        DeleteDirIter(it);
+    }
+    UnLock(lock);
+    
+    return names;
+}
+
+// Packs one blob and checks the packed file unpacks to the same checksum
+// before the raw one is deleted
+static BOOL CompressBlob(struct LzCoder *lz, const char *dir, const char *name, LONG *saved)
+{
+    char raw[MAX_PATH];
+    char packed[MAX_PATH + sizeof(BACKUP_PACKED)];
+    char temp[MAX_PATH + sizeof(BACKUP_PACKED)];
+    ULONG checksum, size, written;
+    BPTR from, to;
+    BOOL ok = FALSE;
+    
+    strcpy(raw, dir);
+    AddPart(raw, name, sizeof(raw));
+    strcpy(packed, raw);
+    strcat(packed, BACKUP_PACKED);
+    strcpy(temp, dir);
+    AddPart(temp, BACKUP_TEMP, MAX_PATH);
+    strcat(temp, BACKUP_PACKED);
+    
+    // Left by an earlier pass stopped before the delete
+    if (Exists(packed))
+        return DeleteFile(raw);
+    
+    if (!(from = Open(raw, MODE_OLDFILE)))
+        return FALSE;
+    
+    if ((to = Open(temp, MODE_NEWFILE)))
+    {
+        ok = LzPackFile(lz, from, to, &written);
+        if (!Close(to))
+            ok = FALSE;
+    }
+    Close(from);
+    
+    if (ok && (from = Open(temp, MODE_OLDFILE)))
+    {
+        ok = LzUnpackFile(lz, from, 0, &checksum, &size) &&
+             checksum == strtoul(name, NULL, 16) &&
+             size == strtoul(name + 9, NULL, 16);
+        Close(from);
+    }
+    else
+    {
+        ok = FALSE;
+    }
+    
+    if (!ok || !Rename(temp, packed))
+    {
+        DeleteFile(temp);
+        return FALSE;
+    }
+    
+    DeleteFile(raw);
+    *saved += (LONG)size - (LONG)written;
+    return TRUE;
+}
+
+// Compresses every blob stored raw. Restores unpack them transparently.
+// This runs at low priority, so the store is held for one blob at a time
+// and installs are not kept waiting for the whole pass.
+BOOL CompressBackups(const char *dir, ULONG *files, LONG *saved)
+{
+    struct SignalSemaphore *sem;
+    struct LzCoder *lz;
+    char (*names)[BACKUP_BLOB_NAME];
+    ULONG count, i;
+    BOOL ok = TRUE;
+    
+    *files = 0;
+    *saved = 0;
+    
+    if (!Exists(dir))
+        return TRUE;
+    
+    if (!(sem = GetStoreSemaphore()) || !(lz = CreateLzCoder()))
+        return FALSE;
+    
+    names = ListRawBlobs(dir, &count);
+    for (i = 0; i < count; i++)
+    {
+        if (CheckSignal(SIGBREAKF_CTRL_C))
+        {
+            ok = FALSE;
+            break;
+        }
+    
+        ObtainSemaphore(sem);
+        if (CompressBlob(lz, dir, names[i], saved))
+            (*files)++;
+        else
+            ok = FALSE;
+        ReleaseSemaphore(sem);
+    }
+    
+    if (names) FreeVec(names);
+    DeleteLzCoder(lz);
+    return ok;
+}
+
+struct PruneEntry {
+    char *path;                 // In the prune's pool
+    struct DateStamp date;
+    ULONG checksum;
+    ULONG size;
+    ULONG seq;                  // Line in the index, oldest first
+    ULONG blob;                 // Same number for the same content
+    ULONG rank;                 // 0 for the newest backup of its file
+    BOOL keep;
+};
+
+struct PruneBlob {
+    ULONG checksum;
+    ULONG size;
+    ULONG refs;                 // Kept entries using the blob
+};
+
+struct Prune {
+    APTR pool;
+    struct PruneEntry *entries;
+    struct PruneBlob *blobs;
+    ULONG count;
+    ULONG max;
+    ULONG numBlobs;
+};
+
+static int CompareContent(const void *a, const void *b)
+{
+    const struct PruneEntry *x = a, *y = b;
+    
+    if (x->checksum != y->checksum)
+        return x->checksum < y->checksum ? -1 : 1;
+    if (x->size != y->size)
+        return x->size < y->size ? -1 : 1;
+    return 0;
+}
+
+// By file, newest first
+static int CompareFiles(const void *a, const void *b)
+{
+    const struct PruneEntry *x = a, *y = b;
+    int c = stricmp(x->path, y->path);
+    
+    if (c != 0)
+        return c;
+    return x->seq < y->seq ? 1 : -1;
+}
+
+static int CompareSeq(const void *a, const void *b)
+{
+    const struct PruneEntry *x = a, *y = b;
+    
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static BOOL LoadPrune(struct Prune *p, const char *dir)
+{
+    struct BackupEntry e;
+    struct PruneEntry *entries;
+    ULONG max;
+    BPTR fh;
+    BOOL ok = TRUE;
+    
+    if (!(fh = OpenIndex(dir)))
+        return IoErr() == ERROR_OBJECT_NOT_FOUND;
+    
+    while (ok && NextEntry(fh, &e))
+    {
+        if (p->count == p->max)
+        {
+            max = p->max ? p->max * 2 : 64;
+            if (!(entries = AllocVec(max * sizeof(struct PruneEntry), MEMF_ANY)))
+            {
+                ok = FALSE;
+                break;
+            }
+            if (p->entries)
+            {
+                memcpy(entries, p->entries, p->count * sizeof(struct PruneEntry));
+                FreeVec(p->entries);
+            }
+            p->entries = entries;
+            p->max = max;
+        }
+    
+        if (!(p->entries[p->count].path = AllocPooled(p->pool, strlen(e.path) + 1)))
+        {
+            ok = FALSE;
+            break;
+        }
+        strcpy(p->entries[p->count].path, e.path);
+        p->entries[p->count].date = e.date;
+        p->entries[p->count].checksum = e.checksum;
+        p->entries[p->count].size = e.size;
+        p->entries[p->count].seq = p->count;
+        p->entries[p->count].keep = TRUE;
+        p->count++;
+    }
+    Close(fh);
+    
+    return ok;
+}
+
+// Numbers the distinct blobs the entries refer to
+static BOOL CollectBlobs(struct Prune *p)
+{
+    struct PruneEntry *e;
+    ULONG i;
+    
+    if (p->count == 0)
+        return TRUE;
+    
+    if (!(p->blobs = AllocVec(p->count * sizeof(struct PruneBlob), MEMF_CLEAR)))
+        return FALSE;
+    
+    qsort(p->entries, p->count, sizeof(struct PruneEntry), CompareContent);
+    for (i = 0; i < p->count; i++)
+    {
+        e = &p->entries[i];
+        if (i == 0 || CompareContent(e, e - 1) != 0)
+        {
+            p->blobs[p->numBlobs].checksum = e->checksum;
+            p->blobs[p->numBlobs].size = e->size;
+            p->numBlobs++;
+        }
+        e->blob = p->numBlobs - 1;
+    }
+    return TRUE;
+}
+
+// Count and age limits. The newest backup of every file is always kept,
+// so each file can be rolled back at least once.
+static void ApplyLimits(struct Prune *p, const struct BackupPolicy *policy)
+{
+    struct DateStamp now;
+    struct PruneEntry *e;
+    ULONG i;
+    
+    DateStamp(&now);
+    
+    qsort(p->entries, p->count, sizeof(struct PruneEntry), CompareFiles);
+    for (i = 0; i < p->count; i++)
+    {
+        e = &p->entries[i];
+        e->rank = (i > 0 && stricmp(e->path, e[-1].path) == 0) ? e[-1].rank + 1 : 0;
+    
+        if (e->rank == 0)
+            continue;
+    
+        if (policy->keep && e->rank >= policy->keep)
+            e->keep = FALSE;
+        if (policy->maxDays && now.ds_Days - e->date.ds_Days > (LONG)policy->maxDays)
+            e->keep = FALSE;
+    }
+}
+
+// Drops the oldest remaining backups until the blobs still referenced fit
+// the budget. Sizes are those of the unpacked files.
+static void ApplyBudget(struct Prune *p, const struct BackupPolicy *policy)
+{
+    struct PruneEntry *e;
+    ULONG total = 0;
+    ULONG i;
+    
+    for (i = 0; i < p->count; i++)
+    {
+        e = &p->entries[i];
+        if (e->keep && p->blobs[e->blob].refs++ == 0)
+            total += e->size;
+    }
+    
+    if (!policy->budget)
+        return;
+    
+    // Entries are in index order again, oldest first
+    for (i = 0; i < p->count && total > policy->budget; i++)
+    {
+        e = &p->entries[i];
+        if (!e->keep || e->rank == 0)
+            continue;
+    
+        e->keep = FALSE;
+        if (--p->blobs[e->blob].refs == 0)
+            total -= e->size;
+    }
+}
+
+static BOOL WriteIndex(struct Prune *p, const char *dir)
+{
+    char index[MAX_PATH];
+    char pruned[MAX_PATH];
+    BPTR fh;
+    ULONG i;
+    BOOL ok = TRUE;
+    
+    IndexPath(dir, index);
+    strcpy(pruned, dir);
+    AddPart(pruned, BACKUP_INDEX_NEW, sizeof(pruned));
+    
+    if (!(fh = Open(pruned, MODE_NEWFILE)))
+        return FALSE;
+    SetVBuf(fh, NULL, BUF_FULL, 4096);
+    
+    for (i = 0; ok && i < p->count; i++)
+    {
+        if (p->entries[i].keep)
+            ok = WriteEntry(fh, p->entries[i].checksum, p->entries[i].size,
+                            &p->entries[i].date, p->entries[i].path);
+    }
+    if (!Close(fh))
+        ok = FALSE;
+    
+    if (!ok)
+    {
+        DeleteFile(pruned);
+        return FALSE;
+    }
+    
+    // Between these two IndexPath() finds only the new index and renames it
+    return DeleteFile(index) && Rename(pruned, index);
+}
+
+// Applies the retention policy using the index alone: the entries dropped
+// are removed from it first, then the blobs no kept entry refers to are
+// deleted by name. An interrupted prune can only leave unused blobs.
+static BOOL PruneStore(const char *dir, const struct BackupPolicy *policy, ULONG *entries,
+                       ULONG *blobs)
+{
+    struct Prune p;
+    char blob[MAX_PATH + sizeof(BACKUP_PACKED)];
+    ULONG i, kept = 0;
+    BOOL ok = FALSE;
+    
+    *entries = 0;
+    *blobs = 0;
+    
+    memset(&p, 0, sizeof(p));
+    if (!(p.pool = CreatePool(MEMF_ANY, 4096, 4096)))
+        return FALSE;
+    
+    if (LoadPrune(&p, dir) && CollectBlobs(&p))
+    {
+        ApplyLimits(&p, policy);
+        qsort(p.entries, p.count, sizeof(struct PruneEntry), CompareSeq);
+        ApplyBudget(&p, policy);
+    
+        for (i = 0; i < p.count; i++)
+        {
+            if (p.entries[i].keep)
+                kept++;
+        }
+    
+        ok = kept == p.count || WriteIndex(&p, dir);
+        if (ok)
+        {
+            *entries = p.count - kept;
+            for (i = 0; i < p.numBlobs; i++)
+            {
+                if (p.blobs[i].refs)
+                    continue;
+    
+                BackupBlobName(dir, p.blobs[i].checksum, p.blobs[i].size, blob);
+                if (!DeleteFile(blob))
+                {
+                    strcat(blob, BACKUP_PACKED);
+                    DeleteFile(blob);
+                }
+                (*blobs)++;
+            }
+        }
+    }
+    
+    if (p.blobs) FreeVec(p.blobs);
+    if (p.entries) FreeVec(p.entries);
+    DeletePool(p.pool);
+    return ok;
+}
+
+BOOL StoreBackup(struct CopyEngine *ce, const char *dir, const char *file,
+                 const char *original, BOOL move)
+{
+    struct SignalSemaphore *sem;
+    BOOL ok;
+    
+    if (!(sem = GetStoreSemaphore()))
+        return FALSE;
+    
+    ObtainSemaphore(sem);
+    ok = AddToStore(ce, dir, file, original, move);
+    ReleaseSemaphore(sem);
+    return ok;
+}
+
+BOOL FindBackup(const char *dir, const char *path, ULONG skip, struct BackupEntry *entry)
+{
+    struct SignalSemaphore *sem;
+    BOOL ok;
+    
+    if (!(sem = GetStoreSemaphore()))
+        return FALSE;
+    
+    ObtainSemaphoreShared(sem);
+    ok = SearchIndex(dir, path, skip, entry);
+    ReleaseSemaphore(sem);
+    return ok;
+}
+
+BOOL RestoreBackup(struct CopyEngine *ce, const char *dir, const struct BackupEntry *entry,
+                   const char *dest)
+{
+    struct SignalSemaphore *sem;
+    BOOL ok;
+    
+    if (!(sem = GetStoreSemaphore()))
+        return FALSE;
+    
+    ObtainSemaphoreShared(sem);
+    ok = CopyFromStore(ce, dir, entry, dest);
+    ReleaseSemaphore(sem);
+    return ok;
+}
+
+// Held from reading the index to deleting the last blob, so no backup can
+// be added to a blob the prune has found unused, or to an index it is
+// about to replace
+BOOL PruneBackups(const char *dir, const struct BackupPolicy *policy, ULONG *entries, ULONG *blobs)
+{
+    struct SignalSemaphore *sem;
+    BOOL ok;
+    
+    *entries = 0;
+    *blobs = 0;
+    if (!(sem = GetStoreSemaphore()))
+        return FALSE;
+    
+    ObtainSemaphore(sem);
+    ok = PruneStore(dir, policy, entries, blobs);
+    ReleaseSemaphore(sem);
+    return ok;
+}
@@ -0,0 +1,57 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include "Shared.h"
+#include "CopyEngine.h"
+#include <exec/semaphores.h>
+
+#define BACKUP_INDEX     "index"        // In the store directory
+#define BACKUP_INDEX_NEW "index.new"    // Written by a prune, then renamed
+#define BACKUP_TEMP      "incoming"     // Copy in progress
+#define BACKUP_PACKED    ".lz"          // Suffix of a compressed blob
+#define BACKUP_RAW_PATTERN "????????" "-????????"  // Split, "??-" is a trigraph
+#define BACKUP_BLOB_NAME 18             // Raw blob name with its terminator
+#define BACKUP_MAX_LINE  (MAX_PATH + 64)
+#define BACKUP_SEMAPHORE_NAME "QuickUpdate.store"
+
+// Backup store: every distinct content is kept once, as a blob named after
+// its checksum and size. The index records each backup taken, one line
+// appended per backup:
+//   B|<checksum hex>|<size>|<days>|<minute>|<tick>|<original path>
+// Backing up content already in the store only appends a line. Blobs may
+// later be compressed in place (see Lz.h) and are unpacked on restore.
+// Public semaphore held by every operation on a store, so a prune or
+// compression never works from an index another process is appending to.
+// Batch installs take it inside the batch semaphore, never the other way.
+struct BackupSemaphore {
+    struct SignalSemaphore sem;
+    char name[sizeof(BACKUP_SEMAPHORE_NAME)];
+};
+
+struct BackupEntry {
+    ULONG checksum;
+    ULONG size;
+    struct DateStamp date;      // When the backup was taken
+    char path[MAX_PATH];        // Where the file was installed
+};
+
+// Retention for PruneBackups(), zero disables a limit
+struct BackupPolicy {
+    ULONG keep;                 // Backups kept per file
+    ULONG maxDays;              // Age in days
+    ULONG budget;               // Bytes of unpacked blobs
+};
+
+void BackupBlobName(const char *dir, ULONG checksum, ULONG size, char *buffer);
+void BackupPathName(const char *path, char *buffer);
+
+// Both take the installed path in any form, the index holds full paths
+BOOL StoreBackup(struct CopyEngine *ce, const char *dir, const char *file,
+                 const char *original, BOOL move);
+BOOL FindBackup(const char *dir, const char *path, ULONG skip, struct BackupEntry *entry);
+BOOL RestoreBackup(struct CopyEngine *ce, const char *dir, const struct BackupEntry *entry,
+                   const char *dest);
+BOOL CompressBackups(const char *dir, ULONG *files, LONG *saved);
+BOOL PruneBackups(const char *dir, const struct BackupPolicy *policy, ULONG *entries, ULONG *blobs);
+
+#endif /* BACKUP_H */
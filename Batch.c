@@ -0,0 +1,491 @@
+#include "Batch.h"
+#include "Backup.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef BATCH_CRASHTEST
+#include "BatchCrash.h"
+#endif
+
+#define BATCH_JOURNAL_VERSION 1
+
+struct Batch *CreateBatch(struct CopyEngine *ce, BOOL verify)
+{
+    struct Batch *b;
+    
+    if ((b = AllocVec(sizeof(struct Batch), MEMF_CLEAR)))
+    {
+        b->ce = ce;
+        b->verify = verify;
+    }
+    return b;
+}
+
+void DeleteBatch(struct Batch *b)
+{
+    if (b)
+    {
+        if (b->entries) FreeVec(b->entries);
+        FreeVec(b);
+    }
+}
+
+static struct BatchEntry *NewEntry(struct Batch *b)
+{
+    struct BatchEntry *entries;
+    ULONG max;
+    
+    if (b->count >= BATCH_MAX_FILES)
+        return NULL;
+    
+    if (b->count == b->max)
+    {
+        max = b->max ? b->max * 2 : 16;
+        if (!(entries = AllocVec(max * sizeof(struct BatchEntry), MEMF_CLEAR)))
+            return NULL;
+        if (b->entries)
+        {
+            memcpy(entries, b->entries, b->count * sizeof(struct BatchEntry));
+            FreeVec(b->entries);
+        }
+        b->entries = entries;
+        b->max = max;
+    }
+    return &b->entries[b->count++];
+}
+
+BOOL AddBatchFile(struct Batch *b, const char *source, const char *dest)
+{
+    struct BatchEntry *e;
+    
+    if (strlen(source) >= MAX_PATH || strlen(dest) >= MAX_PATH || !(e = NewEntry(b)))
+        return FALSE;
+    
+    strcpy(e->source, source);
+    strcpy(e->dest, dest);
+    e->expect = 0;
+    return TRUE;
+}
+
+static BOOL Exists(const char *path)
+{
+    BPTR lock;
+    
+    if ((lock = Lock(path, ACCESS_READ)))
+    {
+        UnLock(lock);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Short names, so they fit where the destination's name did
+static void SideName(const struct BatchEntry *e, const char *prefix, ULONG index, char *buffer)
+{
+    char name[16];
+    
+    strcpy(buffer, e->dest);
+    *PathPart(buffer) = '\0';
+    sprintf(name, "%s%03lu", prefix, index);
+    AddPart(buffer, name, MAX_PATH);
+}
+
+// Ask the handler to write out what it still holds in memory
+static void FlushVolume(const char *path)
+{
+    struct DevProc *dvp;
+    
+    if ((dvp = GetDeviceProc(path, NULL)))
+    {
+        DoPkt(dvp->dvp_Port, ACTION_FLUSH, 0, 0, 0, 0, 0);
+        FreeDeviceProc(dvp);
+    }
+}
+
+// Entries are sorted, so consecutive ones mostly share a volume
+static void FlushVolumes(struct Batch *b)
+{
+    ULONG i;
+    
+    for (i = 0; i < b->count; i++)
+    {
+        if (i == 0 || strnicmp(b->entries[i].dest, b->entries[i - 1].dest,
+                               PathPart(b->entries[i].dest) - b->entries[i].dest) != 0)
+        {
+            FlushVolume(b->entries[i].dest);
+        }
+    }
+    FlushVolume(BATCH_JOURNAL);
+}
+
+static int CompareEntries(const void *a, const void *b)
+{
+    return stricmp(((const struct BatchEntry *)a)->dest, ((const struct BatchEntry *)b)->dest);
+}
+
+static BOOL WriteJournal(struct Batch *b)
+{
+    BPTR fh;
+    ULONG i;
+    BOOL ok;
+    
+    if (!(fh = Open(BATCH_JOURNAL, MODE_NEWFILE)))
+        return FALSE;
+    
+    ok = FPrintf(fh, "QUJ|%ld\n", BATCH_JOURNAL_VERSION) >= 0;
+    for (i = 0; ok && i < b->count; i++)
+    {
+        ok = FPrintf(fh, "F|%ld|%s\n", (LONG)b->entries[i].hadOld, (LONG)b->entries[i].dest) >= 0;
+    }
+    if (!Close(fh))
+        ok = FALSE;
+    
+    FlushVolume(BATCH_JOURNAL);
+    return ok;
+}
+
+// The journal is only appended to once written, so a crash can never
+// leave it with fewer entries than were staged
+static BOOL MarkJournal(const char *mark)
+{
+    BPTR fh;
+    BOOL ok;
+    
+    if (!(fh = Open(BATCH_JOURNAL, MODE_READWRITE)))
+        return FALSE;
+    
+    ok = Seek(fh, 0, OFFSET_END) != -1 && FPuts(fh, mark) == 0;
+    
+    if (!Close(fh))
+        ok = FALSE;
+    
+    FlushVolume(BATCH_JOURNAL);
+    return ok;
+}
+
+// Returns FALSE for a damaged journal
+static BOOL LoadJournal(struct Batch *b, BOOL *committed)
+{
+    struct BatchEntry *e;
+    char line[MAX_PATH + 16];
+    char *nl;
+    BPTR fh;
+    BOOL ok = FALSE;
+    
+    *committed = FALSE;
+    
+    if (!(fh = Open(BATCH_JOURNAL, MODE_OLDFILE)))
+        return FALSE;
+    
+    if (FGets(fh, line, sizeof(line)) && strncmp(line, "QUJ|", 4) == 0 &&
+        strtoul(line + 4, NULL, 10) == BATCH_JOURNAL_VERSION)
+    {
+        ok = TRUE;
+        while (ok && FGets(fh, line, sizeof(line)))
+        {
+            // A last line cut short can only be a mark being appended
+            if (!(nl = strchr(line, '\n')))
+                break;
+            *nl = '\0';
+    
+            if (line[0] == 'C' && line[1] == '\0')
+            {
+                *committed = TRUE;
+            }
+            else if (line[0] == 'U' && line[1] == '\0' && *committed)
+            {
+                *committed = FALSE;
+                break;
+            }
+            else if (line[0] == 'F' && line[1] == '|' && (line[2] == '0' || line[2] == '1') &&
+                     line[3] == '|' && !*committed && (e = NewEntry(b)))
+            {
+                e->hadOld = line[2] == '1';
+                strcpy(e->dest, line + 4);
+            }
+            else
+            {
+                ok = FALSE;
+            }
+        }
+    }
+    Close(fh);
+    
+    return ok;
+}
+
+static BOOL StageFiles(struct Batch *b)
+{
+    struct BatchEntry *e;
+    char stage[MAX_PATH];
+    ULONG i;
+    
+    for (i = 0; i < b->count; i++)
+    {
+        e = &b->entries[i];
+        SideName(e, BATCH_NEW_PREFIX, i, stage);
+    
+        if (!CopyEngineFile(b->ce, e->source, stage))
+        {
+            PrintFault(IoErr(), e->source);
+            return FALSE;
+        }
+        e->checksum = b->ce->checksum;
+    
+        // The source was checked, but may have been replaced since
+        if (e->expect && e->checksum != e->expect)
+        {
+            Printf("Error: %s changed since it was checked\n", (LONG)e->source);
+            return FALSE;
+        }
+    
+        if (b->verify && !VerifyCopy(b->ce, stage, b->ce->checksum))
+        {
+            Printf("Error: %s does not match %s\n", (LONG)stage, (LONG)e->source);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Also finishes an interrupted commit: each step is skipped once done
+static BOOL CommitFiles(struct Batch *b)
+{
+    struct BatchEntry *e;
+    char stage[MAX_PATH];
+    char old[MAX_PATH];
+    ULONG i;
+    
+    for (i = 0; i < b->count; i++)
+    {
+        e = &b->entries[i];
+        SideName(e, BATCH_NEW_PREFIX, i, stage);
+        SideName(e, BATCH_OLD_PREFIX, i, old);
+    
+        if (!Exists(stage))
+            continue;
+    
+        if (e->hadOld && !Exists(old) && !Rename(e->dest, old))
+        {
+            PrintFault(IoErr(), e->dest);
+            return FALSE;
+        }
+    
+        if (!Rename(stage, e->dest))
+        {
+            PrintFault(IoErr(), e->dest);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Puts back every file replaced so far and removes the staged copies
+static void RollBack(struct Batch *b)
+{
+    struct BatchEntry *e;
+    char stage[MAX_PATH];
+    char old[MAX_PATH];
+    ULONG i;
+    
+    for (i = 0; i < b->count; i++)
+    {
+        e = &b->entries[i];
+        SideName(e, BATCH_NEW_PREFIX, i, stage);
+        SideName(e, BATCH_OLD_PREFIX, i, old);
+    
+        if (Exists(old))
+        {
+            DeleteFile(e->dest);
+            Rename(old, e->dest);
+        }
+        else if (!e->hadOld && !Exists(stage))
+        {
+            // A new file that was already swapped in
+            DeleteFile(e->dest);
+        }
+        DeleteFile(stage);
+    }
+}
+
+// The only pass over the old files: each is renamed into the backup store
+// when that is on the same volume, copied otherwise
+static void BackupOld(struct Batch *b, const char *backupDir)
+{
+    struct BatchEntry *e;
+    char old[MAX_PATH];
+    ULONG i;
+    
+    for (i = 0; i < b->count; i++)
+    {
+        e = &b->entries[i];
+        SideName(e, BATCH_OLD_PREFIX, i, old);
+    
+        if (!e->hadOld || !Exists(old))
+            continue;
+    
+        if (!b->ce || !StoreBackup(b->ce, backupDir, old, e->dest, TRUE))
+        {
+            Printf("Warning: Could not back up %s, kept as %s\n", (LONG)e->dest, (LONG)old);
+        }
+    }
+}
+
+// Find or create the public semaphore guarding the journal
+static struct SignalSemaphore *GetBatchSemaphore(void)
+{
+    struct SignalSemaphore *sem;
+    struct BatchSemaphore *bs;
+    
+    Forbid();
+    if (!(sem = FindSemaphore(BATCH_SEMAPHORE_NAME)))
+    {
+        // Never freed, another process may find it at any time
+        if ((bs = AllocMem(sizeof(struct BatchSemaphore), MEMF_PUBLIC|MEMF_CLEAR)))
+        {
+            strcpy(bs->name, BATCH_SEMAPHORE_NAME);
+            bs->sem.ss_Link.ln_Name = bs->name;
+            bs->sem.ss_Link.ln_Pri = 0;
+            AddSemaphore(&bs->sem);
+            sem = &bs->sem;
+        }
+    }
+    Permit();
+    
+    return sem;
+}
+
+static BOOL InstallBatch(struct Batch *b, const char *backupDir)
+{
+    char stage[MAX_PATH];
+    char old[MAX_PATH];
+    ULONG i;
+    
+    if (BatchPending())
+    {
+        Printf("Error: An earlier batch install was not finished\n");
+        return FALSE;
+    }
+    
+    qsort(b->entries, b->count, sizeof(struct BatchEntry), CompareEntries);
+    
+    for (i = 0; i < b->count; i++)
+    {
+        SideName(&b->entries[i], BATCH_NEW_PREFIX, i, stage);
+        SideName(&b->entries[i], BATCH_OLD_PREFIX, i, old);
+    
+        // Left behind by a failed backup pass, it may be the only copy
+        if (Exists(stage) || Exists(old))
+        {
+            Printf("Error: Remove %s and %s first\n", (LONG)stage, (LONG)old);
+            return FALSE;
+        }
+        b->entries[i].hadOld = Exists(b->entries[i].dest);
+    }
+    
+    if (!WriteJournal(b))
+    {
+        Printf("Error: Cannot write %s\n", (LONG)BATCH_JOURNAL);
+        return FALSE;
+    }
+    
+    if (StageFiles(b))
+    {
+        FlushVolumes(b);
+    
+        if (MarkJournal("C\n"))
+        {
+            if (CommitFiles(b))
+            {
+                FlushVolumes(b);
+                BackupOld(b, backupDir);
+                DeleteFile(BATCH_JOURNAL);
+                return TRUE;
+            }
+    
+            // Take the commit back before undoing, so a crash while
+            // rolling back still ends with the old files
+            MarkJournal("U\n");
+        }
+    }
+    
+    RollBack(b);
+    FlushVolumes(b);
+    DeleteFile(BATCH_JOURNAL);
+    return FALSE;
+}
+
+// Waits for any other install to finish first
+BOOL RunBatch(struct Batch *b, const char *backupDir)
+{
+    struct SignalSemaphore *sem;
+    BOOL success;
+    
+    if (!(sem = GetBatchSemaphore()))
+    {
+        PrintFault(ERROR_NO_FREE_STORE, "QuickUpdate");
+        return FALSE;
+    }
+    
+    ObtainSemaphore(sem);
+    success = InstallBatch(b, backupDir);
+    ReleaseSemaphore(sem);
+    
+    return success;
+}
+
+BOOL BatchPending(void)
+{
+    return Exists(BATCH_JOURNAL);
+}
+
+static LONG RecoverJournal(struct Batch *b, const char *backupDir)
+{
+    BOOL committed;
+    
+    if (!BatchPending())
+        return BATCH_NONE;
+    
+    if (!LoadJournal(b, &committed))
+        return BATCH_FAILED;
+    
+    if (committed)
+    {
+        if (!CommitFiles(b))
+            return BATCH_FAILED;
+    
+        FlushVolumes(b);
+        BackupOld(b, backupDir);
+        DeleteFile(BATCH_JOURNAL);
+        return BATCH_FORWARD;
+    }
+    
+    RollBack(b);
+    FlushVolumes(b);
+    DeleteFile(BATCH_JOURNAL);
+    return BATCH_BACK;
+}
+
+// After a crash: finish a committed batch, undo any other. A journal
+// whose semaphore is held belongs to a running install and is left alone.
+LONG RecoverBatch(struct Batch *b, const char *backupDir)
+{
+    struct SignalSemaphore *sem;
+    LONG result;
+    
+    if (!(sem = GetBatchSemaphore()))
+        return BATCH_FAILED;
+    
+    if (!AttemptSemaphore(sem))
+        return BATCH_BUSY;
+    
+    result = RecoverJournal(b, backupDir);
+    ReleaseSemaphore(sem);
+    
+    return result;
+}
@@ -0,0 +1,63 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "Shared.h"
+#include "CopyEngine.h"
+#include <exec/semaphores.h>
+
+#define BATCH_JOURNAL     "PROGDIR:QuickUpdate.journal"
+#define BATCH_NEW_PREFIX  ".qunew"      // Staged copy, next to the destination
+#define BATCH_OLD_PREFIX  ".quold"      // Replaced file until the backup pass
+#define BATCH_MAX_FILES   999           // Side names carry three digits
+#define BATCH_SEMAPHORE_NAME "QuickUpdate.batch"
+
+// RecoverBatch() results
+#define BATCH_NONE     0    // No journal
+#define BATCH_FORWARD  1    // Batch was committed, finished
+#define BATCH_BACK     2    // Batch was not committed, undone
+#define BATCH_FAILED   3
+#define BATCH_BUSY     4    // Another process is running the batch
+
+struct BatchEntry {
+    char source[MAX_PATH];
+    char dest[MAX_PATH];
+    BOOL hadOld;        // Destination existed when the batch was planned
+    ULONG checksum;     // Of the source, hashed while it was staged
+    ULONG expect;       // What checksum must be, 0: anything
+};
+
+// Installs a set of files as one transaction. Every file is first staged
+// next to its destination and the journal lists them; once all are staged
+// a commit mark is appended and the files are swapped in with renames.
+// A crash before the mark rolls back, after it rolls forward. The files
+// replaced are moved to the backup directory in one pass at the end.
+//
+// Journal, one line each:
+//   QUJ|<version>
+//   F|<hadOld>|<destination>       Entry n uses .qunew<n> and .quold<n>
+//   C                              Committed
+//   U                              Commit failed, being undone
+// Public semaphore held for the whole of a batch install or recovery, so
+// one process never rolls back a batch another is still staging. It does
+// not outlive a reset, which is exactly when a journal needs recovering.
+struct BatchSemaphore {
+    struct SignalSemaphore sem;
+    char name[sizeof(BATCH_SEMAPHORE_NAME)];
+};
+
+struct Batch {
+    struct BatchEntry *entries;
+    ULONG count;
+    ULONG max;
+    struct CopyEngine *ce;
+    BOOL verify;        // Read every staged file back
+};
+
+struct Batch *CreateBatch(struct CopyEngine *ce, BOOL verify);
+void DeleteBatch(struct Batch *b);
+BOOL AddBatchFile(struct Batch *b, const char *source, const char *dest);
+BOOL RunBatch(struct Batch *b, const char *backupDir);
+BOOL BatchPending(void);
+LONG RecoverBatch(struct Batch *b, const char *backupDir);
+
+#endif /* BATCH_H */
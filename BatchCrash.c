@@ -0,0 +1,530 @@
+// BatchCrash - crash test of batch installs
+//
+// Installs a few files into a scratch directory as one batch and stops
+// it before its first file system operation, then before its second and
+// so on, as a crash would. Each stopped batch is recovered the way
+// QuickUpdate does at start-up, with the recovery itself stopped before
+// each of its operations and then run again. Every run is repeated with
+// each rename of the commit failing in turn, so rollbacks are stopped
+// too. Afterwards the files must be either all old or all new, with no
+// journal and no staged or replaced copies left.
+//
+// The journal is PROGDIR:QuickUpdate.journal, so copy the tool to a
+// scratch drawer, e.g. RAM:, and run it there.
+
+#include "Batch.h"
+#include "BatchCrash.h"
+#include "Backup.h"
+#include "DirIter.h"
+
+#include <exec/types.h>
+#include <exec/memory.h>
+#include <exec/semaphores.h>
+#include <dos/dos.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <setjmp.h>
+
+#define MAX_FILES   8
+#define MAX_HANDLES 4
+
+// RunOnce() results
+#define RUN_OK    0
+#define RUN_BAD   1     // Files left inconsistent
+#define RUN_ERROR 2     // The test itself failed
+
+// FileState() results
+#define STATE_MISSING 0
+#define STATE_OLD     1
+#define STATE_NEW     2
+#define STATE_OTHER   3
+
+struct DosLibrary *DOSBase = NULL;
+
+static const char template[] = "DIR/A,FILES/K/N";
+struct {
+    char *dir;          // Scratch directory
+    LONG *files;        // Files per batch, default 3
+} args;
+
+struct RunCounts {
+    ULONG batchOps;     // Operations the batch got to
+    ULONG renames;      // Renames among them
+    ULONG recoverOps;   // Operations the first recovery got to
+};
+
+static jmp_buf crashJump;
+static ULONG ops;               // Operations of the batch or recovery so far
+static ULONG crashAt;           // Stop before this operation, 0: never
+static ULONG renames;
+static ULONG failRename;        // Fail this rename, 0: none
+static BPTR handles[MAX_HANDLES];   // Files the batch has open
+
+static char libsDir[MAX_PATH];  // Destinations
+static char newDir[MAX_PATH];   // Sources
+static char backupDir[MAX_PATH];
+static ULONG numFiles;
+
+// Before every operation: a crash leaves the disk as it is
+static void CrashPoint(void)
+{
+    if (++ops == crashAt)
+        longjmp(crashJump, 1);
+}
+
+BPTR CrashOpen(const char *name, LONG mode)
+{
+    BPTR fh;
+    ULONG i;
+    
+    CrashPoint();
+    if ((fh = Open((STRPTR)name, mode)))
+    {
+        for (i = 0; i < MAX_HANDLES && handles[i]; i++)
+            ;
+        if (i < MAX_HANDLES)
+            handles[i] = fh;
+    }
+    return fh;
+}
+
+LONG CrashClose(BPTR fh)
+{
+    ULONG i;
+    
+    CrashPoint();
+    for (i = 0; i < MAX_HANDLES; i++)
+    {
+        if (handles[i] == fh)
+            handles[i] = 0;
+    }
+    return Close(fh);
+}
+
+LONG CrashFPrintf(BPTR fh, const char *format, ...)
+{
+    va_list ap;
+    LONG result;
+    
+    CrashPoint();
+    va_start(ap, format);
+    result = VFPrintf(fh, (STRPTR)format, (LONG *)ap);
+    va_end(ap);
+    return result;
+}
+
+LONG CrashFPuts(BPTR fh, const char *string)
+{
+    CrashPoint();
+    return FPuts(fh, (STRPTR)string);
+}
+
+LONG CrashRename(const char *from, const char *to)
+{
+    CrashPoint();
+    if (++renames == failRename)
+    {
+        // As when the file is in use on a handler that checks for it
+        SetIoErr(ERROR_OBJECT_IN_USE);
+        return DOSFALSE;
+    }
+    return Rename((STRPTR)from, (STRPTR)to);
+}
+
+LONG CrashDeleteFile(const char *name)
+{
+    CrashPoint();
+    return DeleteFile((STRPTR)name);
+}
+
+BOOL CrashCopyEngineFile(struct CopyEngine *ce, const char *source, const char *dest)
+{
+    CrashPoint();
+    return CopyEngineFile(ce, source, dest);
+}
+
+BOOL CrashStoreBackup(struct CopyEngine *ce, const char *dir, const char *file,
+                      const char *original, BOOL move)
+{
+    CrashPoint();
+    return StoreBackup(ce, dir, file, original, move);
+}
+
+// What a reset does to a stopped batch: its open files are closed, as if
+// all that was written had reached the disk, and the semaphores are gone
+static void AfterCrash(void)
+{
+    struct Task *me = FindTask(NULL);
+    struct SignalSemaphore *sem;
+    ULONG i;
+    
+    for (i = 0; i < MAX_HANDLES; i++)
+    {
+        if (handles[i])
+        {
+            Close(handles[i]);
+            handles[i] = 0;
+        }
+    }
+    
+    Forbid();
+    if ((sem = FindSemaphore((STRPTR)BATCH_SEMAPHORE_NAME)))
+    {
+        while (sem->ss_Owner == me)
+            ReleaseSemaphore(sem);
+    }
+    Permit();
+}
+
+static void FileName(const char *dir, ULONG i, char *buffer)
+{
+    char name[32];
+    
+    strcpy(buffer, dir);
+    sprintf(name, "test%lu.library", i);
+    AddPart(buffer, name, MAX_PATH);
+}
+
+static BOOL WriteText(const char *path, const char *text)
+{
+    BPTR fh;
+    BOOL ok;
+    
+    if (!(fh = Open((STRPTR)path, MODE_NEWFILE)))
+        return FALSE;
+    
+    ok = Write(fh, (APTR)text, strlen(text)) == (LONG)strlen(text);
+    if (!Close(fh))
+        ok = FALSE;
+    
+    return ok;
+}
+
+static LONG FileState(ULONG i)
+{
+    char path[MAX_PATH];
+    char text[32];
+    char want[32];
+    BPTR fh;
+    LONG len;
+    
+    FileName(libsDir, i, path);
+    if (!(fh = Open(path, MODE_OLDFILE)))
+        return STATE_MISSING;
+    
+    len = Read(fh, text, sizeof(text) - 1);
+    Close(fh);
+    if (len < 0)
+        return STATE_OTHER;
+    text[len] = '\0';
+    
+    sprintf(want, "old %lu\n", i);
+    if (strcmp(text, want) == 0)
+        return STATE_OLD;
+    
+    sprintf(want, "new %lu\n", i);
+    if (strcmp(text, want) == 0)
+        return STATE_NEW;
+    
+    return STATE_OTHER;
+}
+
+static LONG CountEntries(const char *dir)
+{
+    struct DirIter *it;
+    BPTR lock;
+    LONG count = -1;
+    
+    if ((it = CreateDirIter(NULL, DIRITER_BUFFER_SIZE)))
+    {
+        if ((lock = Lock((STRPTR)dir, ACCESS_READ)))
+        {
+            if (StartDirIter(it, lock))
+            {
+                count = 0;
+                while (NextDirEntry(it))
+                    count++;
+                if (it->error)
+                    count = -1;
+                EndDirIter(it);
+            }
+            UnLock(lock);
+        }
+        DeleteDirIter(it);
+    }
+    return count;
+}
+
+// Every run starts from the old files; the last file is new to the system
+static BOOL ResetFiles(void)
+{
+    char path[MAX_PATH];
+    char name[16];
+    char text[32];
+    ULONG i;
+    
+    for (i = 0; i < numFiles; i++)
+    {
+        strcpy(path, libsDir);
+        sprintf(name, "%s%03lu", BATCH_NEW_PREFIX, i);
+        AddPart(path, name, MAX_PATH);
+        DeleteFile(path);
+    
+        strcpy(path, libsDir);
+        sprintf(name, "%s%03lu", BATCH_OLD_PREFIX, i);
+        AddPart(path, name, MAX_PATH);
+        DeleteFile(path);
+    
+        FileName(libsDir, i, path);
+        DeleteFile(path);
+    
+        sprintf(text, "old %lu\n", i);
+        if (i < numFiles - 1 && !WriteText(path, text))
+            return FALSE;
+    }
+    
+    return CountEntries(libsDir) == (LONG)(numFiles - 1);
+}
+
+// NULL if the files are all old or all new and nothing else is left,
+// *state tells which
+static const char *CheckFiles(LONG *state)
+{
+    LONG s;
+    ULONG i;
+    
+    *state = STATE_MISSING;
+    for (i = 0; i < numFiles; i++)
+    {
+        s = FileState(i);
+        if (i == numFiles - 1 && s == STATE_MISSING)
+            s = STATE_OLD;
+    
+        if (s != STATE_OLD && s != STATE_NEW)
+            return "a file is missing or damaged";
+        if (i > 0 && s != *state)
+            return "old and new files are mixed";
+        *state = s;
+    }
+    
+    if (BatchPending())
+        return "the journal was left";
+    
+    if (CountEntries(libsDir) != (LONG)(*state == STATE_NEW ? numFiles : numFiles - 1))
+        return "staged or replaced copies were left";
+    
+    return NULL;
+}
+
+static BOOL Recover(struct CopyEngine *ce, ULONG crash, ULONG *count)
+{
+    struct Batch *b;
+    
+    if (!(b = CreateBatch(ce, FALSE)))
+        return FALSE;
+    
+    ops = 0;
+    crashAt = crash;
+    if (!setjmp(crashJump))
+        RecoverBatch(b, backupDir);
+    else
+        AfterCrash();
+    crashAt = 0;
+    
+    if (count)
+        *count = ops;
+    DeleteBatch(b);
+    return TRUE;
+}
+
+// One batch stopped before operation crash (0: never) with rename fail
+// failing (0: none), then recovered with the first recovery stopped
+// before operation recoverCrash (0: never)
+static LONG RunOnce(struct CopyEngine *ce, ULONG crash, ULONG fail, ULONG recoverCrash,
+                    struct RunCounts *counts)
+{
+    struct Batch *b;
+    char source[MAX_PATH];
+    char dest[MAX_PATH];
+    const char *why;
+    LONG state;
+    BOOL crashed;
+    ULONG i;
+    
+    if (!ResetFiles())
+    {
+        Printf("Error: Cannot reset the files in %s\n", (LONG)libsDir);
+        return RUN_ERROR;
+    }
+    if (!(b = CreateBatch(ce, FALSE)))
+        return RUN_ERROR;
+    
+    for (i = 0; i < numFiles; i++)
+    {
+        FileName(newDir, i, source);
+        FileName(libsDir, i, dest);
+        if (!AddBatchFile(b, source, dest))
+        {
+            DeleteBatch(b);
+            return RUN_ERROR;
+        }
+    }
+    
+    ops = renames = 0;
+    crashAt = crash;
+    failRename = fail;
+    crashed = FALSE;
+    if (!setjmp(crashJump))
+    {
+        RunBatch(b, backupDir);
+    }
+    else
+    {
+        AfterCrash();
+        crashed = TRUE;
+    }
+    crashAt = failRename = 0;
+    counts->batchOps = ops;
+    counts->renames = renames;
+    DeleteBatch(b);
+    
+    if (!Recover(ce, recoverCrash, &counts->recoverOps) || !Recover(ce, 0, NULL))
+        return RUN_ERROR;
+    
+    if ((why = CheckFiles(&state)) == NULL && !crashed)
+    {
+        if (!fail && state != STATE_NEW)
+            why = "the batch did not install";
+        else if (fail && counts->renames >= fail && state != STATE_OLD)
+            why = "the failed batch was not undone";
+    }
+    
+    if (why)
+    {
+        Printf("Batch stopped at operation %lu, rename %lu failing, recovery stopped at %lu: %s\n",
+               crash, fail, recoverCrash, (LONG)why);
+        return RUN_BAD;
+    }
+    return RUN_OK;
+}
+
+static LONG RunCrashTest(struct CopyEngine *ce)
+{
+    struct RunCounts counts;
+    ULONG fail, crash, recover, total;
+    ULONG runs = 0, bad = 0;
+    LONG result;
+    
+    for (fail = 0; ; fail++)
+    {
+        // A run without a crash tells how many operations there are
+        if ((result = RunOnce(ce, 0, fail, 0, &counts)) == RUN_ERROR)
+            return RETURN_FAIL;
+        runs++;
+        if (result == RUN_BAD)
+            bad++;
+        if (fail && counts.renames < fail)
+            break;
+        total = counts.batchOps;
+    
+        for (crash = 1; crash <= total; crash++)
+        {
+            // Until a recovery gets through without reaching its stop
+            for (recover = 1; ; recover++)
+            {
+                if (SetSignal(0, SIGBREAKF_CTRL_C) & SIGBREAKF_CTRL_C)
+                {
+                    Printf("*** Break\n");
+                    return RETURN_WARN;
+                }
+    
+                if ((result = RunOnce(ce, crash, fail, recover, &counts)) == RUN_ERROR)
+                    return RETURN_FAIL;
+                runs++;
+                if (result == RUN_BAD)
+                    bad++;
+                if (counts.recoverOps < recover)
+                    break;
+            }
+        }
+    
+        Printf("Rename %lu failing (0: none): stopped at each of %lu operations\n", fail, total);
+    }
+    
+    Printf("%lu runs, %lu left the files inconsistent\n", runs, bad);
+    return bad ? RETURN_ERROR : RETURN_OK;
+}
+
+static BOOL MakeDir(char *buffer, const char *name)
+{
+    BPTR lock;
+    
+    strcpy(buffer, args.dir);
+    AddPart(buffer, (STRPTR)name, MAX_PATH);
+    
+    if ((lock = Lock(buffer, ACCESS_READ)) || (lock = CreateDir(buffer)))
+    {
+        UnLock(lock);
+        return TRUE;
+    }
+    PrintFault(IoErr(), buffer);
+    return FALSE;
+}
+
+int main(int argc, char **argv)
+{
+    LONG result = RETURN_FAIL;
+    struct RDArgs *rdargs;
+    struct CopyEngine *ce;
+    char path[MAX_PATH];
+    char text[32];
+    BOOL ok;
+    ULONG i;
+    
+    if (!(DOSBase = (struct DosLibrary *)OpenLibrary("dos.library", 37)))
+        return RETURN_FAIL;
+    
+    if ((rdargs = ReadArgs(template, (LONG *)&args, NULL)))
+    {
+        numFiles = args.files ? *args.files : 3;
+    
+        if (numFiles < 2 || numFiles > MAX_FILES)
+        {
+            Printf("Error: FILES must be 2 to %ld\n", (LONG)MAX_FILES);
+        }
+        else if (BatchPending())
+        {
+            Printf("Error: %s exists, run this in a scratch drawer\n", (LONG)BATCH_JOURNAL);
+        }
+        else if (MakeDir(libsDir, "Libs") && MakeDir(newDir, "New") &&
+                 MakeDir(backupDir, "Backups"))
+        {
+            ok = TRUE;
+            for (i = 0; ok && i < numFiles; i++)
+            {
+                FileName(newDir, i, path);
+                sprintf(text, "new %lu\n", i);
+                ok = WriteText(path, text);
+            }
+    
+            if (!ok)
+                PrintFault(IoErr(), newDir);
+            else if ((ce = CreateCopyEngine(0, 0)))
+            {
+                result = RunCrashTest(ce);
+                DeleteCopyEngine(ce);
+            }
+        }
+        FreeArgs(rdargs);
+    }
+    else
+    {
+        PrintFault(IoErr(), "BatchCrash");
+    }
+    
+    CloseLibrary((struct Library *)DOSBase);
+    return result;
+}
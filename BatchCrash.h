@@ -0,0 +1,33 @@
+#ifndef BATCHCRASH_H
+#define BATCHCRASH_H
+
+#include "Shared.h"
+#include "CopyEngine.h"
+
+// Crash test of batch installs (BatchCrash.c). Batch.c is built a second
+// time with DEFINE=BATCH_CRASHTEST, which sends every file system
+// operation it makes through these wrappers. The tool can then stop a
+// batch before any one of them, as a crash would, or make a rename of the
+// commit fail.
+BPTR CrashOpen(const char *name, LONG mode);
+LONG CrashClose(BPTR fh);
+LONG CrashFPrintf(BPTR fh, const char *format, ...);
+LONG CrashFPuts(BPTR fh, const char *string);
+LONG CrashRename(const char *from, const char *to);
+LONG CrashDeleteFile(const char *name);
+BOOL CrashCopyEngineFile(struct CopyEngine *ce, const char *source, const char *dest);
+BOOL CrashStoreBackup(struct CopyEngine *ce, const char *dir, const char *file,
+                      const char *original, BOOL move);
+
+#ifdef BATCH_CRASHTEST
+#define Open CrashOpen
+#define Close CrashClose
+#define FPrintf CrashFPrintf
+#define FPuts CrashFPuts
+#define Rename CrashRename
+#define DeleteFile CrashDeleteFile
+#define CopyEngineFile CrashCopyEngineFile
+#define StoreBackup CrashStoreBackup
+#endif
+
+#endif /* BATCHCRASH_H */
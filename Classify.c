@@ -0,0 +1,110 @@
+#include "Classify.h"
+
+#include <proto/dos.h>
+#include <string.h>
+#include <ctype.h>
+
+#define HUNK_HEADER 0x000003F3
+#define ID_FORM     0x464F524D  // 'FORM'
+#define ID_DTYP     0x44545950  // 'DTYP'
+
+#define SUFFIX_SLOTS 16
+
+struct Suffix {
+    const char *suffix;
+    LONG type;
+};
+
+// Indexed by SuffixSlot(); the known suffixes all land in different
+// slots, so one comparison confirms a match
+static const struct Suffix suffixes[SUFFIX_SLOTS] = {
+    { NULL, FT_UNKNOWN },
+    { "datatype", FT_DATATYPE },    // 1
+    { NULL, FT_UNKNOWN },
+    { NULL, FT_UNKNOWN },
+    { NULL, FT_UNKNOWN },
+    { "class", FT_CLASS },          // 5
+    { "mcp", FT_MCP },              // 6
+    { NULL, FT_UNKNOWN },
+    { NULL, FT_UNKNOWN },
+    { "mcc", FT_MCC },              // 9
+    { "library", FT_LIBRARY },      // 10
+    { "device", FT_DEVICE },        // 11
+    { NULL, FT_UNKNOWN },
+    { "gadget", FT_GADGET },        // 13
+    { NULL, FT_UNKNOWN },
+    { "resource", FT_RESOURCE }     // 15
+};
+
+static const char *locations[NUM_FILE_TYPES] = {
+    NULL,
+    "LIBS:",
+    "DEVS:",
+    "SYS:Classes/Datatypes",
+    "DEVS:Datatypes",
+    "SYS:Classes",
+    "SYS:Classes/Gadgets",
+    NULL,
+    "SYS:Classes/MUI",
+    "SYS:Classes/MUI"
+};
+
+static const char *names[NUM_FILE_TYPES] = {
+    "unknown", "library", "device", "datatype", "descriptor",
+    "class", "gadget", "resource", "MUI class", "MUI prefs class"
+};
+
+// Perfect hash over the known suffixes: length, first and last letter
+static ULONG SuffixSlot(const char *s, ULONG len)
+{
+    return (len * 3 + tolower((UBYTE)s[0]) + tolower((UBYTE)s[len - 1])) & (SUFFIX_SLOTS - 1);
+}
+
+LONG ClassifyName(const char *name)
+{
+    const char *ext = strrchr(FilePart(name), '.');
+    const struct Suffix *s;
+    ULONG len;
+    
+    // Only the last suffix counts, "foo.v2.library" is a library
+    if (!ext || !(len = strlen(++ext)))
+        return FT_UNKNOWN;
+    
+    s = &suffixes[SuffixSlot(ext, len)];
+    if (s->suffix && stricmp(ext, s->suffix) == 0)
+        return s->type;
+    
+    return FT_UNKNOWN;
+}
+
+static ULONG GetLong(const UBYTE *p)
+{
+    return ((ULONG)p[0] << 24) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 8) | p[3];
+}
+
+LONG ClassifyFile(const char *name, const UBYTE *head, ULONG length)
+{
+    LONG type = ClassifyName(name);
+    
+    if (length == 0)
+        return type;
+    
+    // Descriptors usually have no suffix at all
+    if (length >= 12 && GetLong(head) == ID_FORM && GetLong(head + 8) == ID_DTYP)
+        return FT_DESCRIPTOR;
+    
+    if (length < 4 || GetLong(head) != HUNK_HEADER)
+        return FT_UNKNOWN;
+    
+    return type;
+}
+
+const char *FileTypeLocation(LONG type)
+{
+    return (type >= 0 && type < NUM_FILE_TYPES) ? locations[type] : NULL;
+}
+
+const char *FileTypeName(LONG type)
+{
+    return (type >= 0 && type < NUM_FILE_TYPES) ? names[type] : names[FT_UNKNOWN];
+}
@@ -0,0 +1,33 @@
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include <exec/types.h>
+
+#define CLASSIFY_HEAD 12        // Bytes of the file ClassifyFile() looks at
+
+// Component types
+#define FT_UNKNOWN    0
+#define FT_LIBRARY    1
+#define FT_DEVICE     2
+#define FT_DATATYPE   3         // Datatype class
+#define FT_DESCRIPTOR 4         // Datatype descriptor, IFF FORM DTYP
+#define FT_CLASS      5
+#define FT_GADGET     6
+#define FT_RESOURCE   7
+#define FT_MCC        8
+#define FT_MCP        9
+#define NUM_FILE_TYPES 10
+
+// By the last suffix of the name only
+LONG ClassifyName(const char *name);
+
+// By name and the first bytes of the file. Without them (length 0) this
+// is ClassifyName(); a suffix on a file that is not a hunk executable
+// says nothing.
+LONG ClassifyFile(const char *name, const UBYTE *head, ULONG length);
+
+// Where a type is installed, NULL if it has no standard place
+const char *FileTypeLocation(LONG type);
+const char *FileTypeName(LONG type);
+
+#endif /* CLASSIFY_H */
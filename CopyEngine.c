@@ -0,0 +1,401 @@
+#include "CopyEngine.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+
+struct CopyEngine *CreateCopyEngine(ULONG bufferSize, ULONG numBuffers)
+{
+    struct CopyEngine *ce;
+    ULONG i;
+    
+    if (bufferSize == 0) bufferSize = COPY_BUFFER_SIZE;
+    if (numBuffers == 0) numBuffers = COPY_BUFFERS;
+    if (numBuffers < 2) numBuffers = 2;
+    if (numBuffers > COPY_MAX_BUFFERS) numBuffers = COPY_MAX_BUFFERS;
+    
+    if (!(ce = AllocVec(sizeof(struct CopyEngine), MEMF_CLEAR)))
+        return NULL;
+    
+    if (!(ce->port = CreateMsgPort()))
+    {
+        FreeVec(ce);
+        return NULL;
+    }
+    
+    // Smaller buffers still overlap reads and writes, only with more packets
+    for (; bufferSize >= COPY_MIN_BUFFER; bufferSize /= 2)
+    {
+        if ((ce->pool = CreatePool(MEMF_ANY, bufferSize * numBuffers, bufferSize)))
+        {
+            for (i = 0; i < numBuffers; i++)
+            {
+                if (!(ce->buffers[i].data = AllocPooled(ce->pool, bufferSize)))
+                    break;
+            }
+            if (i == numBuffers)
+                break;
+    
+            DeletePool(ce->pool);
+            ce->pool = NULL;
+        }
+    }
+    
+    if (!ce->pool)
+    {
+        DeleteCopyEngine(ce);
+        return NULL;
+    }
+    
+    ce->numBuffers = numBuffers;
+    ce->bufferSize = bufferSize;
+    OpenStatsTimer();
+    
+    return ce;
+}
+
+void DeleteCopyEngine(struct CopyEngine *ce)
+{
+    if (ce)
+    {
+        if (ce->pool) DeletePool(ce->pool);
+        if (ce->port) DeleteMsgPort(ce->port);
+        FreeVec(ce);
+    }
+}
+
+static void SendBuffer(struct CopyEngine *ce, struct CopyBuffer *b, BPTR fh,
+                       LONG action, LONG length)
+{
+    struct FileHandle *h = (struct FileHandle *)BADDR(fh);
+    
+    b->sp.sp_Msg.mn_Node.ln_Name = (char *)&b->sp.sp_Pkt;
+    b->sp.sp_Pkt.dp_Link = &b->sp.sp_Msg;
+    b->sp.sp_Pkt.dp_Type = action;
+    b->sp.sp_Pkt.dp_Arg1 = h->fh_Arg1;
+    b->sp.sp_Pkt.dp_Arg2 = (LONG)b->data;
+    b->sp.sp_Pkt.dp_Arg3 = length;
+    b->action = action;
+    b->state = CB_BUSY;
+    
+    SendPkt(&b->sp.sp_Pkt, h->fh_Type, ce->port);
+}
+
+// Handles without a handler port (NIL:) only work through Read() and Write()
+static LONG CopySync(struct CopyEngine *ce, BPTR from, BPTR to, ULONG *crc, ULONG *size)
+{
+    UBYTE *data = ce->buffers[0].data;
+    LONG len;
+    
+    while ((len = Read(from, data, ce->bufferSize)) > 0)
+    {
+        *crc = UpdateCRC32(*crc, data, len);
+        *size += len;
+        if (to && Write(to, data, len) != len)
+            return IoErr() ? IoErr() : ERROR_DISK_FULL;
+        ce->bytes += to ? len : 0;
+    }
+    return len < 0 ? IoErr() : 0;
+}
+
+// Both handles must be freshly opened, nothing may sit in their buffers.
+// One read and one write are in flight at a time; with more than two
+// buffers a slow destination does not stop the source at once. The data
+// is checksummed as it arrives, while the next read and write are out.
+BOOL CopyHandles(struct CopyEngine *ce, BPTR from, BPTR to)
+{
+    struct FileHandle *in = (struct FileHandle *)BADDR(from);
+    struct FileHandle *out = (struct FileHandle *)BADDR(to);
+    struct CopyBuffer *b, *hash = NULL;
+    struct Message *msg;
+    struct timeval start;
+    ULONG r = 0, w = 0;         // Next buffer to read into, to write from
+    BOOL reading = FALSE, writing = FALSE, eof = FALSE;
+    ULONG crc = 0xFFFFFFFF;
+    ULONG size = 0;
+    LONG error = 0;
+    LONG res;
+    ULONG i;
+    
+    StatStart(&start);
+    
+    if (!in->fh_Type || !out->fh_Type)
+    {
+        error = CopySync(ce, from, to, &crc, &size);
+        ce->checksum = crc ^ 0xFFFFFFFF;
+        StatStop(&ce->time, &start);
+        SetIoErr(error);
+        return error == 0;
+    }
+    
+    for (i = 0; i < ce->numBuffers; i++)
+    {
+        ce->buffers[i].state = CB_FREE;
+    }
+    
+    for (;;)
+    {
+        if (!reading && !eof && !error && ce->buffers[r].state == CB_FREE)
+        {
+            SendBuffer(ce, &ce->buffers[r], from, ACTION_READ, ce->bufferSize);
+            reading = TRUE;
+        }
+    
+        if (!writing && !error && ce->buffers[w].state == CB_FULL)
+        {
+            SendBuffer(ce, &ce->buffers[w], to, ACTION_WRITE, ce->buffers[w].length);
+            writing = TRUE;
+        }
+    
+        // Hashed while the handlers work on the packets just sent
+        if (hash)
+        {
+            crc = UpdateCRC32(crc, hash->data, hash->length);
+            hash = NULL;
+        }
+        
+        // After an error this drains the packets still out
+        if (!reading && !writing)
+            break;
+    
+        WaitPort(ce->port);
+        while ((msg = GetMsg(ce->port)))
+        {
+            b = (struct CopyBuffer *)msg;
+            res = b->sp.sp_Pkt.dp_Res1;
+    
+            if (b->action == ACTION_READ)
+            {
+                reading = FALSE;
+                b->state = CB_FREE;
+    
+                if (res < 0)
+                {
+                    error = b->sp.sp_Pkt.dp_Res2;
+                }
+                else if (res == 0)
+                {
+                    eof = TRUE;
+                }
+                else
+                {
+                    b->length = res;
+                    b->state = CB_FULL;
+                    r = (r + 1) % ce->numBuffers;
+                    hash = b;
+                }
+            }
+            else
+            {
+                writing = FALSE;
+                b->state = CB_FREE;
+                w = (w + 1) % ce->numBuffers;
+    
+                if (res != b->length)
+                {
+                    error = b->sp.sp_Pkt.dp_Res2 ? b->sp.sp_Pkt.dp_Res2 : ERROR_DISK_FULL;
+                }
+                else
+                {
+                    ce->bytes += res;
+                }
+            }
+        }
+    }
+    
+    ce->checksum = crc ^ 0xFFFFFFFF;
+    StatStop(&ce->time, &start);
+    SetIoErr(error);
+    return error == 0;
+}
+
+// Checksum a file with two of the engine's buffers, hashing one while the
+// next is read
+static LONG ChecksumHandle(struct CopyEngine *ce, BPTR fh, ULONG *crc, ULONG *size)
+{
+    struct FileHandle *h = (struct FileHandle *)BADDR(fh);
+    struct CopyBuffer *b;
+    ULONG n = 0;
+    LONG res;
+    
+    if (!h->fh_Type)
+        return CopySync(ce, fh, 0, crc, size);
+    
+    SendBuffer(ce, &ce->buffers[0], fh, ACTION_READ, ce->bufferSize);
+    for (;;)
+    {
+        WaitPort(ce->port);
+        b = (struct CopyBuffer *)GetMsg(ce->port);
+        b->state = CB_FREE;
+        
+        if ((res = b->sp.sp_Pkt.dp_Res1) <= 0)
+            return res < 0 ? b->sp.sp_Pkt.dp_Res2 : 0;
+        
+        n ^= 1;
+        SendBuffer(ce, &ce->buffers[n], fh, ACTION_READ, ce->bufferSize);
+        *crc = UpdateCRC32(*crc, b->data, res);
+        *size += res;
+    }
+}
+
+// Read a written file back and compare its checksum. The handler is asked
+// to flush first, so the data comes from the disk: FFS moves reads of whole
+// blocks straight into the caller's buffer rather than through its block
+// cache, and the engine's buffers are far larger than a block.
+BOOL VerifyCopy(struct CopyEngine *ce, const char *path, ULONG checksum)
+{
+    struct timeval start;
+    ULONG crc = 0xFFFFFFFF;
+    ULONG size = 0;
+    LONG error;
+    BPTR fh;
+    
+    StatStart(&start);
+    
+    if (!(fh = Open(path, MODE_OLDFILE)))
+        return FALSE;
+    
+    if (((struct FileHandle *)BADDR(fh))->fh_Type)
+    {
+        DoPkt(((struct FileHandle *)BADDR(fh))->fh_Type, ACTION_FLUSH, 0, 0, 0, 0, 0);
+    }
+    
+    error = ChecksumHandle(ce, fh, &crc, &size);
+    Close(fh);
+    
+    StatStop(&ce->verify, &start);
+    ce->verified++;
+    
+    if (error)
+    {
+        SetIoErr(error);
+        return FALSE;
+    }
+    return (crc ^ 0xFFFFFFFF) == checksum;
+}
+
+// Same as CalculateChecksum() but with the engine's buffers; also returns the size
+BOOL ChecksumEngineFile(struct CopyEngine *ce, const char *path, ULONG *checksum, ULONG *size)
+{
+    ULONG crc = 0xFFFFFFFF;
+    LONG error;
+    BPTR fh;
+    
+    *size = 0;
+    if (!(fh = Open(path, MODE_OLDFILE)))
+        return FALSE;
+    
+    error = ChecksumHandle(ce, fh, &crc, size);
+    Close(fh);
+    
+    *checksum = crc ^ 0xFFFFFFFF;
+    SetIoErr(error);
+    return error == 0;
+}
+
+// A failed copy leaves no partial destination behind
+BOOL CopyEngineFile(struct CopyEngine *ce, const char *source, const char *dest)
+{
+    BPTR from, to;
+    BOOL success = FALSE;
+    LONG error = 0;
+    
+    if ((from = Open(source, MODE_OLDFILE)))
+    {
+        if ((to = Open(dest, MODE_NEWFILE)))
+        {
+            success = CopyHandles(ce, from, to);
+            error = IoErr();
+    
+            if (!Close(to) && success)
+            {
+                success = FALSE;
+                error = IoErr();
+            }
+    
+            if (success)
+                ce->files++;
+            else
+                DeleteFile(dest);
+        }
+        else
+        {
+            error = IoErr();
+        }
+        Close(from);
+    }
+    else
+    {
+        error = IoErr();
+    }
+    
+    SetIoErr(error);
+    return success;
+}
+
+// Whether a and b hold the same bytes, cheapest test first: the sizes,
+// then the first COPY_PREFIX bytes, then checksums of the rest of each
+// file. Any error counts as different.
+BOOL SameContent(struct CopyEngine *ce, const char *a, const char *b)
+{
+    struct FileInfoBlock *fib;
+    ULONG crcA = 0xFFFFFFFF, crcB = 0xFFFFFFFF;
+    ULONG sizeA = 0, sizeB = 0;
+    LONG lenA = -1, lenB = -1, n;
+    BPTR fa, fb;
+    BOOL same = FALSE;
+    
+    if (!(fib = AllocDosObject(DOS_FIB, NULL)))
+        return FALSE;
+    
+    if ((fa = Open(a, MODE_OLDFILE)))
+    {
+        if ((fb = Open(b, MODE_OLDFILE)))
+        {
+            if (ExamineFH(fa, fib)) lenA = fib->fib_Size;
+            if (ExamineFH(fb, fib)) lenB = fib->fib_Size;
+    
+            if (lenA >= 0 && lenA == lenB)
+            {
+                n = lenA < COPY_PREFIX ? lenA : COPY_PREFIX;
+                same = Read(fa, ce->buffers[0].data, n) == n &&
+                       Read(fb, ce->buffers[1].data, n) == n &&
+                       memcmp(ce->buffers[0].data, ce->buffers[1].data, n) == 0;
+    
+                // Both handles are past the prefix now
+                if (same && lenA > n)
+                {
+                    same = ChecksumHandle(ce, fa, &crcA, &sizeA) == 0 &&
+                           ChecksumHandle(ce, fb, &crcB, &sizeB) == 0 &&
+                           crcA == crcB && sizeA == sizeB;
+                }
+            }
+            Close(fb);
+        }
+        Close(fa);
+    }
+    FreeDosObject(DOS_FIB, fib);
+    
+    return same;
+}
+
+void PrintCopyStats(const struct CopyEngine *ce)
+{
+    ULONG ms = ce->time.secs * 1000 + ce->time.micro / 1000;
+    
+    Printf("Copied %ld files, %ld KB in %ld.%03ld s with %ld x %ld KB buffers",
+           ce->files, ce->bytes / 1024, ms / 1000, ms % 1000,
+           ce->numBuffers, ce->bufferSize / 1024);
+    if (ms > 0)
+    {
+        Printf(" (%ld KB/s)", (ce->bytes / 1024) * 1000 / ms);
+    }
+    Printf("\n");
+    
+    if (ce->verified)
+    {
+        ms = ce->verify.secs * 1000 + ce->verify.micro / 1000;
+        Printf("Verified %ld files in %ld.%03ld s\n", ce->verified, ms / 1000, ms % 1000);
+    }
+}
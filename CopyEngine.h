@@ -0,0 +1,58 @@
+#ifndef COPYENGINE_H
+#define COPYENGINE_H
+
+#include <exec/types.h>
+#include <dos/dos.h>
+#include <dos/dosextens.h>
+#include "Shared.h"
+#include "Stats.h"
+#include "Tuning.h"
+
+#define COPY_BUFFER_SIZE TUNE_COPY_BUFFER   // Default per buffer
+#define COPY_BUFFERS     TUNE_COPY_BUFFERS  // Default number of buffers
+#define COPY_MAX_BUFFERS 8
+#define COPY_MIN_BUFFER  4096               // Smallest size tried when memory is short
+#define COPY_PREFIX      4096               // Compared by SameContent() before hashing
+
+// Buffer states
+#define CB_FREE 0
+#define CB_BUSY 1           // Packet out at a handler
+#define CB_FULL 2           // Read, waiting to be written
+
+struct CopyBuffer {
+    struct StandardPacket sp;   // First: the reply message is the buffer
+    UBYTE *data;
+    LONG length;                // Bytes read into data
+    LONG action;                // ACTION_READ or ACTION_WRITE while busy
+    LONG state;
+};
+
+// Copies files with read and write packets sent to the handlers directly,
+// so reading the next buffer from the source overlaps writing the last one
+// to the destination. Buffers come from one pool and are reused for every
+// file the engine copies.
+struct CopyEngine {
+    APTR pool;
+    struct MsgPort *port;
+    struct CopyBuffer buffers[COPY_MAX_BUFFERS];
+    ULONG numBuffers;
+    ULONG bufferSize;
+    ULONG checksum;             // CRC32 of the data the last copy read
+    ULONG files;
+    ULONG bytes;
+    ULONG verified;             // Files read back by VerifyCopy()
+    struct StatTimer time;
+    struct StatTimer verify;
+};
+
+// Zero selects the defaults; the buffer size is halved until it fits
+struct CopyEngine *CreateCopyEngine(ULONG bufferSize, ULONG numBuffers);
+void DeleteCopyEngine(struct CopyEngine *ce);
+BOOL CopyHandles(struct CopyEngine *ce, BPTR from, BPTR to);
+BOOL CopyEngineFile(struct CopyEngine *ce, const char *source, const char *dest);
+BOOL VerifyCopy(struct CopyEngine *ce, const char *path, ULONG checksum);
+BOOL ChecksumEngineFile(struct CopyEngine *ce, const char *path, ULONG *checksum, ULONG *size);
+BOOL SameContent(struct CopyEngine *ce, const char *a, const char *b);
+void PrintCopyStats(const struct CopyEngine *ce);
+
+#endif /* COPYENGINE_H */
@@ -1,4 +1,7 @@
 #include "CreateDB.h"
+#include "Database.h"
+#include "Scan.h"
+#include "Stream.h"
 
 #include <exec/types.h>
 #include <libraries/dos.h>
@@ -6,6 +9,7 @@
 #include <proto/dos.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <proto/utility.h>
 
 #define CHECKSUM_DB "PROGDIR:QuickUpdate.db"
@@ -25,24 +29,37 @@ struct Entry {
     char origin[64];
 };
 
-static const char template[] = "FOLDER/A,ALL/S,ORIGIN/K";
+static const char template[] = "FOLDER/A/M,ALL/S,ORIGIN/K,FULL/S,WORKERS/K/N,DEPTH/K/N,STATS/S,STATSFILE/K,RESUME/S,STREAM/K,FORMAT/K";
 struct {
-    char *folder;
+    char **folders;
     LONG all;
     char *origin;
-} args = { NULL, FALSE, NULL };
+    LONG full;
+    LONG *workers;      // Per physical device
+    LONG *depth;        // Files in flight per worker
+    LONG stats;
+    char *statsfile;    // Append a record of the run here
+    LONG resume;        // Continue an interrupted scan
+    char *stream;       // Write records here instead of the database
+    char *format;       // NDJSON or DB
+} args = { NULL, FALSE, NULL, FALSE, NULL, NULL, FALSE, NULL, FALSE, NULL, NULL };
 
 struct RDArgs *rdargs = NULL;
 static const char version[] = "$VER: CreateDB 1.0 (2024-03-20)";
 
-// Reuse these functions from QuickUpdate.c
-BOOL IsValidFileType(const char *filename);
+// Reuse these functions from Shared.c
 BOOL CheckFileVersion(const char *filename, struct VersionInfo *info);
 
 struct Entry *entries = NULL;
 LONG numEntries = 0;
 
-// Add signal handling
+// Scan state. During a scan only the committer touches entries.
+struct Scan scan;
+struct ScanStream *stream = NULL;
+ULONG dbGeneration = 0;         // Database generation LoadExistingDB() read
+BOOL haveDB = FALSE;
+
+// Set when CTRL-C stopped the load or the scan
 volatile BOOL break_signal_received = FALSE;
 
 void HandleBreak(void)
@@ -52,29 +69,46 @@ void HandleBreak(void)
 
 BOOL LoadExistingDB(void)
 {
-    BPTR fh;
-    char line[512];
+    struct Database *db;
+    char line[MAX_DB_LINE + 1];
+    ULONG lineNum = 0;
+    struct ChecksumEntry record;
     BOOL success = TRUE;
     
-    if ((fh = Open(CHECKSUM_DB, MODE_OLDFILE)))
+    // Read the live generation; our snapshot stays valid while we scan
+    if ((db = OpenDatabase()))
     {
-        while ((line = ReadLine(fh)))
+        dbGeneration = db->generation;
+        haveDB = TRUE;
+        
+        while (FGets(db->fh, line, sizeof(line)))
         {
+            lineNum++;
+            
+            if (CheckSignal(SIGBREAKF_CTRL_C))
+            {
+                HandleBreak();
+                break;
+            }
+            
             // Skip comments and empty lines
             if (line[0] == '#' || line[0] == '\n')
             {
-                FreeVec(line);
                 continue;
             }
             
-            struct Entry *entry = &entries[numEntries];
-            
             // Parse line: CHECKSUM|FILESIZE|FILENAME|VERSION.REVISION|DATE|ORIGIN
-            if (sscanf(line, "%lx|%lu|%[^|]|%hu.%hu|%lu|%[^\n]",
-                      &entry->checksum, &entry->filesize, entry->filename,
-                      &entry->version, &entry->revision,
-                      &entry->date, entry->origin) == 7)
+            if (LoadDatabaseEntry(line, lineNum, &record))
             {
+                struct Entry *entry = &entries[numEntries];
+                
+                entry->checksum = record.checksum;
+                entry->filesize = record.filesize;
+                strcpy(entry->filename, record.filename);
+                entry->version = record.version;
+                entry->revision = record.revision;
+                entry->date = record.date;
+                strcpy(entry->origin, record.origin);
                 entry->isNew = FALSE;
                 numEntries++;
                 
@@ -88,9 +122,8 @@ BOOL LoadExistingDB(void)
             {
                 Printf("Warning: Skipping invalid entry in database\n");
             }
-            FreeVec(line);
         }
-        Close(fh);
+        CloseDatabase(db);
     }
     else
     {
@@ -115,234 +148,284 @@ BOOL EntryExists(const char *filename, ULONG checksum, ULONG filesize)
     return FALSE;
 }
 
-void ScanDirectory(const char *path, BOOL recursive)
+// Note a new entry in the checkpoint
+static void RecordFound(const struct Entry *entry)
 {
-    BPTR lock, oldDir;
-    struct FileInfoBlock *fib;
-    char fullpath[MAX_PATH];
+    struct ChecksumEntry record;
     
-    if ((lock = Lock(path, ACCESS_READ)))
+    if (scan.mw)
     {
-        if ((fib = AllocDosObject(DOS_FIB, NULL)))
-        {
-            oldDir = CurrentDir(lock);
-            
-            if (Examine(lock, fib))
-            {
-                while (ExNext(lock, fib))
-                {
-                    if (fib->fib_DirEntryType > 0)  // Directory
-                    {
-                        if (recursive)
-                        {
-                            strncpy(fullpath, path, MAX_PATH - 1);
-                            fullpath[MAX_PATH - 1] = '\0';
-                            AddPart(fullpath, fib->fib_FileName, MAX_PATH);
-                            ScanDirectory(fullpath, TRUE);
-                        }
-                    }
-                    else  // File
-                    {
-                        if (IsValidFileType(fib->fib_FileName))
-                        {
-                            strncpy(fullpath, path, MAX_PATH - 1);
-                            fullpath[MAX_PATH - 1] = '\0';
-                            AddPart(fullpath, fib->fib_FileName, MAX_PATH);
-                            
-                            ULONG checksum = CalculateChecksum(fullpath);
-                            
-                            if (!EntryExists(fib->fib_FileName, checksum, fib->fib_Size))
-                            {
-                                struct VersionInfo info;
-                                if (CheckFileVersion(fullpath, &info))
-                                {
-                                    struct Entry *entry = &entries[numEntries];
-                                    entry->checksum = checksum;
-                                    entry->filesize = fib->fib_Size;
-                                    strcpy(entry->filename, fib->fib_FileName);
-                                    entry->version = info.version;
-                                    entry->revision = info.revision;
-                                    entry->date = info.date;
-                                    entry->isNew = TRUE;
-                                    numEntries++;
-                                    
-                                    Printf("Found: %s (v%ld.%ld, %ld bytes)\n", 
-                                           fib->fib_FileName,
-                                           info.version, info.revision,
-                                           fib->fib_Size);
-                                    
-                                    if (numEntries >= MAX_ENTRIES)
-                                    {
-                                        Printf("Warning: Maximum entries reached\n");
-                                        break;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-            
-            CurrentDir(oldDir);
-            FreeDosObject(DOS_FIB, fib);
-        }
-        UnLock(lock);
+        record.checksum = entry->checksum;
+        record.filesize = entry->filesize;
+        strcpy(record.filename, entry->filename);
+        record.version = entry->version;
+        record.revision = entry->revision;
+        record.date = entry->date;
+        record.origin[0] = '\0';
+        WriteManifestFound(scan.mw, &record);
     }
 }
 
-BOOL SaveDatabase(const char *origin)
+// Scan committer: new files go into the entry table, FALSE when full
+static BOOL CommitEntry(struct Scan *scan, struct ScanResult *r)
 {
-    BPTR fh;
-    char tempDB[MAX_PATH];
-    BOOL success = FALSE;
-    LONG writeError = FALSE;
+    struct Entry *entry;
     
-    // Create temporary file
-    strcpy(tempDB, CHECKSUM_DB);
-    strcat(tempDB, ".new");
+    if (!r->haveVersion || EntryExists(r->name, r->checksum, r->size))
+    {
+        return TRUE;
+    }
+    
+    entry = &entries[numEntries];
+    entry->checksum = r->checksum;
+    entry->filesize = r->size;
+    strncpy(entry->filename, r->name, sizeof(entry->filename) - 1);
+    entry->filename[sizeof(entry->filename) - 1] = '\0';
+    entry->version = r->info.version;
+    entry->revision = r->info.revision;
+    entry->date = r->info.date;
+    entry->isNew = TRUE;
+    numEntries++;
+    RecordFound(entry);
     
-    if ((fh = Open(tempDB, MODE_NEWFILE)))
+    Printf("Found: %s (v%ld.%ld, %ld bytes)\n", 
+           r->name,
+           r->info.version, r->info.revision,
+           r->size);
+    
+    if (numEntries >= MAX_ENTRIES)
     {
-        // Set buffer for better performance
-        SetVBuf(fh, NULL, BUF_LINE, 4096);
-        
-        // Write header
-        if (FPuts(fh, "# QuickUpdate Checksum Database\n") == -1 ||
-            FPuts(fh, "# Format: CHECKSUM|FILESIZE|FILENAME|VERSION.REVISION|DATE|ORIGIN\n") == -1)
-        {
-            Printf("Error writing database header\n");
-            writeError = TRUE;
-        }
-
-        // Write all entries if header was successful
-        if (!writeError)
-        {
-            for (LONG i = 0; i < numEntries; i++)
-            {
-                if (VFPrintf(fh, "%08lx|%lu|%s|%d.%d|%lu|%s\n",
-                           entries[i].checksum,
-                           entries[i].filesize,
-                           entries[i].filename,
-                           entries[i].version,
-                           entries[i].revision,
-                           entries[i].date,
-                           entries[i].isNew ? origin : entries[i].origin) == -1)
-                {
-                    Printf("Error writing database entry %ld\n", i);
-                    writeError = TRUE;
-                    break;
-                }
-            }
-        }
+        Printf("Warning: Maximum entries reached\n");
+        return FALSE;
+    }
+    return TRUE;
+}
 
-        // Only proceed if all writes were successful
-        if (!writeError)
-        {
-            Close(fh);
-            
-            // Check if original file exists
-            BPTR lock = Lock(CHECKSUM_DB, ACCESS_READ);
-            BOOL exists = lock ? TRUE : FALSE;
-            if (lock) UnLock(lock);
+// Stream committer: every analyzed file, no lookups and no table
+static BOOL StreamEntry(struct Scan *scan, struct ScanResult *r)
+{
+    if (!WriteScanRecord(stream, r))
+    {
+        PrintFault(IoErr(), args.stream);
+        return FALSE;
+    }
+    return TRUE;
+}
 
-            // Delete existing file if present
-            if (exists)
-            {
-                if (!DeleteFile(CHECKSUM_DB))
-                {
-                    Printf("Error removing old database (read-only?)\n");
-                    DeleteFile(tempDB);
-                    return FALSE;
-                }
-            }
+// Entries an interrupted scan found go back into the table, and into the
+// new checkpoint in case this scan is interrupted too
+static void RestoreEntries(struct Manifest *m)
+{
+    struct ChecksumEntry *record;
+    struct Entry *entry;
+    ULONG i;
+    
+    for (i = 0; i < m->numFound && numEntries < MAX_ENTRIES; i++)
+    {
+        record = &m->found[i];
+        if (EntryExists(record->filename, record->checksum, record->filesize))
+            continue;
+        
+        entry = &entries[numEntries];
+        entry->checksum = record->checksum;
+        entry->filesize = record->filesize;
+        strcpy(entry->filename, record->filename);
+        entry->version = record->version;
+        entry->revision = record->revision;
+        entry->date = record->date;
+        entry->isNew = TRUE;
+        numEntries++;
+        RecordFound(entry);
+    }
+}
 
-            // Rename temp file
-            if (Rename(tempDB, CHECKSUM_DB))
-            {
-                success = TRUE;
-            }
-            else
-            {
-                Printf("Error renaming database file\n");
-                // Try to preserve temp file for recovery
-                DeleteFile(tempDB);
-            }
+// Reuse the previous run's results unless FULL was given, and with RESUME
+// what an interrupted scan of the same folders had done
+static void BeginManifest(char **roots, BOOL full, BOOL resume)
+{
+    if (resume)
+    {
+        if ((scan.resume = LoadManifest(roots, dbGeneration, TRUE)))
+        {
+            Printf("Resuming: %ld directories done, %ld files found\n",
+                   scan.resume->numDirs, scan.resume->numFound);
         }
         else
         {
-            Close(fh);
-            DeleteFile(tempDB);
-            Printf("Aborting due to write errors\n");
+            Printf("No checkpoint for these folders, scanning from the start\n");
         }
     }
-    else
+    
+    if (haveDB && !full)
     {
-        Printf("Error creating temporary database (disk full? read-only?)\n");
+        scan.old = LoadManifest(roots, dbGeneration, FALSE);
     }
+    
+    // Replaces the checkpoint we just read
+    if ((scan.mw = CreateManifestWriter(roots, dbGeneration)))
+    {
+        if (scan.resume) RestoreEntries(scan.resume);
+        CheckpointManifest(scan.mw);
+    }
+    else if (scan.resume)
+    {
+        RestoreEntries(scan.resume);
+    }
+}
 
-    // Set protection if we succeeded
-    if (success)
+// Only a complete scan whose results reached the database may be published
+static void EndManifest(BOOL publish)
+{
+    struct Database *db;
+    
+    if (scan.mw)
     {
-        if (!SetProtection(CHECKSUM_DB, FIBF_READ|FIBF_WRITE))
+        if (publish && (db = OpenDatabase()))
+        {
+            CloseManifestWriter(scan.mw, db->generation, TRUE);
+            CloseDatabase(db);
+        }
+        else
         {
-            Printf("Warning: Could not set file protection\n");
+            CloseManifestWriter(scan.mw, 0, FALSE);
         }
+        scan.mw = NULL;
     }
+    
+    FreeManifest(scan.old);
+    FreeManifest(scan.resume);
+    scan.old = NULL;
+    scan.resume = NULL;
+}
 
-    return success;
+// Records are written in HashName() order so the index can locate them
+static int CompareEntries(const void *a, const void *b)
+{
+    const struct Entry *ea = (const struct Entry *)a;
+    const struct Entry *eb = (const struct Entry *)b;
+    ULONG ha = HashName(ea->filename);
+    ULONG hb = HashName(eb->filename);
+    LONG cmp;
+    
+    if (ha != hb) return (ha < hb) ? -1 : 1;
+    if ((cmp = stricmp(ea->filename, eb->filename)) != 0) return cmp;
+    if (ea->checksum != eb->checksum) return (ea->checksum < eb->checksum) ? -1 : 1;
+    if (ea->filesize != eb->filesize) return (ea->filesize < eb->filesize) ? -1 : 1;
+    return 0;
 }
 
-ULONG CalculateChecksum(const char *filename)
+BOOL SaveDatabase(const char *origin)
 {
-    BPTR fh;
-    ULONG checksum = 0;
-    UBYTE buffer[4096];  // Smaller 4KB buffer for 68000
-    LONG bytes_read;
+    struct DBWriter *w;
+    struct ChecksumEntry record;
+    BOOL writeError = FALSE;
+    
+    qsort(entries, numEntries, sizeof(struct Entry), CompareEntries);
+    
+    // Build the next generation privately, running QuickUpdates keep
+    // reading their snapshot until it is switched in
+    if (!(w = CreateDatabaseWriter()))
+    {
+        Printf("Error creating temporary database (disk full? read-only?)\n");
+        return FALSE;
+    }
     
-    if ((fh = Open(filename, MODE_OLDFILE)))
+    // Write all entries
+    for (LONG i = 0; i < numEntries; i++)
     {
-        while ((bytes_read = Read(fh, buffer, sizeof(buffer))) > 0)
+        record.checksum = entries[i].checksum;
+        record.filesize = entries[i].filesize;
+        strcpy(record.filename, entries[i].filename);
+        record.version = entries[i].version;
+        record.revision = entries[i].revision;
+        record.date = entries[i].date;
+        strncpy(record.origin, entries[i].isNew ? origin : entries[i].origin,
+                sizeof(record.origin) - 1);
+        record.origin[sizeof(record.origin) - 1] = '\0';
+        
+        if (!WriteDatabaseEntry(w, &record))
         {
-            if (break_signal_received)
-            {
-                Close(fh);
-                return 0;
-            }
-            
-            // Simple rotating XOR - very fast on 68000
-            for (LONG i = 0; i < bytes_read; i++)
-            {
-                checksum = (checksum << 1) | (checksum >> 31);  // Rotate left
-                checksum ^= buffer[i];
-            }
+            writeError = TRUE;
+            break;
         }
-        Close(fh);
     }
     
-    return checksum;
+    if (writeError)
+    {
+        CloseDatabaseWriter(w, FALSE);
+        Printf("Aborting due to write errors\n");
+        return FALSE;
+    }
+    
+    return CloseDatabaseWriter(w, TRUE);
 }
 
-BOOL LoadDatabaseEntry(const char *line, ULONG lineNum)
+// Inventory mode: the database is neither read nor written, so memory use
+// does not depend on the number of files
+static LONG StreamScan(void)
 {
-    if (strlen(line) > 512)
+    LONG result = RETURN_FAIL;
+    ULONG records;
+    BOOL complete;
+    
+    if (!(stream = OpenScanStream(args.stream, args.format, args.origin)))
     {
-        Printf("Error: Line %ld too long\n", lineNum);
-        return FALSE;
+        PrintFault(IoErr(), args.stream);
+        return RETURN_FAIL;
     }
     
-    // Count separators
-    LONG separators = 0;
-    for (const char *p = line; *p; p++)
-        if (*p == '|') separators++;
-        
-    if (separators != 5)
+    scan.commit = StreamEntry;
+    scan.quiet = !stream->own;
+    if (args.workers) scan.perDevice = *args.workers;
+    if (args.depth && *args.depth > 0) scan.depth = *args.depth;
+    
+    complete = RunScan(&scan, args.folders, args.all);
+    if (scan.broken)
     {
-        Printf("Error: Corrupt entry at line %ld (wrong format)\n", lineNum);
-        return FALSE;
+        HandleBreak();
     }
     
-    // Rest of parsing with validation...
-    return TRUE;
+    records = stream->records;
+    if (CloseScanStream(stream) && complete)
+    {
+        result = RETURN_OK;
+    }
+    else if (break_signal_received)
+    {
+        Printf("\n*** Break received - aborting ***\n");
+    }
+    stream = NULL;
+    
+    if (!scan.quiet)
+    {
+        Printf("\nWrote %ld records to %s\n", records, (LONG)args.stream);
+    }
+    
+    return result;
+}
+
+static void ReportStats(const struct timeval *runStart, LONG result)
+{
+    char settings[256];
+    
+    StatStop(&scan.stats.total, runStart);
+    
+    if (args.stats)
+    {
+        PrintScanStats(&scan.stats);
+    }
+    
+    if (args.statsfile)
+    {
+        sprintf(settings, "result=%ld all=%ld full=%ld resume=%ld workers=%ld depth=%ld folder=%.64s",
+                result, args.all ? 1L : 0L, args.full ? 1L : 0L, args.resume ? 1L : 0L,
+                scan.perDevice, scan.depth, args.folders[0]);
+        
+        if (!WriteStatsRecord(args.statsfile, &scan.stats, settings))
+        {
+            PrintFault(IoErr(), args.statsfile);
+        }
+    }
 }
 
 // Update entry point to use _main
@@ -351,36 +434,76 @@ LONG _main(LONG argc, char **argv)
     LONG result = RETURN_FAIL;
     char origin[64];
     LONG newEntries = 0;
+    BOOL complete = FALSE;
+    BOOL loaded;
+    struct timeval runStart, start;
     struct Task *task = FindTask(NULL);
     ULONG oldSignals = SetSignal(0, SIGBREAKF_CTRL_C);
     
     // Set up break handling
     break_signal_received = FALSE;
     
+    InitScan(&scan, CommitEntry, NULL);
+    
     if ((DOSBase = (struct DosLibrary *)OpenLibrary("dos.library", 37)))
     {
+        OpenStatsTimer();
+        StatStart(&runStart);
+        
         if ((entries = AllocMem(sizeof(struct Entry) * MAX_ENTRIES, MEMF_CLEAR|MEMF_PUBLIC)))
         {
             rdargs = ReadArgs(template, (LONG *)&args, NULL);
             if (rdargs)
             {
-                if (args.folder)
+                if (args.folders && args.folders[0] && args.stream)
                 {
-                    if (LoadExistingDB())
+                    result = StreamScan();
+                }
+                else if (args.folders && args.folders[0])
+                {
+                    StatStart(&start);
+                    loaded = LoadExistingDB();
+                    StatStop(&scan.stats.load, &start);
+                    
+                    if (break_signal_received)
+                    {
+                        Printf("\n*** Break received - aborting ***\n");
+                    }
+                    else if (loaded)
                     {
                         LONG startEntries = numEntries;
                         
-                        Printf("Scanning directory: %s\n", (LONG)args.folder);
-                        ScanDirectory(args.folder, args.all);
+                        BeginManifest(args.folders, args.full, args.resume);
+                        
+                        for (LONG i = 0; args.folders[i]; i++)
+                        {
+                            Printf("Scanning directory: %s\n", (LONG)args.folders[i]);
+                        }
+                        if (args.workers) scan.perDevice = *args.workers;
+                        if (args.depth && *args.depth > 0) scan.depth = *args.depth;
+                        complete = RunScan(&scan, args.folders, args.all);
                         
                         // Check if break was received during scan
+                        if (scan.broken)
+                        {
+                            HandleBreak();
+                        }
                         if (break_signal_received)
                         {
                             Printf("\n*** Break received - aborting ***\n");
+                            if (scan.mw)
+                            {
+                                Printf("Run again with RESUME to continue the scan\n");
+                            }
                             goto cleanup;
                         }
                         
                         newEntries = numEntries - startEntries;
+                        if (scan.stats.dirHits > 0)
+                        {
+                            Printf("\nSkipped %ld unchanged directories, %ld unchanged files\n",
+                                   scan.stats.dirHits, scan.stats.fileHits);
+                        }
                         Printf("\nFound %ld new files\n", newEntries);
                         
                         if (newEntries > 0)
@@ -407,11 +530,13 @@ LONG _main(LONG argc, char **argv)
                             }
                             
                             // Once we start writing, we complete even if break received
+                            StatStart(&start);
                             if (SaveDatabase(origin))
                             {
                                 Printf("Database updated successfully\n");
                                 result = RETURN_OK;
                             }
+                            StatStop(&scan.stats.save, &start);
                         }
                         else
                         {
@@ -427,15 +552,20 @@ LONG _main(LONG argc, char **argv)
                 else
                 {
                     Printf("Error: FOLDER argument is required\n");
-                    Printf("Usage: CreateDB FOLDER=<path> [ALL/S] [ORIGIN=<text>]\n");
+                    Printf("Usage: CreateDB FOLDER=<path> [<path>...] [ALL/S] [ORIGIN=<text>] [FULL/S] [WORKERS=<n>] [DEPTH=<n>] [STATS/S] [STATSFILE=<file>] [RESUME/S] [STREAM=<file>|*] [FORMAT=NDJSON|DB]\n");
                 }
             cleanup:
+                EndManifest(result == RETURN_OK && complete);
+                if (args.folders && args.folders[0])
+                {
+                    ReportStats(&runStart, result);
+                }
                 FreeArgs(rdargs);
             }
             else
             {
                 Printf("Error parsing arguments\n");
-                Printf("Usage: CreateDB FOLDER=<path> [ALL/S] [ORIGIN=<text>]\n");
+                Printf("Usage: CreateDB FOLDER=<path> [<path>...] [ALL/S] [ORIGIN=<text>] [FULL/S] [WORKERS=<n>] [DEPTH=<n>] [STATS/S] [STATSFILE=<file>] [RESUME/S] [STREAM=<file>|*] [FORMAT=NDJSON|DB]\n");
             }
             FreeMem(entries, sizeof(struct Entry) * MAX_ENTRIES);
         }
@@ -443,6 +573,7 @@ LONG _main(LONG argc, char **argv)
         {
             Printf("Error: Out of memory\n");
         }
+        CloseStatsTimer();
         CloseLibrary((struct Library *)DOSBase);
     }
     else
@@ -17,7 +17,6 @@ struct CreateDBEntry {
 
 // CreateDB-specific prototypes
 BOOL EntryExists(const char *filename, ULONG checksum, ULONG filesize);
-void ScanDirectory(const char *path, BOOL recursive);
 BOOL SaveDatabase(const char *origin);
 BOOL LoadExistingDB(void);
 
@@ -0,0 +1,273 @@
+// DBStress - stress test of the database generation switch
+//
+// Reader processes open the current generation, look up every record and
+// close it again in a loop, while the main process publishes generation
+// after generation through the same writer CreateDB uses. Each record of
+// generation n carries version n, so a reader that finds a record of
+// another version, a missing or doubled record, or no database at all has
+// seen a torn switch. At the end no superseded generation may be left.
+//
+// It publishes into PROGDIR:, so copy it to a scratch drawer, never run it
+// next to the real QuickUpdate.db.
+
+#include "Shared.h"
+#include "Database.h"
+
+#include <exec/types.h>
+#include <exec/memory.h>
+#include <dos/dos.h>
+#include <dos/dostags.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_READERS 16
+#define READER_STACK 8192
+
+struct DosLibrary *DOSBase = NULL;
+
+static const char template[] = "READERS/K/N,ROUNDS/K/N,RECORDS/K/N";
+struct {
+    LONG *readers;      // Default 4
+    LONG *rounds;       // Generations to publish, default 200
+    LONG *records;      // Per generation, default 300
+} args;
+
+struct Reader {
+    struct Message msg;     // Startup message, replied when the reader ends
+    char name[24];
+    ULONG opens;
+    ULONG lookups;
+    ULONG errors;
+};
+
+static struct ChecksumEntry *records;  // In HashName() order
+static ULONG numRecords;
+static volatile BOOL stopReaders;
+
+static int CompareRecords(const void *a, const void *b)
+{
+    ULONG ha = HashName(((const struct ChecksumEntry *)a)->filename);
+    ULONG hb = HashName(((const struct ChecksumEntry *)b)->filename);
+    
+    if (ha != hb) return (ha < hb) ? -1 : 1;
+    return stricmp(((const struct ChecksumEntry *)a)->filename,
+                   ((const struct ChecksumEntry *)b)->filename);
+}
+
+static __saveds void ReaderEntry(void)
+{
+    struct Process *me = (struct Process *)FindTask(NULL);
+    struct Reader *r;
+    struct Database *db;
+    struct DBCursor cursor;
+    struct ChecksumEntry entry;
+    ULONG i;
+    
+    WaitPort(&me->pr_MsgPort);
+    r = (struct Reader *)GetMsg(&me->pr_MsgPort);
+    
+    while (!stopReaders)
+    {
+        if (!(db = OpenDatabase()))
+        {
+            r->errors++;
+            continue;
+        }
+        r->opens++;
+    
+        for (i = 0; i < numRecords; i++)
+        {
+            r->lookups++;
+            if (!FindFirstEntry(db, records[i].filename, &cursor, &entry) ||
+                entry.version != (UWORD)db->generation ||
+                FindNextEntry(db, &cursor, &entry))
+            {
+                r->errors++;
+                break;
+            }
+        }
+    
+        CloseDatabase(db);
+    }
+    
+    Forbid();
+    ReplyMsg(&r->msg);
+}
+
+// Write the next generation, every record with its number as the version
+static BOOL Publish(void)
+{
+    struct DBWriter *w;
+    ULONG current, oldest, i;
+    BOOL ok = TRUE;
+    
+    // Only this process publishes, so the number cannot change under us
+    if (!ReadGeneration(&current, &oldest))
+        current = 0;
+    
+    if (!(w = CreateDatabaseWriter()))
+        return FALSE;
+    
+    for (i = 0; i < numRecords && ok; i++)
+    {
+        records[i].version = (UWORD)(current + 1);
+        ok = WriteDatabaseEntry(w, &records[i]);
+    }
+    
+    return (BOOL)(CloseDatabaseWriter(w, ok) && ok);
+}
+
+static LONG RunStress(void)
+{
+    struct Reader *readers;
+    struct MsgPort *reply;
+    struct Process *proc;
+    ULONG numReaders = args.readers ? *args.readers : 4;
+    ULONG rounds = args.rounds ? *args.rounds : 200;
+    ULONG started = 0, published = 0, failed = 0, errors = 0, leaked = 0;
+    ULONG first, current, oldest, i;
+    BPTR lock;
+    char name[MAX_PATH];
+    
+    if (numReaders < 1 || numReaders > MAX_READERS)
+    {
+        Printf("Error: READERS must be 1 to %ld\n", (LONG)MAX_READERS);
+        return RETURN_FAIL;
+    }
+    
+    // Readers only start once there is a generation to open
+    if (!Publish() || !ReadGeneration(&first, &oldest))
+    {
+        Printf("Error: Cannot publish a database in PROGDIR:\n");
+        return RETURN_FAIL;
+    }
+    
+    if (!(readers = AllocVec(sizeof(struct Reader) * numReaders, MEMF_PUBLIC|MEMF_CLEAR)))
+        return RETURN_FAIL;
+    if (!(reply = CreateMsgPort()))
+    {
+        FreeVec(readers);
+        return RETURN_FAIL;
+    }
+    
+    stopReaders = FALSE;
+    for (i = 0; i < numReaders; i++)
+    {
+        sprintf(readers[i].name, "DBStress reader %lu", i);
+        readers[i].msg.mn_ReplyPort = reply;
+        readers[i].msg.mn_Length = sizeof(struct Reader);
+    
+        proc = CreateNewProcTags(NP_Entry, (ULONG)ReaderEntry,
+                                 NP_Name, (ULONG)readers[i].name,
+                                 NP_StackSize, READER_STACK,
+                                 NP_Output, (ULONG)Output(),
+                                 NP_CloseOutput, FALSE,
+                                 TAG_DONE);
+        if (!proc)
+            break;
+        PutMsg(&proc->pr_MsgPort, &readers[i].msg);
+        started++;
+    }
+    
+    Printf("Publishing %lu generations under %lu readers, %lu records each\n",
+           rounds, started, numRecords);
+    
+    for (i = 0; i < rounds && started; i++)
+    {
+        if (SetSignal(0, SIGBREAKF_CTRL_C) & SIGBREAKF_CTRL_C)
+        {
+            Printf("*** Break\n");
+            break;
+        }
+        if (Publish())
+            published++;
+        else
+            failed++;
+    }
+    
+    stopReaders = TRUE;
+    for (i = 0; i < started; i++)
+    {
+        WaitPort(reply);
+        GetMsg(reply);
+    }
+    
+    for (i = 0; i < started; i++)
+    {
+        Printf("%s: %lu opens, %lu lookups, %lu errors\n",
+               (LONG)readers[i].name, readers[i].opens,
+               readers[i].lookups, readers[i].errors);
+        errors += readers[i].errors;
+    }
+    
+    // With no reader left, the last publish reclaims every older generation
+    if (started && Publish() && ReadGeneration(&current, &oldest))
+    {
+        for (i = first; i < current; i++)
+        {
+            GenerationName(i, FALSE, name);
+            if ((lock = Lock(name, ACCESS_READ)))
+            {
+                UnLock(lock);
+                leaked++;
+            }
+        }
+    }
+    else
+        failed++;
+    
+    Printf("%lu generations published, %lu failed, %lu reader errors, %lu left behind\n",
+           published, failed, errors, leaked);
+    
+    DeleteMsgPort(reply);
+    FreeVec(readers);
+    
+    if (started < numReaders)
+        Printf("Error: Only %lu readers started\n", started);
+    
+    return (started == numReaders && !failed && !errors && !leaked) ? RETURN_OK : RETURN_ERROR;
+}
+
+int main(int argc, char **argv)
+{
+    LONG result = RETURN_FAIL;
+    struct RDArgs *rdargs;
+    ULONG i;
+    
+    if (!(DOSBase = (struct DosLibrary *)OpenLibrary("dos.library", 37)))
+        return RETURN_FAIL;
+    
+    if ((rdargs = ReadArgs(template, (LONG *)&args, NULL)))
+    {
+        numRecords = args.records ? *args.records : 300;
+        if (numRecords < 1)
+            numRecords = 1;
+    
+        if ((records = AllocVec(sizeof(struct ChecksumEntry) * numRecords, MEMF_CLEAR)))
+        {
+            // Enough records to span several index blocks
+            for (i = 0; i < numRecords; i++)
+            {
+                sprintf(records[i].filename, "stress%lu.library", i);
+                records[i].checksum = i;
+                records[i].filesize = i;
+                strcpy(records[i].origin, "DBStress");
+            }
+            qsort(records, numRecords, sizeof(struct ChecksumEntry), CompareRecords);
+    
+            result = RunStress();
+            FreeVec(records);
+        }
+        FreeArgs(rdargs);
+    }
+    else
+    {
+        PrintFault(IoErr(), "DBStress");
+    }
+    
+    CloseLibrary((struct Library *)DOSBase);
+    return result;
+}
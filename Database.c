@@ -0,0 +1,668 @@
+#include "Database.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+static const char *dbHeaderLines[DB_HEADER_LINES] = {
+    "# QuickUpdate Checksum Database\n",
+    "# Format: CHECKSUM|FILESIZE|FILENAME|VERSION.REVISION|DATE|ORIGIN\n"
+};
+
+static LONG DatabaseSize(BPTR fh)
+{
+    struct FileInfoBlock *fib;
+    LONG size = -1;
+
+    if ((fib = AllocDosObject(DOS_FIB, NULL)))
+    {
+        if (ExamineFH(fh, fib))
+        {
+            size = fib->fib_Size;
+        }
+        FreeDosObject(DOS_FIB, fib);
+    }
+    return size;
+}
+
+// Copy the FILENAME field of a record line, returns FALSE if malformed
+static BOOL ReadNameField(const char *line, char *name, LONG size)
+{
+    const char *p = line;
+    LONG i;
+
+    for (i = 0; i < 2; i++)
+    {
+        if (!(p = strchr(p, '|'))) return FALSE;
+        p++;
+    }
+
+    for (i = 0; *p && *p != '|' && *p != '\n'; i++, p++)
+    {
+        if (i >= size - 1) return FALSE;
+        name[i] = *p;
+    }
+    name[i] = '\0';
+
+    return (*p == '|') ? TRUE : FALSE;
+}
+
+// Find or create the public semaphore guarding generation switches
+static struct SignalSemaphore *GetDatabaseSemaphore(void)
+{
+    struct SignalSemaphore *sem;
+    struct DBSemaphore *ds;
+
+    Forbid();
+    if (!(sem = FindSemaphore(DB_SEMAPHORE_NAME)))
+    {
+        // Never freed, another process may find it at any time
+        if ((ds = AllocMem(sizeof(struct DBSemaphore), MEMF_PUBLIC|MEMF_CLEAR)))
+        {
+            strcpy(ds->name, DB_SEMAPHORE_NAME);
+            ds->sem.ss_Link.ln_Name = ds->name;
+            ds->sem.ss_Link.ln_Pri = 0;
+            AddSemaphore(&ds->sem);
+            sem = &ds->sem;
+        }
+    }
+    Permit();
+
+    return sem;
+}
+
+void GenerationName(ULONG generation, BOOL index, char *buffer)
+{
+    // Generation 0 is the unversioned file from before generations existed
+    if (generation == 0)
+    {
+        strcpy(buffer, index ? CHECKSUM_IDX : CHECKSUM_DB);
+    }
+    else
+    {
+        sprintf(buffer, "%s.%lu", index ? CHECKSUM_IDX : CHECKSUM_DB, generation);
+    }
+}
+
+static BOOL ReadGenerationFile(const char *name, ULONG *current, ULONG *oldest)
+{
+    BPTR fh;
+    char line[32];
+    char *p;
+    BOOL success = FALSE;
+
+    if ((fh = Open(name, MODE_OLDFILE)))
+    {
+        if (FGets(fh, line, sizeof(line)))
+        {
+            *current = strtoul(line, &p, 10);
+            *oldest = strtoul(p, &p, 10);
+            success = (*oldest <= *current) ? TRUE : FALSE;
+        }
+        Close(fh);
+    }
+    return success;
+}
+
+// The pointer file holds "<current> <oldest>", the live generation and the
+// oldest one that may still be on disk. Call with the semaphore held.
+BOOL ReadGeneration(ULONG *current, ULONG *oldest)
+{
+    char name[MAX_PATH];
+
+    if (ReadGenerationFile(CHECKSUM_GEN, current, oldest))
+        return TRUE;
+
+    // A writer died between removing the old pointer and renaming the new one
+    strcpy(name, CHECKSUM_GEN);
+    strcat(name, ".new");
+    if (ReadGenerationFile(name, current, oldest))
+        return TRUE;
+
+    *current = 0;
+    *oldest = 0;
+    return FALSE;
+}
+
+// Replace the pointer file, call with the semaphore held exclusively
+static BOOL WriteGeneration(ULONG current, ULONG oldest)
+{
+    BPTR fh;
+    char name[MAX_PATH];
+    char line[32];
+    LONG len;
+    BOOL success = FALSE;
+
+    strcpy(name, CHECKSUM_GEN);
+    strcat(name, ".new");
+
+    if ((fh = Open(name, MODE_NEWFILE)))
+    {
+        len = sprintf(line, "%lu %lu\n", current, oldest);
+        success = (Write(fh, line, len) == len) ? TRUE : FALSE;
+        if (!Close(fh)) success = FALSE;
+
+        if (success)
+        {
+            DeleteFile(CHECKSUM_GEN);
+            success = Rename(name, CHECKSUM_GEN) ? TRUE : FALSE;
+        }
+        if (!success)
+        {
+            DeleteFile(name);
+        }
+    }
+    return success;
+}
+
+// Delete one generation unless a reader still has it open
+static BOOL ReclaimGeneration(ULONG generation)
+{
+    char name[MAX_PATH];
+
+    GenerationName(generation, FALSE, name);
+    if (!DeleteFile(name) && IoErr() == ERROR_OBJECT_IN_USE)
+        return FALSE;
+
+    GenerationName(generation, TRUE, name);
+    DeleteFile(name);
+    return TRUE;
+}
+
+struct Database *OpenDatabase(void)
+{
+    struct SignalSemaphore *sem;
+    struct Database *db;
+    char dbName[MAX_PATH];
+    char idxName[MAX_PATH];
+    ULONG oldest;
+    BPTR idxfh;
+    LONG size;
+    LONG i;
+
+    if (!(db = AllocVec(sizeof(struct Database), MEMF_CLEAR)))
+        return NULL;
+
+    // Resolve and open the live generation in one step, a writer cannot
+    // switch generations while we hold the semaphore shared
+    if ((sem = GetDatabaseSemaphore()))
+        ObtainSemaphoreShared(sem);
+
+    ReadGeneration(&db->generation, &oldest);
+    GenerationName(db->generation, FALSE, dbName);
+    GenerationName(db->generation, TRUE, idxName);
+
+    if (!(db->fh = Open(dbName, MODE_OLDFILE)))
+    {
+        if (sem) ReleaseSemaphore(sem);
+        FreeVec(db);
+        return NULL;
+    }
+
+    for (i = 0; i < DB_CACHE_BLOCKS; i++)
+    {
+        db->cache[i].block = -1;
+    }
+
+    // Only the index header and block table are read up front, record
+    // blocks are faulted in by FindNextEntry() as lookups need them
+    if ((idxfh = Open(idxName, MODE_OLDFILE)))
+    {
+        if (Read(idxfh, &db->header, sizeof(db->header)) == sizeof(db->header) &&
+            db->header.magic == DB_INDEX_MAGIC &&
+            db->header.version == DB_INDEX_VERSION &&
+            db->header.blockSize == DB_BLOCK_SIZE &&
+            db->header.numBlocks > 0 &&
+            DatabaseSize(db->fh) == (LONG)db->header.dbSize)
+        {
+            size = db->header.numBlocks * sizeof(struct DBIndexBlock);
+
+            db->blocks = AllocVec(size, MEMF_ANY);
+            db->cacheData = AllocVec(DB_CACHE_BLOCKS * (DB_BLOCK_SIZE + 1), MEMF_ANY);
+
+            if (!db->blocks || !db->cacheData ||
+                Read(idxfh, db->blocks, size) != size)
+            {
+                // Stale or unreadable index, fall back to a sequential scan
+                if (db->blocks) FreeVec(db->blocks);
+                if (db->cacheData) FreeVec(db->cacheData);
+                db->blocks = NULL;
+                db->cacheData = NULL;
+            }
+            else
+            {
+                for (i = 0; i < DB_CACHE_BLOCKS; i++)
+                {
+                    db->cache[i].data = db->cacheData + i * (DB_BLOCK_SIZE + 1);
+                }
+            }
+        }
+        Close(idxfh);
+    }
+
+    if (sem) ReleaseSemaphore(sem);
+
+    return db;
+}
+
+void CloseDatabase(struct Database *db)
+{
+    struct SignalSemaphore *sem;
+    ULONG current, oldest;
+
+    if (db)
+    {
+        if (db->blocks) FreeVec(db->blocks);
+        if (db->cacheData) FreeVec(db->cacheData);
+        Close(db->fh);
+
+        // The last reader of a superseded generation reclaims it
+        if (db->generation > 0 && (sem = GetDatabaseSemaphore()))
+        {
+            ObtainSemaphoreShared(sem);
+            if (ReadGeneration(&current, &oldest) && db->generation < current)
+            {
+                ReclaimGeneration(db->generation);
+            }
+            ReleaseSemaphore(sem);
+        }
+
+        FreeVec(db);
+    }
+}
+
+// Return the cache slot holding a block, reading it in over the least
+// recently used slot on a miss
+static struct DBCacheSlot *GetBlock(struct Database *db, LONG block)
+{
+    struct DBCacheSlot *slot = NULL;
+    struct DBCacheSlot *victim = &db->cache[0];
+    struct DBIndexBlock *b = &db->blocks[block];
+    LONG i;
+
+    for (i = 0; i < DB_CACHE_BLOCKS; i++)
+    {
+        if (db->cache[i].block == block)
+        {
+            slot = &db->cache[i];
+            break;
+        }
+        if (db->cache[i].lastUse < victim->lastUse)
+        {
+            victim = &db->cache[i];
+        }
+    }
+
+    if (slot)
+    {
+        db->hits++;
+    }
+    else
+    {
+        db->misses++;
+        slot = victim;
+        slot->block = -1;
+
+        if (b->length > DB_BLOCK_SIZE ||
+            Seek(db->fh, b->offset, OFFSET_BEGINNING) == -1 ||
+            Read(db->fh, slot->data, b->length) != (LONG)b->length)
+        {
+            return NULL;
+        }
+        slot->data[b->length] = '\0';
+        slot->length = b->length;
+        slot->block = block;
+    }
+
+    slot->lastUse = ++db->useCounter;
+    return slot;
+}
+
+BOOL FindFirstEntry(struct Database *db, const char *filename,
+                    struct DBCursor *cursor, struct ChecksumEntry *entry)
+{
+    LONG lo, hi, mid;
+
+    strncpy(cursor->name, FilePart(filename), sizeof(cursor->name) - 1);
+    cursor->name[sizeof(cursor->name) - 1] = '\0';
+    cursor->hash = HashName(cursor->name);
+    cursor->pos = 0;
+    cursor->record = 0;
+
+    if (db->blocks)
+    {
+        // Find the last block starting below the hash, matching records
+        // may run on from it into the following blocks
+        lo = 0;
+        hi = db->header.numBlocks - 1;
+        cursor->block = 0;
+        while (lo <= hi)
+        {
+            mid = (lo + hi) / 2;
+            if (db->blocks[mid].firstHash < cursor->hash)
+            {
+                cursor->block = mid;
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid - 1;
+            }
+        }
+    }
+    else
+    {
+        cursor->block = -1;
+        Seek(db->fh, 0, OFFSET_BEGINNING);
+    }
+
+    return FindNextEntry(db, cursor, entry);
+}
+
+BOOL FindNextEntry(struct Database *db, struct DBCursor *cursor,
+                   struct ChecksumEntry *entry)
+{
+    struct DBCacheSlot *slot;
+    struct DBIndexBlock *b;
+    char line[MAX_DB_LINE + 1];
+    char name[108];
+    const char *p, *end;
+    ULONG len, hash;
+
+    // No usable index: stream through the whole file
+    if (cursor->block < 0)
+    {
+        while (FGets(db->fh, line, sizeof(line)))
+        {
+            cursor->record++;
+            if (line[0] == '#' || line[0] == '\n')
+                continue;
+
+            if (ReadNameField(line, name, sizeof(name)) &&
+                stricmp(name, cursor->name) == 0 &&
+                LoadDatabaseEntry(line, cursor->record, entry))
+            {
+                return TRUE;
+            }
+        }
+        return FALSE;
+    }
+
+    while (cursor->block < (LONG)db->header.numBlocks)
+    {
+        if (!(slot = GetBlock(db, cursor->block)))
+        {
+            Printf("Error: Cannot read database block %ld\n", cursor->block);
+            return FALSE;
+        }
+        b = &db->blocks[cursor->block];
+
+        while (cursor->pos < slot->length)
+        {
+            p = slot->data + cursor->pos;
+            end = strchr(p, '\n');
+            len = end ? (end - p) + 1 : slot->length - cursor->pos;
+
+            cursor->pos += len;
+            cursor->record++;
+
+            if (len > MAX_DB_LINE)
+                continue;
+            memcpy(line, p, len);
+            line[len] = '\0';
+
+            if (!ReadNameField(line, name, sizeof(name)))
+                continue;
+
+            hash = HashName(name);
+            if (hash > cursor->hash)
+            {
+                // Sorted by hash, nothing further can match
+                cursor->block = db->header.numBlocks;
+                return FALSE;
+            }
+
+            if (hash == cursor->hash && stricmp(name, cursor->name) == 0 &&
+                LoadDatabaseEntry(line, DB_HEADER_LINES + b->firstRecord + cursor->record, entry))
+            {
+                return TRUE;
+            }
+        }
+
+        cursor->block++;
+        cursor->pos = 0;
+        cursor->record = 0;
+    }
+
+    return FALSE;
+}
+
+struct DBWriter *CreateDatabaseWriter(void)
+{
+    struct DBWriter *w;
+    LONG i;
+
+    if (!(w = AllocVec(sizeof(struct DBWriter), MEMF_CLEAR)))
+        return NULL;
+
+    // Private names so concurrent writers never share a temporary file
+    sprintf(w->dbName, "%s.%08lx.new", CHECKSUM_DB, (ULONG)FindTask(NULL));
+    sprintf(w->idxName, "%s.%08lx.new", CHECKSUM_IDX, (ULONG)FindTask(NULL));
+
+    w->fh = Open(w->dbName, MODE_NEWFILE);
+    w->idxfh = Open(w->idxName, MODE_NEWFILE);
+    if (!w->fh || !w->idxfh)
+    {
+        if (w->fh)
+        {
+            Close(w->fh);
+            DeleteFile(w->dbName);
+        }
+        if (w->idxfh)
+        {
+            Close(w->idxfh);
+            DeleteFile(w->idxName);
+        }
+        FreeVec(w);
+        return NULL;
+    }
+
+    // Set buffer for better performance
+    SetVBuf(w->fh, NULL, BUF_FULL, 4096);
+
+    w->header.magic = DB_INDEX_MAGIC;
+    w->header.version = DB_INDEX_VERSION;
+    w->header.blockSize = DB_BLOCK_SIZE;
+
+    for (i = 0; i < DB_HEADER_LINES; i++)
+    {
+        if (FPuts(w->fh, dbHeaderLines[i]) == -1)
+        {
+            Printf("Error writing database header\n");
+            w->error = TRUE;
+        }
+        w->offset += strlen(dbHeaderLines[i]);
+    }
+
+    return w;
+}
+
+BOOL WriteDatabaseEntry(struct DBWriter *w, const struct ChecksumEntry *entry)
+{
+    struct DBIndexBlock *b = NULL;
+    struct DBIndexBlock *newBlocks;
+    char line[MAX_DB_LINE + 1];
+    ULONG len;
+
+    if (w->error)
+        return FALSE;
+
+    len = sprintf(line, "%08lx|%lu|%s|%lu.%lu|%lu|%s\n",
+                  entry->checksum,
+                  entry->filesize,
+                  entry->filename,
+                  (ULONG)entry->version,
+                  (ULONG)entry->revision,
+                  entry->date,
+                  entry->origin);
+
+    if (w->header.numBlocks > 0)
+    {
+        b = &w->blocks[w->header.numBlocks - 1];
+    }
+
+    // Lines never straddle blocks so each block parses on its own
+    if (!b || b->length + len > DB_BLOCK_SIZE)
+    {
+        if (w->header.numBlocks == w->maxBlocks)
+        {
+            w->maxBlocks = w->maxBlocks ? w->maxBlocks * 2 : 64;
+            if (!(newBlocks = AllocVec(w->maxBlocks * sizeof(struct DBIndexBlock), MEMF_ANY)))
+            {
+                Printf("Error: Out of memory for database index\n");
+                w->error = TRUE;
+                return FALSE;
+            }
+            if (w->blocks)
+            {
+                CopyMem(w->blocks, newBlocks, w->header.numBlocks * sizeof(struct DBIndexBlock));
+                FreeVec(w->blocks);
+            }
+            w->blocks = newBlocks;
+        }
+
+        b = &w->blocks[w->header.numBlocks++];
+        b->firstHash = HashName(entry->filename);
+        b->firstRecord = w->header.numRecords;
+        b->offset = w->offset;
+        b->length = 0;
+    }
+
+    if (FWrite(w->fh, line, len, 1) != 1)
+    {
+        Printf("Error writing database entry %ld\n", w->header.numRecords);
+        w->error = TRUE;
+        return FALSE;
+    }
+
+    b->length += len;
+    w->offset += len;
+    w->header.numRecords++;
+
+    return TRUE;
+}
+
+// Install the finished files as the next generation and switch the
+// pointer to it, then reclaim superseded generations no reader holds
+static BOOL PublishDatabase(struct DBWriter *w)
+{
+    struct SignalSemaphore *sem;
+    char dbName[MAX_PATH];
+    char idxName[MAX_PATH];
+    ULONG current, oldest, next, g;
+    BOOL success = FALSE;
+
+    if (!(sem = GetDatabaseSemaphore()))
+    {
+        Printf("Error: Cannot create database semaphore\n");
+        return FALSE;
+    }
+    ObtainSemaphore(sem);
+
+    ReadGeneration(&current, &oldest);
+    next = current + 1;
+    GenerationName(next, FALSE, dbName);
+    GenerationName(next, TRUE, idxName);
+
+    // Leftovers of a writer that died before switching
+    DeleteFile(dbName);
+    DeleteFile(idxName);
+
+    if (Rename(w->dbName, dbName) && Rename(w->idxName, idxName))
+    {
+        if (!SetProtection(dbName, FIBF_READ|FIBF_WRITE))
+        {
+            Printf("Warning: Could not set file protection\n");
+        }
+
+        if (WriteGeneration(next, oldest))
+        {
+            success = TRUE;
+
+            // Readers opened before the switch keep their files open,
+            // those generations are left for the next pass
+            for (g = oldest; g < next; g++)
+            {
+                if (!ReclaimGeneration(g))
+                    break;
+            }
+            if (g != oldest)
+            {
+                WriteGeneration(next, g);
+            }
+        }
+        else
+        {
+            Printf("Error switching database generation\n");
+        }
+    }
+    else
+    {
+        Printf("Error renaming database file\n");
+    }
+
+    if (!success)
+    {
+        DeleteFile(dbName);
+        DeleteFile(idxName);
+    }
+
+    ReleaseSemaphore(sem);
+    return success;
+}
+
+BOOL CloseDatabaseWriter(struct DBWriter *w, BOOL publish)
+{
+    BOOL success = !w->error;
+    LONG size;
+
+    if (!Close(w->fh))
+    {
+        success = FALSE;
+    }
+
+    if (success)
+    {
+        w->header.dbSize = w->offset;
+        size = w->header.numBlocks * sizeof(struct DBIndexBlock);
+
+        if (Write(w->idxfh, &w->header, sizeof(w->header)) != sizeof(w->header) ||
+            (size && Write(w->idxfh, w->blocks, size) != size))
+        {
+            Printf("Error writing database index\n");
+            success = FALSE;
+        }
+    }
+
+    if (!Close(w->idxfh))
+    {
+        success = FALSE;
+    }
+
+    if (success && publish)
+    {
+        success = PublishDatabase(w);
+    }
+
+    // Anything not renamed into place is discarded
+    DeleteFile(w->dbName);
+    DeleteFile(w->idxName);
+
+    if (w->blocks) FreeVec(w->blocks);
+    FreeVec(w);
+
+    return success && publish;
+}
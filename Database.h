@@ -0,0 +1,102 @@
+#ifndef DATABASE_H
+#define DATABASE_H
+
+#include "Shared.h"
+#include <exec/semaphores.h>
+
+#define CHECKSUM_IDX "PROGDIR:QuickUpdate.idx"
+#define CHECKSUM_GEN "PROGDIR:QuickUpdate.gen"
+#define DB_SEMAPHORE_NAME "QuickUpdate.db"
+
+#define DB_INDEX_MAGIC   0x51554958  // 'QUIX'
+#define DB_INDEX_VERSION 1
+#define DB_HEADER_LINES  2           // Comment lines before the first record
+#define DB_BLOCK_SIZE    2048        // Maximum bytes of whole lines per block
+#define DB_CACHE_BLOCKS  TUNE_DB_CACHE // Blocks kept in the LRU cache
+
+// Index file header, followed by numBlocks DBIndexBlock records.
+// Records in the text database are sorted by HashName(filename), so each
+// block covers a contiguous hash range and can be found by binary search.
+struct DBIndexHeader {
+    ULONG magic;
+    UWORD version;
+    UWORD blockSize;
+    ULONG numRecords;
+    ULONG numBlocks;
+    ULONG dbSize;       // Size of the text database this index describes
+};
+
+struct DBIndexBlock {
+    ULONG firstHash;    // HashName() of the first record in the block
+    ULONG firstRecord;  // Ordinal of the first record (for error messages)
+    ULONG offset;       // File offset of the first line in the block
+    ULONG length;       // Bytes of whole lines in the block
+};
+
+struct DBCacheSlot {
+    LONG block;         // Block number held, -1 if empty
+    ULONG lastUse;      // LRU stamp
+    ULONG length;
+    char *data;         // DB_BLOCK_SIZE + 1 bytes, NUL terminated
+};
+
+// Public semaphore serialising generation switches. Readers hold it shared
+// only while resolving and opening the current generation; the open file
+// then pins their snapshot, since AmigaDOS refuses to delete open files.
+struct DBSemaphore {
+    struct SignalSemaphore sem;
+    char name[sizeof(DB_SEMAPHORE_NAME)];
+};
+
+struct Database {
+    BPTR fh;
+    ULONG generation;   // Snapshot this reader holds, 0 for the legacy file
+    struct DBIndexHeader header;
+    struct DBIndexBlock *blocks;    // NULL: no usable index, scan sequentially
+    struct DBCacheSlot cache[DB_CACHE_BLOCKS];
+    char *cacheData;
+    ULONG useCounter;
+    ULONG hits;
+    ULONG misses;
+};
+
+// Iteration state for all records matching one filename
+struct DBCursor {
+    ULONG hash;
+    char name[108];
+    LONG block;         // Current block, -1 in sequential fallback mode
+    ULONG pos;          // Byte position inside the block
+    ULONG record;       // Record ordinal within the block
+};
+
+struct DBWriter {
+    char dbName[MAX_PATH];      // Private temporary files until published
+    char idxName[MAX_PATH];
+    BPTR fh;
+    BPTR idxfh;
+    struct DBIndexHeader header;
+    struct DBIndexBlock *blocks;
+    ULONG maxBlocks;
+    ULONG offset;       // Bytes written to the text database so far
+    BOOL error;
+};
+
+// Generations
+BOOL ReadGeneration(ULONG *current, ULONG *oldest);
+void GenerationName(ULONG generation, BOOL index, char *buffer);
+
+// Reader
+struct Database *OpenDatabase(void);
+void CloseDatabase(struct Database *db);
+BOOL FindFirstEntry(struct Database *db, const char *filename,
+                    struct DBCursor *cursor, struct ChecksumEntry *entry);
+BOOL FindNextEntry(struct Database *db, struct DBCursor *cursor,
+                   struct ChecksumEntry *entry);
+
+// Writer: entries must be passed in HashName() order. Closing with publish
+// set installs the file as the next generation, otherwise it is discarded.
+struct DBWriter *CreateDatabaseWriter(void);
+BOOL WriteDatabaseEntry(struct DBWriter *w, const struct ChecksumEntry *entry);
+BOOL CloseDatabaseWriter(struct DBWriter *w, BOOL publish);
+
+#endif /* DATABASE_H */
@@ -0,0 +1,332 @@
+#include "Delta.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+
+void RollSumInit(struct RollSum *r, const UBYTE *data, ULONG length)
+{
+    ULONG i;
+    
+    r->a = 0;
+    r->b = 0;
+    r->length = length;
+    for (i = 0; i < length; i++)
+    {
+        r->a += data[i];
+        r->b += (length - i) * data[i];
+    }
+}
+
+void RollSumRotate(struct RollSum *r, UBYTE out, UBYTE in)
+{
+    r->a += in - out;
+    r->b += r->a - r->length * out;
+}
+
+// Whole file in one allocation, for CreateDelta() only
+static UBYTE *LoadFile(const char *path, ULONG *size)
+{
+    struct FileInfoBlock *fib;
+    UBYTE *data = NULL;
+    LONG length = -1;
+    BPTR fh;
+    
+    if (!(fh = Open(path, MODE_OLDFILE)))
+        return NULL;
+    
+    if ((fib = AllocDosObject(DOS_FIB, NULL)))
+    {
+        if (ExamineFH(fh, fib))
+            length = fib->fib_Size;
+        FreeDosObject(DOS_FIB, fib);
+    }
+    
+    // One spare byte, so an empty file still gets a buffer
+    if (length >= 0 && (data = AllocVec(length + 1, MEMF_ANY)))
+    {
+        if (Read(fh, data, length) != length)
+        {
+            FreeVec(data);
+            data = NULL;
+        }
+    }
+    Close(fh);
+    
+    *size = length;
+    return data;
+}
+
+struct DeltaWriter {
+    BPTR fh;
+    const UBYTE *target;
+    ULONG literal;              // Start of the target bytes not yet covered
+    ULONG copyOffset;           // COPY held back in case the next one adjoins
+    ULONG copyLength;
+    ULONG written;
+    BOOL ok;
+};
+
+static void PutOp(struct DeltaWriter *w, ULONG type, ULONG offset, ULONG length)
+{
+    struct DeltaOp op;
+    
+    op.type = type;
+    op.offset = offset;
+    op.length = length;
+    if (FWrite(w->fh, &op, sizeof(op), 1) != 1)
+        w->ok = FALSE;
+    w->written += sizeof(op);
+}
+
+static void FlushCopy(struct DeltaWriter *w)
+{
+    if (w->copyLength)
+    {
+        PutOp(w, DELTA_COPY, w->copyOffset, w->copyLength);
+        w->copyLength = 0;
+    }
+}
+
+static void FlushLiteral(struct DeltaWriter *w, ULONG end)
+{
+    if (end > w->literal)
+    {
+        FlushCopy(w);
+        PutOp(w, DELTA_DATA, 0, end - w->literal);
+        if (FWrite(w->fh, w->target + w->literal, end - w->literal, 1) != 1)
+            w->ok = FALSE;
+        w->written += end - w->literal;
+        w->literal = end;
+    }
+}
+
+static void AddCopy(struct DeltaWriter *w, ULONG pos, ULONG offset, ULONG length)
+{
+    FlushLiteral(w, pos);
+    
+    if (w->copyLength && w->copyOffset + w->copyLength == offset)
+    {
+        w->copyLength += length;
+    }
+    else
+    {
+        FlushCopy(w);
+        w->copyOffset = offset;
+        w->copyLength = length;
+    }
+    w->literal = pos + length;
+}
+
+// Finds the blocks of base in target with the rolling checksum, extends
+// each match both ways byte by byte and writes the rest as data. Both
+// files are loaded whole: this runs where releases are prepared, not on
+// the machine being updated.
+BOOL CreateDelta(const char *base, const char *target, const char *patch, ULONG *written)
+{
+    struct DeltaHeader header;
+    struct DeltaWriter w;
+    struct RollSum rs;
+    UBYTE *old = NULL, *new = NULL;
+    ULONG *heads = NULL, *next = NULL, *weaks = NULL;
+    ULONG oldSize, newSize, blocks, mask, weak, i, p, off, len;
+    BOOL found;
+    
+    memset(&w, 0, sizeof(w));
+    *written = 0;
+    
+    if (strlen(FilePart(target)) >= DELTA_NAME)
+        return FALSE;
+    
+    if (!(old = LoadFile(base, &oldSize)) || !(new = LoadFile(target, &newSize)))
+        goto done;
+    
+    blocks = oldSize / DELTA_BLOCK;
+    for (mask = 256; mask < blocks; mask <<= 1)
+        ;
+    mask--;
+    
+    if (!(heads = AllocVec((mask + 1) * sizeof(ULONG), MEMF_CLEAR)) ||
+        !(next = AllocVec((blocks + 1) * sizeof(ULONG), MEMF_ANY)) ||
+        !(weaks = AllocVec((blocks + 1) * sizeof(ULONG), MEMF_ANY)))
+        goto done;
+    
+    // Chains hold block numbers plus one, lowest first
+    for (i = blocks; i > 0; i--)
+    {
+        RollSumInit(&rs, old + (i - 1) * DELTA_BLOCK, DELTA_BLOCK);
+        weaks[i - 1] = RollSumDigest(&rs);
+        next[i - 1] = heads[weaks[i - 1] & mask];
+        heads[weaks[i - 1] & mask] = i;
+    }
+    
+    if (!(w.fh = Open(patch, MODE_NEWFILE)))
+        goto done;
+    SetVBuf(w.fh, NULL, BUF_FULL, 8192);
+    w.target = new;
+    w.ok = TRUE;
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = DELTA_MAGIC;
+    header.baseChecksum = UpdateCRC32(0xFFFFFFFF, old, oldSize) ^ 0xFFFFFFFF;
+    header.baseSize = oldSize;
+    header.targetChecksum = UpdateCRC32(0xFFFFFFFF, new, newSize) ^ 0xFFFFFFFF;
+    header.targetSize = newSize;
+    strcpy(header.name, FilePart(target));
+    if (FWrite(w.fh, &header, sizeof(header), 1) != 1)
+        w.ok = FALSE;
+    w.written = sizeof(header);
+    
+    p = 0;
+    if (blocks && newSize >= DELTA_BLOCK)
+        RollSumInit(&rs, new, DELTA_BLOCK);
+    
+    while (blocks && w.ok && p + DELTA_BLOCK <= newSize)
+    {
+        weak = RollSumDigest(&rs);
+        found = FALSE;
+        for (i = heads[weak & mask]; i; i = next[i - 1])
+        {
+            if (weaks[i - 1] == weak &&
+                memcmp(old + (i - 1) * DELTA_BLOCK, new + p, DELTA_BLOCK) == 0)
+            {
+                found = TRUE;
+                break;
+            }
+        }
+    
+        if (!found)
+        {
+            if (p + DELTA_BLOCK < newSize)
+                RollSumRotate(&rs, new[p], new[p + DELTA_BLOCK]);
+            p++;
+            continue;
+        }
+    
+        off = (i - 1) * DELTA_BLOCK;
+        len = DELTA_BLOCK;
+        while (p + len < newSize && off + len < oldSize && old[off + len] == new[p + len])
+            len++;
+        while (p > w.literal && off > 0 && old[off - 1] == new[p - 1])
+        {
+            p--;
+            off--;
+            len++;
+        }
+    
+        AddCopy(&w, p, off, len);
+        p += len;
+        if (p + DELTA_BLOCK <= newSize)
+            RollSumInit(&rs, new + p, DELTA_BLOCK);
+    }
+    
+    FlushLiteral(&w, newSize);
+    FlushCopy(&w);
+    PutOp(&w, DELTA_END, 0, 0);
+    
+    if (!Close(w.fh))
+        w.ok = FALSE;
+    if (!w.ok)
+        DeleteFile(patch);
+    *written = w.written;
+    
+done:
+    if (weaks) FreeVec(weaks);
+    if (next) FreeVec(next);
+    if (heads) FreeVec(heads);
+    if (new) FreeVec(new);
+    if (old) FreeVec(old);
+    return w.ok;
+}
+
+BOOL ReadDeltaHeader(const char *patch, struct DeltaHeader *header)
+{
+    BPTR fh;
+    BOOL ok;
+    
+    if (!(fh = Open(patch, MODE_OLDFILE)))
+        return FALSE;
+    
+    ok = Read(fh, header, sizeof(*header)) == sizeof(*header) &&
+         header->magic == DELTA_MAGIC && memchr(header->name, '\0', DELTA_NAME) != NULL;
+    Close(fh);
+    
+    return ok;
+}
+
+// Rebuilds the target from base and the patch, streaming: COPY ranges are
+// read from base a buffer at a time, DATA from the patch. Every range is
+// checked against the sizes in the header, and dest is deleted unless it
+// comes out with the target's size and checksum.
+BOOL ApplyDelta(const char *base, const char *patch, const char *dest)
+{
+    struct DeltaHeader header;
+    struct DeltaOp op;
+    UBYTE *buffer;
+    ULONG crc = 0xFFFFFFFF;
+    ULONG size = 0;
+    LONG n;
+    BPTR fb = 0, fp = 0, fd = 0;
+    BOOL ok = FALSE;
+    BOOL done = FALSE;
+    
+    if (!(buffer = AllocVec(DELTA_IO, MEMF_ANY)))
+        return FALSE;
+    
+    if ((fb = Open(base, MODE_OLDFILE)) && (fp = Open(patch, MODE_OLDFILE)) &&
+        (fd = Open(dest, MODE_NEWFILE)))
+    {
+        SetVBuf(fp, NULL, BUF_FULL, 8192);
+        ok = FRead(fp, &header, sizeof(header), 1) == 1 && header.magic == DELTA_MAGIC;
+    
+        while (ok && !done)
+        {
+            if (FRead(fp, &op, sizeof(op), 1) != 1)
+            {
+                ok = FALSE;
+                break;
+            }
+    
+            if (op.type == DELTA_END)
+                done = TRUE;
+            else if (op.type == DELTA_COPY)
+                ok = op.offset <= header.baseSize && op.length <= header.baseSize - op.offset &&
+                     Seek(fb, op.offset, OFFSET_BEGINNING) != -1;
+            else if (op.type != DELTA_DATA)
+                ok = FALSE;
+    
+            if (op.length > header.targetSize - size)
+                ok = FALSE;
+    
+            while (ok && !done && op.length)
+            {
+                n = op.length < DELTA_IO ? op.length : DELTA_IO;
+                if (op.type == DELTA_COPY)
+                    ok = Read(fb, buffer, n) == n;
+                else
+                    ok = FRead(fp, buffer, 1, n) == n;
+    
+                if (ok)
+                {
+                    ok = Write(fd, buffer, n) == n;
+                    crc = UpdateCRC32(crc, buffer, n);
+                    size += n;
+                    op.length -= n;
+                }
+            }
+        }
+    }
+    
+    ok = ok && done && size == header.targetSize && (crc ^ 0xFFFFFFFF) == header.targetChecksum;
+    
+    if (fd && !Close(fd))
+        ok = FALSE;
+    if (fp) Close(fp);
+    if (fb) Close(fb);
+    if (fd && !ok)
+        DeleteFile(dest);
+    
+    FreeVec(buffer);
+    return ok;
+}
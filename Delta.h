@@ -0,0 +1,53 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "Shared.h"
+
+#define DELTA_MAGIC  0x51554431     // "QUD1"
+#define DELTA_BLOCK  512            // Match granularity of CreateDelta()
+#define DELTA_NAME   32             // File name, as FFS allows
+#define DELTA_IO     BUFFER_SIZE    // Bytes ApplyDelta() moves at a time
+
+// Op types
+#define DELTA_END  0
+#define DELTA_COPY 1                // Bytes of the installed file
+#define DELTA_DATA 2                // Bytes that follow in the patch
+
+// A patch turns one release of a file into another. The header names the
+// release it applies to by checksum, so it can be checked against the
+// installed file before anything is written, and the release it makes,
+// so the result can be checked before it is installed. The ops follow,
+// each a DeltaOp, DATA ones followed by their bytes, up to an END.
+struct DeltaHeader {
+    ULONG magic;
+    ULONG baseChecksum;
+    ULONG baseSize;
+    ULONG targetChecksum;
+    ULONG targetSize;
+    char name[DELTA_NAME];
+};
+
+struct DeltaOp {
+    ULONG type;
+    ULONG offset;                   // COPY only
+    ULONG length;
+};
+
+// rsync's weak checksum: two 16 bit sums over a window, updated in
+// constant time as the window slides by a byte
+struct RollSum {
+    ULONG a;
+    ULONG b;
+    ULONG length;
+};
+
+#define RollSumDigest(r) (((r)->b << 16) | ((r)->a & 0xFFFF))
+
+void RollSumInit(struct RollSum *r, const UBYTE *data, ULONG length);
+void RollSumRotate(struct RollSum *r, UBYTE out, UBYTE in);
+
+BOOL CreateDelta(const char *base, const char *target, const char *patch, ULONG *written);
+BOOL ReadDeltaHeader(const char *patch, struct DeltaHeader *header);
+BOOL ApplyDelta(const char *base, const char *patch, const char *dest);
+
+#endif /* DELTA_H */
@@ -0,0 +1,120 @@
+#include "DirIter.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+
+// Directory entries are always returned, the pattern only filters files
+struct DirIter *CreateDirIter(const char *pattern, LONG bufferSize)
+{
+    struct DirIter *it;
+    LONG len;
+    
+    if (!(it = AllocVec(sizeof(struct DirIter), MEMF_CLEAR)))
+        return NULL;
+    
+    it->bufferSize = bufferSize;
+    it->buffer = AllocVec(bufferSize, MEMF_ANY);
+    it->eac = AllocDosObject(DOS_EXALLCONTROL, NULL);
+    
+    if (it->buffer && it->eac && pattern)
+    {
+        // Compiled once, matched against every file name we see
+        len = strlen(pattern) * 2 + 2;
+        if ((it->pattern = AllocVec(len, MEMF_ANY)))
+        {
+            if (ParsePatternNoCase(pattern, it->pattern, len) == -1)
+            {
+                FreeVec(it->pattern);
+                it->pattern = NULL;
+            }
+        }
+    }
+    
+    if (!it->buffer || !it->eac || (pattern && !it->pattern))
+    {
+        DeleteDirIter(it);
+        return NULL;
+    }
+    
+    return it;
+}
+
+void DeleteDirIter(struct DirIter *it)
+{
+    if (it)
+    {
+        EndDirIter(it);
+        if (it->pattern) FreeVec(it->pattern);
+        if (it->eac) FreeDosObject(DOS_EXALLCONTROL, it->eac);
+        if (it->buffer) FreeVec(it->buffer);
+        FreeVec(it);
+    }
+}
+
+BOOL StartDirIter(struct DirIter *it, BPTR lock)
+{
+    EndDirIter(it);
+    
+    it->lock = lock;
+    it->eac->eac_LastKey = 0;
+    it->eac->eac_MatchString = NULL;
+    it->eac->eac_MatchFunc = NULL;
+    it->next = NULL;
+    it->more = TRUE;
+    it->error = 0;
+    
+    return TRUE;
+}
+
+struct ExAllData *NextDirEntry(struct DirIter *it)
+{
+    struct ExAllData *ed;
+    
+    for (;;)
+    {
+        while ((ed = it->next))
+        {
+            it->next = ed->ed_Next;
+            
+            if (ed->ed_Type < 0 && it->pattern &&
+                !MatchPatternNoCase(it->pattern, ed->ed_Name))
+            {
+                continue;
+            }
+            
+            it->entries++;
+            return ed;
+        }
+        
+        if (!it->more)
+            return NULL;
+        
+        // ED_DATE returns name, type, size, protection and date in one go
+        it->more = ExAll(it->lock, it->buffer, it->bufferSize, ED_DATE, it->eac) ? TRUE : FALSE;
+        it->calls++;
+        
+        if (!it->more && IoErr() != ERROR_NO_MORE_ENTRIES)
+        {
+            it->error = IoErr();
+        }
+        
+        // Entries are valid even when ExAll() reports the last batch
+        it->next = (it->eac->eac_Entries > 0) ? it->buffer : NULL;
+        it->seen += it->eac->eac_Entries;
+    }
+}
+
+// Release the filesystem's ExAll() state if the directory was not read to
+// the end; harmless otherwise
+void EndDirIter(struct DirIter *it)
+{
+    if (it->lock && it->more)
+    {
+        ExAllEnd(it->lock, it->buffer, it->bufferSize, ED_DATE, it->eac);
+    }
+    it->lock = 0;
+    it->more = FALSE;
+    it->next = NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef DIRITER_H
+#define DIRITER_H
+
+#include <exec/types.h>
+#include <dos/dos.h>
+#include <dos/exall.h>
+#include "Tuning.h"
+
+#define DIRITER_BUFFER_SIZE TUNE_DIR_BUFFER // One ExAll batch, about 150 entries at 8 KB
+
+// Directory iterator built on ExAll(). A single iterator (buffer, control
+// block and compiled pattern) is reused for any number of directories, so
+// scanning a directory of thousands of entries costs a handful of packets.
+struct DirIter {
+    BPTR lock;                  // Directory being read, not owned
+    struct ExAllControl *eac;
+    struct ExAllData *buffer;
+    LONG bufferSize;
+    struct ExAllData *next;     // Next unread entry of the current batch
+    BOOL more;                  // ExAll() has further batches
+    char *pattern;              // Parsed file name pattern, NULL for all
+    LONG error;                 // IoErr() if reading stopped early
+    ULONG calls;                // ExAll() round trips so far
+    ULONG entries;              // Entries returned so far
+    ULONG seen;                 // Entries ExAll() delivered, before the pattern
+};
+
+struct DirIter *CreateDirIter(const char *pattern, LONG bufferSize);
+void DeleteDirIter(struct DirIter *it);
+BOOL StartDirIter(struct DirIter *it, BPTR lock);
+struct ExAllData *NextDirEntry(struct DirIter *it);
+void EndDirIter(struct DirIter *it);
+
+#endif /* DIRITER_H */
@@ -0,0 +1,227 @@
+#include "DirWalk.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+
+#define WALK_INITIAL_PATH   256
+#define WALK_INITIAL_NAMES  1024
+
+// Grow a buffer to hold at least needed bytes, keeping its contents
+static BOOL GrowBuffer(APTR *buffer, ULONG *size, ULONG used, ULONG needed)
+{
+    ULONG newSize = *size;
+    APTR newBuffer;
+    
+    if (needed <= *size)
+        return TRUE;
+    
+    while (newSize < needed) newSize *= 2;
+    
+    if (!(newBuffer = AllocVec(newSize, MEMF_ANY)))
+        return FALSE;
+    
+    CopyMem(*buffer, newBuffer, used);
+    FreeVec(*buffer);
+    *buffer = newBuffer;
+    *size = newSize;
+    return TRUE;
+}
+
+struct DirWalk *CreateDirWalk(const char *pattern, DirWalkFunc func, APTR userData)
+{
+    struct DirWalk *walk;
+    
+    if (!(walk = AllocVec(sizeof(struct DirWalk), MEMF_CLEAR)))
+        return NULL;
+    
+    walk->func = func;
+    walk->userData = userData;
+    walk->pathSize = WALK_INITIAL_PATH;
+    walk->namesSize = WALK_INITIAL_NAMES;
+    
+    walk->iter = CreateDirIter(pattern, DIRITER_BUFFER_SIZE);
+    walk->path = AllocVec(walk->pathSize, MEMF_ANY);
+    walk->names = AllocVec(walk->namesSize, MEMF_ANY);
+    walk->fib = AllocDosObject(DOS_FIB, NULL);
+    
+    if (!walk->iter || !walk->path || !walk->names || !walk->fib)
+    {
+        DeleteDirWalk(walk);
+        return NULL;
+    }
+    
+    return walk;
+}
+
+void DeleteDirWalk(struct DirWalk *walk)
+{
+    if (walk)
+    {
+        if (walk->iter) DeleteDirIter(walk->iter);
+        if (walk->path) FreeVec(walk->path);
+        if (walk->names) FreeVec(walk->names);
+        if (walk->fib) FreeDosObject(DOS_FIB, walk->fib);
+        FreeVec(walk);
+    }
+}
+
+// Append a path component, returns the previous length for PopPath()
+static LONG PushPath(struct DirWalk *walk, const char *name)
+{
+    ULONG oldLen = walk->pathLen;
+    ULONG len = strlen(name);
+    BOOL sep;
+    
+    sep = (oldLen > 0 && walk->path[oldLen - 1] != ':' && walk->path[oldLen - 1] != '/');
+    
+    if (!GrowBuffer((APTR *)&walk->path, &walk->pathSize, oldLen + 1,
+                    oldLen + sep + len + 1))
+    {
+        return -1;
+    }
+    
+    if (sep) walk->path[walk->pathLen++] = '/';
+    memcpy(walk->path + walk->pathLen, name, len + 1);
+    walk->pathLen += len;
+    
+    return (LONG)oldLen;
+}
+
+static void PopPath(struct DirWalk *walk, ULONG len)
+{
+    walk->pathLen = len;
+    walk->path[len] = '\0';
+}
+
+static BOOL PushName(struct DirWalk *walk, const char *name)
+{
+    ULONG len = strlen(name) + 1;
+    
+    if (!GrowBuffer((APTR *)&walk->names, &walk->namesSize, walk->namesLen,
+                    walk->namesLen + len))
+    {
+        return FALSE;
+    }
+    
+    memcpy(walk->names + walk->namesLen, name, len);
+    walk->namesLen += len;
+    return TRUE;
+}
+
+// Queue a subdirectory of the directory being visited. Only valid from the
+// callback, and a no-op unless the walk is recursive.
+BOOL DirWalkQueue(struct DirWalk *walk, const char *name)
+{
+    if (!walk->recursive)
+        return TRUE;
+    
+    if (!PushName(walk, name))
+    {
+        walk->error = ERROR_NO_FREE_STORE;
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+// Read one directory completely. Files are reported as they come, wanted
+// subdirectories are queued so the single ExAll buffer is free again
+// before we descend.
+static BOOL ScanDirectory(struct DirWalk *walk, BPTR lock)
+{
+    struct ExAllData *ed;
+    LONG oldLen;
+    LONG rc;
+    
+    StartDirIter(walk->iter, lock);
+    
+    while ((ed = NextDirEntry(walk->iter)))
+    {
+        if ((oldLen = PushPath(walk, (char *)ed->ed_Name)) < 0)
+        {
+            walk->error = ERROR_NO_FREE_STORE;
+            EndDirIter(walk->iter);
+            return FALSE;
+        }
+        
+        if (ed->ed_Type > 0)
+        {
+            rc = walk->func(walk, DWE_DIR, ed, walk->userData);
+            if (rc == WALK_CONTINUE && walk->recursive &&
+                !PushName(walk, (char *)ed->ed_Name))
+            {
+                walk->error = ERROR_NO_FREE_STORE;
+                rc = WALK_ABORT;
+            }
+        }
+        else
+        {
+            rc = walk->func(walk, DWE_FILE, ed, walk->userData);
+        }
+        
+        PopPath(walk, oldLen);
+        
+        if (rc == WALK_ABORT)
+        {
+            EndDirIter(walk->iter);
+            return FALSE;
+        }
+    }
+    
+    if (walk->iter->error)
+    {
+        walk->error = walk->iter->error;
+    }
+    EndDirIter(walk->iter);
+    
+    return TRUE;
+}
+
+// Announce a directory, read it unless the callback objects, then report
+// that its entries are complete
+static BOOL EnterDirectory(struct DirWalk *walk, BPTR lock)
+{
+    LONG rc;
+    
+    if (!Examine(lock, walk->fib))
+    {
+        walk->error = IoErr();
+        return TRUE;
+    }
+    
+    rc = walk->func(walk, DWE_ENTER, NULL, walk->userData);
+    
+    if (rc == WALK_ABORT)
+        return FALSE;
+    if (rc == WALK_SKIP)
+        return TRUE;
+    if (rc == WALK_CONTINUE && !ScanDirectory(walk, lock))
+        return FALSE;
+    
+    return walk->func(walk, DWE_DONE, NULL, walk->userData) != WALK_ABORT;
+}
+
+// Visit one directory without descending. lock is the directory path
+// names and stays the caller's, who locks the subdirectories relative to
+// it. With collect set, the wanted subdirectories are left in walk->names
+// (NUL separated, namesLen bytes) for the caller to schedule. Returns
+// FALSE only if the callback aborted or memory ran out.
+BOOL VisitDirectory(struct DirWalk *walk, const char *path, BPTR lock, BOOL collect)
+{
+    walk->recursive = collect;
+    walk->pathLen = 0;
+    walk->path[0] = '\0';
+    walk->namesLen = 0;
+    walk->error = 0;
+    
+    if (PushPath(walk, path) < 0)
+    {
+        walk->error = ERROR_NO_FREE_STORE;
+        return FALSE;
+    }
+    walk->dirs++;
+    
+    return EnterDirectory(walk, lock);
+}
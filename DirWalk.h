@@ -0,0 +1,52 @@
+#ifndef DIRWALK_H
+#define DIRWALK_H
+
+#include "DirIter.h"
+
+// Callback results
+#define WALK_CONTINUE 0
+#define WALK_SKIP     1     // DWE_DIR, DWE_ENTER: do not descend into this directory
+#define WALK_ABORT    2     // Stop the walk
+#define WALK_NOSCAN   3     // DWE_ENTER: do not read the directory, the callback
+                            // queues the subdirectories it wants with DirWalkQueue()
+
+// Callback events, walk->path holds the full path of the entry
+#define DWE_FILE  1
+#define DWE_DIR   2
+#define DWE_ENTER 3         // Directory opened, walk->fib describes it, ed is NULL
+#define DWE_DONE  4         // All entries of the directory reported, ed is NULL
+#define DWE_START 5         // ParWalk: worker starting, in its own process
+#define DWE_END   6         // ParWalk: worker finished, in its own process
+
+struct DirWalk;
+
+typedef LONG (*DirWalkFunc)(struct DirWalk *walk, LONG event,
+                            struct ExAllData *ed, APTR userData);
+
+// Directory visitor. Memory is one ExAll buffer, one path buffer that
+// grows and shrinks by components and the names of the subdirectories
+// found in the directory being visited. The caller holds the directory's
+// lock and schedules the subdirectories, locking each relative to its
+// parent (see ParWalk.c).
+struct DirWalk {
+    struct DirIter *iter;
+    char *path;
+    ULONG pathLen;
+    ULONG pathSize;
+    char *names;        // Pending subdirectory names, NUL separated
+    ULONG namesLen;
+    ULONG namesSize;
+    BOOL recursive;
+    struct FileInfoBlock *fib;
+    DirWalkFunc func;
+    APTR userData;
+    LONG error;         // Last IoErr() for a directory that could not be read
+    ULONG dirs;         // Directories entered
+};
+
+struct DirWalk *CreateDirWalk(const char *pattern, DirWalkFunc func, APTR userData);
+void DeleteDirWalk(struct DirWalk *walk);
+BOOL DirWalkQueue(struct DirWalk *walk, const char *name);
+BOOL VisitDirectory(struct DirWalk *walk, const char *path, BPTR lock, BOOL collect);
+
+#endif /* DIRWALK_H */
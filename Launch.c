@@ -0,0 +1,153 @@
+#include <exec/types.h>
+#include <exec/execbase.h>
+#include <dos/dos.h>
+#include <dos/dosextens.h>
+#include <dos/dostags.h>
+#include <workbench/startup.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+
+// Launcher installed under the plain tool name. It loads the build variant
+// of the same name that suits the CPU, e.g. PROGDIR:QuickUpdate.020, and
+// runs it in place with the original arguments or Workbench message.
+// See Tuning.h for the variants.
+
+#ifndef AFF_68060
+#define AFF_68060 (1L<<7)
+#endif
+
+#define LAUNCH_NAME_SIZE 108
+#define LAUNCH_MIN_STACK 16384
+
+extern struct ExecBase *SysBase;
+
+// Best first, a missing variant falls back to the next one
+static const char *variants[] = { ".060", ".020", ".000" };
+#define NUM_VARIANTS 3
+
+static LONG FirstVariant(void)
+{
+    UWORD attn = SysBase->AttnFlags;
+    
+    if (attn & (AFF_68040 | AFF_68060))
+        return 0;
+    if (attn & AFF_68020)
+        return 1;
+    return 2;
+}
+
+static BPTR LoadVariant(const char *name, char *path)
+{
+    BPTR seg = 0;
+    LONG i;
+    
+    for (i = FirstVariant(); i < NUM_VARIANTS && !seg; i++)
+    {
+        strcpy(path, "PROGDIR:");
+        strcat(path, name);
+        strcat(path, variants[i]);
+        seg = LoadSeg(path);
+    }
+    return seg;
+}
+
+static LONG StackSize(void)
+{
+    struct Process *me = (struct Process *)FindTask(NULL);
+    struct CommandLineInterface *cli = Cli();
+    LONG stack = cli ? cli->cli_DefaultStack * 4 : (LONG)me->pr_StackSize;
+    
+    return stack < LAUNCH_MIN_STACK ? LAUNCH_MIN_STACK : stack;
+}
+
+// Shell: RunCommand() keeps our process, so the variant sees the same
+// command name, arguments, streams and PROGDIR:
+static LONG RunShell(BPTR seg)
+{
+    char *args = GetArgStr();
+    LONG rc;
+    
+    rc = RunCommand(seg, StackSize(), args, strlen(args));
+    UnLoadSeg(seg);
+    
+    return rc == -1 ? RETURN_FAIL : rc;
+}
+
+// Workbench: the variant runs as a process of its own and is handed a copy
+// of our message. Its startup code replies the copy to us when it is done;
+// the original goes back to Workbench when we exit after that.
+static LONG RunWorkbench(BPTR seg, const char *name, struct WBStartup *wbmsg)
+{
+    struct WBStartup msg;
+    struct MsgPort *port;
+    struct Process *proc;
+    BPTR home;
+    
+    if (!(port = CreateMsgPort()))
+    {
+        UnLoadSeg(seg);
+        return RETURN_FAIL;
+    }
+    
+    home = DupLock(GetProgramDir());
+    proc = CreateNewProcTags(NP_Seglist, (ULONG)seg,
+                             NP_FreeSeglist, TRUE,
+                             NP_Name, (ULONG)name,
+                             NP_StackSize, StackSize(),
+                             NP_HomeDir, (ULONG)home,
+                             TAG_DONE);
+    if (!proc)
+    {
+        UnLock(home);
+        UnLoadSeg(seg);
+        DeleteMsgPort(port);
+        return RETURN_FAIL;
+    }
+    
+    msg = *wbmsg;
+    msg.sm_Message.mn_ReplyPort = port;
+    msg.sm_Process = &proc->pr_MsgPort;
+    msg.sm_Segment = seg;
+    PutMsg(&proc->pr_MsgPort, &msg.sm_Message);
+    
+    WaitPort(port);
+    GetMsg(port);
+    DeleteMsgPort(port);
+    
+    return RETURN_OK;
+}
+
+int main(int argc, char **argv)
+{
+    struct WBStartup *wbmsg = NULL;
+    char name[LAUNCH_NAME_SIZE];
+    char path[LAUNCH_NAME_SIZE + 16];
+    BPTR seg;
+    
+    if (argc == 0)
+    {
+        wbmsg = (struct WBStartup *)argv;
+        strncpy(name, wbmsg->sm_ArgList[0].wa_Name, sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+    }
+    else if (!GetProgramName(name, sizeof(name)))
+    {
+        return RETURN_FAIL;
+    }
+    
+    // Run as "Work:Tools/QuickUpdate", the variants are next to us
+    memmove(name, FilePart(name), strlen(FilePart(name)) + 1);
+    
+    if (!(seg = LoadVariant(name, path)))
+    {
+        if (!wbmsg)
+        {
+            Printf("%s: No build variant found (PROGDIR:%s.000, .020 or .060)\n",
+                   (LONG)name, (LONG)name);
+        }
+        return RETURN_FAIL;
+    }
+    
+    return wbmsg ? RunWorkbench(seg, name, wbmsg) : RunShell(seg);
+}
@@ -0,0 +1,228 @@
+#include "Lz.h"
+#include "Shared.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+
+#define LZ_HASH(p) ((((p)[0] << 6) ^ ((p)[1] << 3) ^ (p)[2]) & (LZ_HASH_SIZE - 1))
+
+struct LzCoder *CreateLzCoder(void)
+{
+    struct LzCoder *lz;
+    
+    // One allocation for the coder and its buffers
+    if ((lz = AllocVec(sizeof(struct LzCoder) + LZ_BLOCK_SIZE * 2 + LZ_SLACK +
+                       LZ_HASH_SIZE * sizeof(UWORD), MEMF_ANY)))
+    {
+        lz->hash = (UWORD *)(lz + 1);
+        lz->raw = (UBYTE *)(lz->hash + LZ_HASH_SIZE);
+        lz->packed = lz->raw + LZ_BLOCK_SIZE;
+    }
+    return lz;
+}
+
+void DeleteLzCoder(struct LzCoder *lz)
+{
+    if (lz) FreeVec(lz);
+}
+
+// Packs length bytes of lz->raw into lz->packed. Returns the packed size,
+// or zero when that would not be smaller than the block.
+ULONG LzPack(struct LzCoder *lz, ULONG length)
+{
+    const UBYTE *src = lz->raw;
+    const UBYTE *end = src + length;
+    const UBYTE *p = src;
+    const UBYTE *m;
+    const UBYTE *q;
+    UBYTE *dst = lz->packed;
+    UBYTE *out = dst;
+    UBYTE *flags = NULL;
+    UBYTE bit = 0;
+    ULONG len, max, off = 0;
+    UWORD h, cand;
+    
+    // Positions are stored plus one, zero is empty
+    memset(lz->hash, 0, LZ_HASH_SIZE * sizeof(UWORD));
+    
+    while (p < end)
+    {
+        if (bit == 0)
+        {
+            flags = out++;
+            *flags = 0;
+            bit = 0x80;
+        }
+    
+        if (out - dst + 2 >= length)
+            return 0;
+    
+        len = 0;
+        if (end - p >= LZ_MIN_MATCH)
+        {
+            h = LZ_HASH(p);
+            cand = lz->hash[h];
+            lz->hash[h] = p - src + 1;
+    
+            if (cand)
+            {
+                m = src + cand - 1;
+                off = p - m;
+                if (off <= LZ_WINDOW && m[0] == p[0] && m[1] == p[1] && m[2] == p[2])
+                {
+                    max = end - p;
+                    if (max > LZ_MAX_MATCH)
+                        max = LZ_MAX_MATCH;
+                    for (len = LZ_MIN_MATCH; len < max && m[len] == p[len]; len++)
+                        ;
+                }
+            }
+        }
+    
+        if (len)
+        {
+            *flags |= bit;
+            out[0] = (off - 1) >> 4;
+            out[1] = ((off - 1) << 4) | (len - LZ_MIN_MATCH);
+            out += 2;
+    
+            for (q = p + 1, p += len; q < p && end - q >= LZ_MIN_MATCH; q++)
+                lz->hash[LZ_HASH(q)] = q - src + 1;
+        }
+        else
+        {
+            *out++ = *p++;
+        }
+        bit >>= 1;
+    }
+    
+    return out - dst;
+}
+
+// Unpacks lz->packed into length bytes of lz->raw, checking every offset
+// and length so a damaged file fails instead of writing out of bounds
+BOOL LzUnpack(struct LzCoder *lz, ULONG packed, ULONG length)
+{
+    const UBYTE *in = lz->packed;
+    const UBYTE *inEnd = in + packed;
+    const UBYTE *m;
+    UBYTE *dst = lz->raw;
+    UBYTE *out = dst;
+    UBYTE *outEnd = dst + length;
+    UBYTE flags = 0, bit = 0;
+    ULONG len, off;
+    
+    while (out < outEnd)
+    {
+        if (bit == 0)
+        {
+            if (in >= inEnd)
+                return FALSE;
+            flags = *in++;
+            bit = 0x80;
+        }
+    
+        if (flags & bit)
+        {
+            if (inEnd - in < 2)
+                return FALSE;
+            off = ((in[0] << 4) | (in[1] >> 4)) + 1;
+            len = (in[1] & 15) + LZ_MIN_MATCH;
+            in += 2;
+    
+            if (off > out - dst || len > outEnd - out)
+                return FALSE;
+    
+            for (m = out - off; len; len--)
+                *out++ = *m++;
+        }
+        else
+        {
+            if (in >= inEnd)
+                return FALSE;
+            *out++ = *in++;
+        }
+        bit >>= 1;
+    }
+    
+    return in == inEnd;
+}
+
+BOOL LzPackFile(struct LzCoder *lz, BPTR from, BPTR to, ULONG *written)
+{
+    ULONG header[2];
+    ULONG magic = LZ_MAGIC;
+    LONG length;
+    ULONG packed;
+    
+    *written = sizeof(magic);
+    if (Write(to, &magic, sizeof(magic)) != sizeof(magic))
+        return FALSE;
+    
+    while ((length = Read(from, lz->raw, LZ_BLOCK_SIZE)) > 0)
+    {
+        packed = LzPack(lz, length);
+        header[0] = length;
+        header[1] = packed;
+    
+        if (Write(to, header, sizeof(header)) != sizeof(header))
+            return FALSE;
+    
+        if (packed)
+        {
+            if (Write(to, lz->packed, packed) != packed)
+                return FALSE;
+        }
+        else
+        {
+            if (Write(to, lz->raw, length) != length)
+                return FALSE;
+        }
+        *written += sizeof(header) + (packed ? packed : length);
+    }
+    
+    return length == 0;
+}
+
+// Each block is written out as soon as it is unpacked. With no output
+// handle the file is only checked.
+BOOL LzUnpackFile(struct LzCoder *lz, BPTR from, BPTR to, ULONG *checksum, ULONG *size)
+{
+    ULONG header[2];
+    ULONG magic;
+    ULONG crc = 0xFFFFFFFF;
+    LONG got;
+    
+    *size = 0;
+    
+    if (Read(from, &magic, sizeof(magic)) != sizeof(magic) || magic != LZ_MAGIC)
+        return FALSE;
+    
+    while ((got = Read(from, header, sizeof(header))) == sizeof(header))
+    {
+        if (header[0] == 0 || header[0] > LZ_BLOCK_SIZE || header[1] >= header[0])
+            return FALSE;
+    
+        if (header[1])
+        {
+            if (Read(from, lz->packed, header[1]) != header[1] ||
+                !LzUnpack(lz, header[1], header[0]))
+                return FALSE;
+        }
+        else if (Read(from, lz->raw, header[0]) != header[0])
+        {
+            return FALSE;
+        }
+    
+        crc = UpdateCRC32(crc, lz->raw, header[0]);
+        *size += header[0];
+    
+        if (to && Write(to, lz->raw, header[0]) != header[0])
+            return FALSE;
+    }
+    
+    *checksum = crc ^ 0xFFFFFFFF;
+    return got == 0;
+}
@@ -0,0 +1,35 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <exec/types.h>
+#include <dos/dos.h>
+
+#define LZ_MAGIC       0x514C5A31   // "QLZ1"
+#define LZ_BLOCK_SIZE  16384        // Raw bytes per block
+#define LZ_WINDOW      4096         // 12 bit offsets
+#define LZ_MIN_MATCH   3
+#define LZ_MAX_MATCH   18           // 4 bit lengths
+#define LZ_HASH_SIZE   1024         // Entries, two bytes each
+#define LZ_SLACK       16           // Packed buffer beyond LZ_BLOCK_SIZE
+
+// LZSS coder small enough for any 68000: a 4 KB window, one hash probe
+// per byte and a 2 KB hash table. Files are a magic longword followed by
+// independent blocks, each
+//   <raw length> <packed length> <data>
+// with a packed length of zero for a block stored as it was. Flag bytes
+// select, MSB first, a literal byte or a two byte match of 12 bit offset
+// and 4 bit length.
+struct LzCoder {
+    UBYTE *raw;
+    UBYTE *packed;
+    UWORD *hash;
+};
+
+struct LzCoder *CreateLzCoder(void);
+void DeleteLzCoder(struct LzCoder *lz);
+ULONG LzPack(struct LzCoder *lz, ULONG length);
+BOOL LzUnpack(struct LzCoder *lz, ULONG packed, ULONG length);
+BOOL LzPackFile(struct LzCoder *lz, BPTR from, BPTR to, ULONG *written);
+BOOL LzUnpackFile(struct LzCoder *lz, BPTR from, BPTR to, ULONG *checksum, ULONG *size);
+
+#endif /* LZ_H */
@@ -0,0 +1,520 @@
+#include "Manifest.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char manifestHeader[] = "# QuickUpdate scan manifest, written by CreateDB\n";
+
+// Make room for needed elements, keeping the used ones
+static BOOL GrowArray(APTR *array, ULONG *max, ULONG used, ULONG needed, ULONG elemSize)
+{
+    ULONG newMax = *max ? *max : 64;
+    APTR newArray;
+    
+    if (needed <= *max)
+        return TRUE;
+    
+    while (newMax < needed) newMax *= 2;
+    
+    if (!(newArray = AllocVec(newMax * elemSize, MEMF_ANY)))
+        return FALSE;
+    
+    if (*array)
+    {
+        CopyMem(*array, newArray, used * elemSize);
+        FreeVec(*array);
+    }
+    *array = newArray;
+    *max = newMax;
+    return TRUE;
+}
+
+static BOOL AddString(struct Manifest *m, const char *s, ULONG *offset)
+{
+    ULONG len = strlen(s) + 1;
+    
+    if (!GrowArray((APTR *)&m->pool, &m->poolSize, m->poolLen, m->poolLen + len, 1))
+        return FALSE;
+    
+    memcpy(m->pool + m->poolLen, s, len);
+    *offset = m->poolLen;
+    m->poolLen += len;
+    return TRUE;
+}
+
+// Parse count '|' terminated numbers, returns the rest of the line
+static char *ParseNumbers(char *p, ULONG *values, LONG count)
+{
+    char *end;
+    LONG i;
+    
+    for (i = 0; i < count; i++)
+    {
+        values[i] = strtoul(p, &end, 10);
+        if (end == p || *end != '|')
+            return NULL;
+        p = end + 1;
+    }
+    return p;
+}
+
+static int CompareEntryHash(const void *a, const void *b)
+{
+    ULONG ha = ((const struct ManifestEntry *)a)->hash;
+    ULONG hb = ((const struct ManifestEntry *)b)->hash;
+    
+    return (ha < hb) ? -1 : (ha > hb) ? 1 : 0;
+}
+
+static int CompareDirHash(const void *a, const void *b)
+{
+    ULONG ha = ((const struct ManifestDir *)a)->hash;
+    ULONG hb = ((const struct ManifestDir *)b)->hash;
+    
+    return (ha < hb) ? -1 : (ha > hb) ? 1 : 0;
+}
+
+static BOOL AddEntry(struct Manifest *m, const char *name, ULONG size, ULONG *v)
+{
+    struct ManifestEntry *e;
+    
+    if (!GrowArray((APTR *)&m->entries, &m->maxEntries, m->numEntries,
+                   m->numEntries + 1, sizeof(struct ManifestEntry)))
+    {
+        return FALSE;
+    }
+    
+    e = &m->entries[m->numEntries];
+    if (!AddString(m, name, &e->name))
+        return FALSE;
+    
+    e->hash = HashName(name);
+    e->size = size;
+    e->date.ds_Days = v ? v[0] : 0;
+    e->date.ds_Minute = v ? v[1] : 0;
+    e->date.ds_Tick = v ? v[2] : 0;
+    m->numEntries++;
+    return TRUE;
+}
+
+// Close the group of entries read since the previous directory line
+static BOOL AddDir(struct Manifest *m, const char *path, ULONG *v, ULONG first)
+{
+    struct ManifestDir *d;
+    
+    if (!GrowArray((APTR *)&m->dirs, &m->maxDirs, m->numDirs,
+                   m->numDirs + 1, sizeof(struct ManifestDir)))
+    {
+        return FALSE;
+    }
+    
+    d = &m->dirs[m->numDirs];
+    if (!AddString(m, path, &d->path))
+        return FALSE;
+    
+    d->hash = HashName(path);
+    d->date.ds_Days = v[0];
+    d->date.ds_Minute = v[1];
+    d->date.ds_Tick = v[2];
+    d->first = first;
+    d->children = m->numEntries - first;
+    m->numDirs++;
+    
+    qsort(&m->entries[first], d->children, sizeof(struct ManifestEntry), CompareEntryHash);
+    return TRUE;
+}
+
+static BOOL AddFound(struct Manifest *m, const char *line, ULONG lineNum)
+{
+    if (!GrowArray((APTR *)&m->found, &m->maxFound, m->numFound,
+                   m->numFound + 1, sizeof(struct ChecksumEntry)))
+    {
+        return FALSE;
+    }
+    
+    if (!LoadDatabaseEntry(line, lineNum, &m->found[m->numFound]))
+        return FALSE;
+    
+    m->numFound++;
+    return TRUE;
+}
+
+struct Manifest *LoadManifest(char **roots, ULONG generation, BOOL checkpoint)
+{
+    struct Manifest *m;
+    BPTR fh;
+    char line[MAX_MANIFEST_LINE + 1];
+    char *p, *nl;
+    ULONG v[3];
+    ULONG first = 0;
+    ULONG lineNum = 0;
+    LONG numRoots = 0;
+    BOOL body = FALSE;
+    BOOL ended = FALSE;
+    BOOL ok = TRUE;
+    
+    if (!(m = AllocVec(sizeof(struct Manifest), MEMF_CLEAR)))
+        return NULL;
+    
+    if (!(fh = Open(checkpoint ? SCAN_CHECKPOINT : SCAN_MANIFEST, MODE_OLDFILE)))
+    {
+        FreeVec(m);
+        return NULL;
+    }
+    SetVBuf(fh, NULL, BUF_FULL, 4096);
+    
+    while (ok && FGets(fh, line, sizeof(line)))
+    {
+        lineNum++;
+        
+        // A line without newline is overlong or the file was cut short,
+        // which is where an interrupted scan's checkpoint may end
+        if (!(nl = strchr(line, '\n')))
+        {
+            ok = checkpoint;
+            break;
+        }
+        *nl = '\0';
+        
+        if (line[0] == '#')
+            continue;
+        
+        if (ended || line[1] != '|')
+        {
+            ok = FALSE;
+            break;
+        }
+        p = line + 2;
+        
+        if (line[0] == 'R')
+        {
+            // Results for other roots say nothing about these
+            ok = !body && roots[numRoots] && stricmp(p, roots[numRoots]) == 0;
+            numRoots++;
+            continue;
+        }
+        
+        // The root lines must have named exactly our roots
+        if (!body)
+        {
+            ok = numRoots > 0 && !roots[numRoots];
+            body = TRUE;
+        }
+        
+        if (!ok)
+        {
+            break;
+        }
+        else if (line[0] == 'F')
+        {
+            ULONG size;
+            
+            ok = (p = ParseNumbers(p, &size, 1)) && (p = ParseNumbers(p, v, 3)) &&
+                 AddEntry(m, p, size, v);
+        }
+        else if (line[0] == 'S')
+        {
+            ok = AddEntry(m, p, MANIFEST_SUBDIR, NULL);
+        }
+        else if (line[0] == 'D')
+        {
+            ok = (p = ParseNumbers(p, v, 3)) && AddDir(m, p, v, first);
+            first = m->numEntries;
+        }
+        else if (line[0] == 'N')
+        {
+            // Already in the database once the manifest was published
+            ok = !checkpoint || AddFound(m, p, lineNum);
+        }
+        else if (line[0] == 'G')
+        {
+            m->generation = strtoul(p, NULL, 10);
+        }
+        else if (line[0] == 'E')
+        {
+            m->generation = strtoul(p, NULL, 10);
+            ended = TRUE;
+        }
+        else
+        {
+            ok = FALSE;
+        }
+    }
+    Close(fh);
+    
+    if (checkpoint)
+    {
+        m->numEntries = first;
+    }
+    
+    // The database must still contain what this manifest says was seen
+    if (!ok || (!checkpoint && (!ended || first != m->numEntries)) ||
+        m->generation > generation)
+    {
+        FreeManifest(m);
+        return NULL;
+    }
+    
+    qsort(m->dirs, m->numDirs, sizeof(struct ManifestDir), CompareDirHash);
+    return m;
+}
+
+void FreeManifest(struct Manifest *m)
+{
+    if (m)
+    {
+        if (m->dirs) FreeVec(m->dirs);
+        if (m->entries) FreeVec(m->entries);
+        if (m->pool) FreeVec(m->pool);
+        if (m->found) FreeVec(m->found);
+        FreeVec(m);
+    }
+}
+
+struct ManifestDir *FindManifestDir(struct Manifest *m, const char *path)
+{
+    ULONG hash = HashName(path);
+    ULONG lo = 0, hi = m->numDirs, mid;
+    
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (m->dirs[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    
+    for (; lo < m->numDirs && m->dirs[lo].hash == hash; lo++)
+    {
+        if (stricmp(ManifestName(m, m->dirs[lo].path), path) == 0)
+            return &m->dirs[lo];
+    }
+    return NULL;
+}
+
+struct ManifestEntry *FindManifestEntry(struct Manifest *m, struct ManifestDir *dir,
+                                        const char *name)
+{
+    struct ManifestEntry *e = &m->entries[dir->first];
+    ULONG hash = HashName(name);
+    ULONG lo = 0, hi = dir->children, mid;
+    
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (e[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    
+    for (; lo < dir->children && e[lo].hash == hash; lo++)
+    {
+        if (stricmp(ManifestName(m, e[lo].name), name) == 0)
+            return &e[lo];
+    }
+    return NULL;
+}
+
+static BOOL WriteManifestLine(struct ManifestWriter *w, const char *line)
+{
+    if (w->error)
+        return FALSE;
+    
+    if (FPuts(w->fh, line) == -1)
+    {
+        Printf("Error writing scan manifest\n");
+        w->error = TRUE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Writes the checkpoint, replacing one left by an earlier scan
+struct ManifestWriter *CreateManifestWriter(char **roots, ULONG generation)
+{
+    struct ManifestWriter *w;
+    char line[MAX_MANIFEST_LINE + 1];
+    LONG i;
+    
+    for (i = 0; roots[i]; i++)
+    {
+        if (strlen(roots[i]) >= MAX_PATH)
+            return NULL;
+    }
+    
+    if (!(w = AllocVec(sizeof(struct ManifestWriter), MEMF_CLEAR)))
+        return NULL;
+    
+    InitSemaphore(&w->lock);
+    
+    if (!(w->fh = Open(SCAN_CHECKPOINT, MODE_NEWFILE)))
+    {
+        FreeVec(w);
+        return NULL;
+    }
+    SetVBuf(w->fh, NULL, BUF_FULL, 4096);
+    
+    WriteManifestLine(w, manifestHeader);
+    for (i = 0; roots[i]; i++)
+    {
+        sprintf(line, "R|%s\n", roots[i]);
+        WriteManifestLine(w, line);
+    }
+    sprintf(line, "G|%lu\n", generation);
+    WriteManifestLine(w, line);
+    
+    return w;
+}
+
+static BOOL AddGroupLine(struct ManifestGroup *g, const char *line)
+{
+    ULONG len = strlen(line);
+    ULONG size = g->size;
+    
+    if (g->error)
+        return FALSE;
+    
+    if (!GrowArray((APTR *)&g->buffer, &size, g->len, g->len + len + 1, 1))
+    {
+        g->error = TRUE;
+        return FALSE;
+    }
+    g->size = size;
+    
+    memcpy(g->buffer + g->len, line, len + 1);
+    g->len += len;
+    return TRUE;
+}
+
+BOOL AddManifestFile(struct ManifestGroup *g, const char *name, ULONG size,
+                     const struct DateStamp *date)
+{
+    char line[MAX_MANIFEST_LINE + 1];
+    
+    sprintf(line, "F|%lu|%ld|%ld|%ld|%s\n", size,
+            date->ds_Days, date->ds_Minute, date->ds_Tick, name);
+    
+    return AddGroupLine(g, line);
+}
+
+BOOL AddManifestSubdir(struct ManifestGroup *g, const char *name)
+{
+    char line[MAX_MANIFEST_LINE + 1];
+    
+    sprintf(line, "S|%s\n", name);
+    
+    return AddGroupLine(g, line);
+}
+
+void FreeManifestGroup(struct ManifestGroup *g)
+{
+    if (g->buffer) FreeVec(g->buffer);
+    g->buffer = NULL;
+    g->len = g->size = 0;
+    g->error = FALSE;
+}
+
+BOOL WriteManifestDir(struct ManifestWriter *w, struct ManifestGroup *g,
+                      const char *path, const struct DateStamp *date)
+{
+    char line[MAX_MANIFEST_LINE + 1];
+    BOOL success = FALSE;
+    
+    ObtainSemaphore(&w->lock);
+    
+    // The reader could not take the line back, drop the whole manifest
+    if (strlen(path) >= MAX_PATH)
+    {
+        if (!w->error)
+        {
+            Printf("Warning: %s: path too long for the scan manifest\n", (LONG)path);
+        }
+        w->error = TRUE;
+    }
+    else if (g->error)
+    {
+        w->error = TRUE;
+    }
+    else
+    {
+        sprintf(line, "D|%ld|%ld|%ld|%s\n",
+                date->ds_Days, date->ds_Minute, date->ds_Tick, path);
+        
+        success = (g->len == 0 || WriteManifestLine(w, g->buffer)) &&
+                  WriteManifestLine(w, line);
+    }
+    
+    ReleaseSemaphore(&w->lock);
+    
+    // Keep the buffer for the next directory
+    g->len = 0;
+    g->error = FALSE;
+    
+    return success;
+}
+
+// Record a new database entry, so a resumed scan does not lose it
+BOOL WriteManifestFound(struct ManifestWriter *w, const struct ChecksumEntry *entry)
+{
+    char line[MAX_MANIFEST_LINE + 1];
+    BOOL success;
+    
+    sprintf(line, "N|%08lx|%lu|%s|%lu.%lu|%lu|\n",
+            entry->checksum, entry->filesize, entry->filename,
+            (ULONG)entry->version, (ULONG)entry->revision, entry->date);
+    
+    ObtainSemaphore(&w->lock);
+    success = WriteManifestLine(w, line);
+    ReleaseSemaphore(&w->lock);
+    
+    return success;
+}
+
+// Put everything written so far on disk
+BOOL CheckpointManifest(struct ManifestWriter *w)
+{
+    BOOL success = FALSE;
+    
+    ObtainSemaphore(&w->lock);
+    if (!w->error)
+    {
+        success = Flush(w->fh) ? TRUE : FALSE;
+    }
+    ReleaseSemaphore(&w->lock);
+    
+    return success;
+}
+
+// Publishing replaces the previous manifest, otherwise the file stays
+// behind as a checkpoint for RESUME
+BOOL CloseManifestWriter(struct ManifestWriter *w, ULONG generation, BOOL publish)
+{
+    char line[32];
+    BOOL success = FALSE;
+    
+    if (publish)
+    {
+        sprintf(line, "E|%lu\n", generation);
+        WriteManifestLine(w, line);
+    }
+    
+    if (!Close(w->fh))
+    {
+        w->error = TRUE;
+    }
+    
+    if (publish && !w->error)
+    {
+        DeleteFile(SCAN_MANIFEST);
+        success = Rename(SCAN_CHECKPOINT, SCAN_MANIFEST) ? TRUE : FALSE;
+    }
+    
+    FreeVec(w);
+    return success;
+}
@@ -0,0 +1,103 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "Shared.h"
+#include <dos/dos.h>
+#include <exec/semaphores.h>
+
+#define SCAN_MANIFEST   "PROGDIR:QuickUpdate.scan"
+#define SCAN_CHECKPOINT "PROGDIR:QuickUpdate.scan.resume"
+
+#define MAX_MANIFEST_LINE (MAX_PATH + 64)
+#define MANIFEST_SUBDIR   0xFFFFFFFF    // ManifestEntry.size of a subdirectory
+
+// The manifest remembers what the last CreateDB run saw, one group of lines
+// per directory:
+//
+//   F|SIZE|DAYS|MINUTE|TICK|NAME     matching file
+//   S|NAME                           subdirectory
+//   D|DAYS|MINUTE|TICK|PATH          closes the group with the directory's
+//                                    datestamp
+//   N|DATABASE LINE                  entry the scan added, without origin
+//
+// preceded by one "R|ROOT" per scanned root and "G|GENERATION", the database
+// generation the scan started from, and followed by "E|GENERATION", the
+// generation the results went into. A directory whose datestamp has not
+// changed has had no entries added, deleted or renamed, so its group can be
+// reused without reading it.
+//
+// The file is written as SCAN_CHECKPOINT and renamed when the scan is
+// published. Groups are only written once all their files are committed,
+// so an interrupted scan leaves a usable checkpoint: its directories can
+// be reused and its N lines restore the entries found so far.
+struct ManifestEntry {
+    ULONG hash;         // HashName() of the name
+    ULONG name;         // Offset into the string pool
+    ULONG size;
+    struct DateStamp date;
+};
+
+struct ManifestDir {
+    ULONG hash;         // HashName() of the path
+    ULONG path;         // Offset into the string pool
+    struct DateStamp date;
+    ULONG first;        // First entry, sorted by hash within the directory
+    ULONG children;     // F/S lines of the group
+};
+
+struct Manifest {
+    ULONG generation;
+    struct ManifestDir *dirs;   // Sorted by hash
+    ULONG numDirs;
+    ULONG maxDirs;
+    struct ManifestEntry *entries;
+    ULONG numEntries;
+    ULONG maxEntries;
+    char *pool;
+    ULONG poolLen;
+    ULONG poolSize;
+    struct ChecksumEntry *found; // N lines, read from checkpoints only
+    ULONG numFound;
+    ULONG maxFound;
+};
+
+#define ManifestName(m, offset) ((m)->pool + (offset))
+
+// Lines of the directory being read, collected per walker so concurrent
+// walkers never interleave groups in the file
+struct ManifestGroup {
+    char *buffer;
+    ULONG len;
+    ULONG size;
+    BOOL error;
+};
+
+struct ManifestWriter {
+    struct SignalSemaphore lock;    // Guards fh and error
+    BPTR fh;
+    BOOL error;
+};
+
+// Reader: NULL if there is no manifest, it belongs to another root or a
+// newer database generation, or it is damaged. A checkpoint may end
+// anywhere, the unfinished group is dropped.
+struct Manifest *LoadManifest(char **roots, ULONG generation, BOOL checkpoint);
+void FreeManifest(struct Manifest *m);
+struct ManifestDir *FindManifestDir(struct Manifest *m, const char *path);
+struct ManifestEntry *FindManifestEntry(struct Manifest *m, struct ManifestDir *dir,
+                                        const char *name);
+
+// Writer: collect a directory's entries in a group, then write the group
+// and the directory line in one go
+struct ManifestWriter *CreateManifestWriter(char **roots, ULONG generation);
+BOOL AddManifestFile(struct ManifestGroup *g, const char *name, ULONG size,
+                     const struct DateStamp *date);
+BOOL AddManifestSubdir(struct ManifestGroup *g, const char *name);
+void FreeManifestGroup(struct ManifestGroup *g);
+BOOL WriteManifestDir(struct ManifestWriter *w, struct ManifestGroup *g,
+                      const char *path, const struct DateStamp *date);
+BOOL WriteManifestFound(struct ManifestWriter *w, const struct ChecksumEntry *entry);
+BOOL CheckpointManifest(struct ManifestWriter *w);
+BOOL CloseManifestWriter(struct ManifestWriter *w, ULONG generation, BOOL publish);
+
+#endif /* MANIFEST_H */
@@ -0,0 +1,536 @@
+#include "ParWalk.h"
+
+#include <exec/memory.h>
+#include <dos/dosextens.h>
+#include <dos/dostags.h>
+#include <dos/filehandler.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+#include <stdio.h>
+
+struct ParWalk *CreateParWalk(const char *pattern, DirWalkFunc func, LONG perDevice)
+{
+    struct ParWalk *pw;
+    
+    if (!(pw = AllocVec(sizeof(struct ParWalk), MEMF_CLEAR)))
+        return NULL;
+    
+    if (!(pw->pattern = AllocVec(strlen(pattern) + 1, MEMF_ANY)))
+    {
+        FreeVec(pw);
+        return NULL;
+    }
+    strcpy(pw->pattern, pattern);
+    
+    InitSemaphore(&pw->lock);
+    pw->func = func;
+    pw->perDevice = perDevice > 0 ? perDevice : 1;
+    
+    return pw;
+}
+
+void DeleteParWalk(struct ParWalk *pw)
+{
+    struct ParWorker *w;
+    struct WalkItem *item;
+    ULONG i;
+    
+    if (pw)
+    {
+        for (i = 0; i < pw->numWorkers; i++)
+        {
+            w = &pw->workers[i];
+            while ((item = (struct WalkItem *)RemHead((struct List *)&w->queue)))
+            {
+                if (item->parent) UnLock(item->parent);
+                FreeVec(item);
+            }
+            DeleteDirWalk(w->walk);
+        }
+        FreeVec(pw->pattern);
+        FreeVec(pw);
+    }
+}
+
+// Copy a BSTR into a C string
+static void CopyBSTR(BSTR bstr, char *buffer, LONG size)
+{
+    UBYTE *s = BADDR(bstr);
+    LONG len = s[0];
+    
+    if (len > size - 1) len = size - 1;
+    memcpy(buffer, s + 1, len);
+    buffer[len] = '\0';
+}
+
+// Name the physical drive behind a lock. Partitions of one drive share
+// the exec device and unit in their startup message; handlers without
+// one (RAM:, network file systems) are told apart by their DOS name.
+static void DeviceName(BPTR lock, char *name, LONG size)
+{
+    struct FileLock *fl = BADDR(lock);
+    struct DosList *dl;
+    struct FileSysStartupMsg *fssm;
+    char device[48];
+    
+    sprintf(name, "%08lx", (ULONG)fl->fl_Task);
+    
+    dl = LockDosList(LDF_DEVICES | LDF_READ);
+    while ((dl = NextDosEntry(dl, LDF_DEVICES)))
+    {
+        if (dl->dol_Task == fl->fl_Task)
+        {
+            // dol_Startup is not always a pointer, check before following it
+            fssm = BADDR(dl->dol_misc.dol_handler.dol_Startup);
+            if (dl->dol_misc.dol_handler.dol_Startup > 64 && TypeOfMem(fssm) &&
+                fssm->fssm_Device && TypeOfMem(BADDR(fssm->fssm_Device)))
+            {
+                CopyBSTR(fssm->fssm_Device, device, sizeof(device));
+                sprintf(name, "%.48s/%lu", device, fssm->fssm_Unit);
+            }
+            else
+            {
+                CopyBSTR(dl->dol_Name, name, size - 1);
+                strcat(name, ":");
+            }
+            break;
+        }
+    }
+    UnLockDosList(LDF_DEVICES | LDF_READ);
+}
+
+// Queue a directory on a worker, the caller has counted it as pending.
+// dir is the parent's lock, duplicated for the item.
+static BOOL PushItem(struct ParWorker *w, const char *parent, const char *name, BPTR dir)
+{
+    struct WalkItem *item;
+    ULONG len = strlen(parent);
+    BOOL sep = FALSE;
+    
+    if (name)
+    {
+        sep = (len > 0 && parent[len - 1] != ':' && parent[len - 1] != '/');
+        len += sep + strlen(name);
+    }
+    
+    if (!(item = AllocVec(sizeof(struct WalkItem) + len, MEMF_ANY)))
+        return FALSE;
+    
+    strcpy(item->path, parent);
+    if (name)
+    {
+        if (sep) strcat(item->path, "/");
+        strcat(item->path, name);
+    }
+    
+    // Without a lock the item is found by its full path
+    item->parent = dir ? DupLock(dir) : 0;
+    
+    ObtainSemaphore(&w->lock);
+    AddTail((struct List *)&w->queue, (struct Node *)item);
+    ReleaseSemaphore(&w->lock);
+    
+    return TRUE;
+}
+
+static void BreakWalk(struct ParWalk *pw)
+{
+    ObtainSemaphore(&pw->lock);
+    pw->broken = TRUE;
+    pw->abort = TRUE;
+    ReleaseSemaphore(&pw->lock);
+}
+
+// Only the process that started the walk gets CTRL-C; it polls, the other
+// workers follow the abort flag. SetSignal() is cheap enough for every entry.
+static BOOL PollBreak(struct ParWalk *pw)
+{
+    if (FindTask(NULL) == pw->owner &&
+        (SetSignal(0, SIGBREAKF_CTRL_C) & SIGBREAKF_CTRL_C))
+    {
+        BreakWalk(pw);
+    }
+    return pw->abort;
+}
+
+// Count files and bytes per worker, then hand over to the user callback
+static LONG WorkerEvent(struct DirWalk *walk, LONG event, struct ExAllData *ed, APTR userData)
+{
+    struct ParWorker *w = (struct ParWorker *)userData;
+    
+    // Stop inside large directories too, not just between them
+    if ((event == DWE_FILE || event == DWE_ENTER) && PollBreak(w->pw))
+    {
+        return WALK_ABORT;
+    }
+    
+    if (event == DWE_FILE)
+    {
+        w->files++;
+        w->bytes += ed->ed_Size;
+    }
+    else if (event == DWE_ENTER)
+    {
+        w->dirs++;
+    }
+    
+    return w->pw->func(walk, event, ed, w->userData);
+}
+
+static struct ParWorker *NewWorker(struct ParWalk *pw, struct ParDevice *dev)
+{
+    struct ParWorker *w;
+    
+    if (pw->numWorkers == PARWALK_MAX_WORKERS)
+        return NULL;
+    
+    w = &pw->workers[pw->numWorkers];
+    
+    if (!(w->walk = CreateDirWalk(pw->pattern, WorkerEvent, w)))
+        return NULL;
+    
+    w->pw = pw;
+    w->device = dev;
+    InitSemaphore(&w->lock);
+    NewList((struct List *)&w->queue);
+    sprintf(w->name, "Scan worker %lu", pw->numWorkers);
+    pw->numWorkers++;
+    dev->count++;
+    
+    return w;
+}
+
+BOOL AddParWalkRoot(struct ParWalk *pw, const char *root)
+{
+    struct ParDevice *dev = NULL;
+    char name[64];
+    BPTR lock;
+    ULONG i;
+    LONG n;
+    
+    if (!(lock = Lock(root, ACCESS_READ)))
+        return FALSE;
+    
+    DeviceName(lock, name, sizeof(name));
+    UnLock(lock);
+    
+    for (i = 0; i < pw->numDevices; i++)
+    {
+        if (stricmp(pw->devices[i].name, name) == 0)
+        {
+            dev = &pw->devices[i];
+            break;
+        }
+    }
+    
+    if (!dev)
+    {
+        if (pw->numDevices == PARWALK_MAX_DEVICES)
+        {
+            SetIoErr(ERROR_NO_FREE_STORE);
+            return FALSE;
+        }
+        
+        dev = &pw->devices[pw->numDevices++];
+        strcpy(dev->name, name);
+        dev->first = pw->numWorkers;
+        
+        for (n = 0; n < pw->perDevice; n++)
+        {
+            if (!NewWorker(pw, dev) && n == 0)
+            {
+                pw->numDevices--;
+                SetIoErr(ERROR_NO_FREE_STORE);
+                return FALSE;
+            }
+        }
+    }
+    
+    // Roots are spread over the device's workers, stealing evens out the rest
+    if (!PushItem(&pw->workers[dev->first + dev->pending % dev->count], root, NULL, 0))
+    {
+        SetIoErr(ERROR_NO_FREE_STORE);
+        return FALSE;
+    }
+    dev->pending++;
+    
+    return TRUE;
+}
+
+static BPTR LockItem(struct WalkItem *item)
+{
+    BPTR lock, oldDir;
+    
+    if (!item->parent)
+        return Lock(item->path, ACCESS_READ);
+    
+    oldDir = CurrentDir(item->parent);
+    lock = Lock(FilePart(item->path), ACCESS_READ);
+    CurrentDir(oldDir);
+    
+    return lock;
+}
+
+// Wake the idle workers of a device: there is work to steal, or none left.
+// Called with pw->lock held, so a worker cannot exit while signalled.
+static void WakeWorkers(struct ParWalk *pw, struct ParDevice *dev)
+{
+    struct ParWorker *w;
+    ULONG i;
+    
+    for (i = 0; i < dev->count; i++)
+    {
+        w = &pw->workers[dev->first + i];
+        if (w->task && w->task != FindTask(NULL))
+            Signal(w->task, w->wake);
+    }
+}
+
+// Own work first, newest item; otherwise the oldest item of a sibling
+static struct WalkItem *TakeItem(struct ParWorker *w)
+{
+    struct ParDevice *dev = w->device;
+    struct ParWorker *victim;
+    struct WalkItem *item;
+    ULONG i;
+    
+    ObtainSemaphore(&w->lock);
+    item = (struct WalkItem *)RemTail((struct List *)&w->queue);
+    ReleaseSemaphore(&w->lock);
+    
+    for (i = 0; !item && i < dev->count; i++)
+    {
+        victim = &w->pw->workers[dev->first + i];
+        if (victim != w)
+        {
+            ObtainSemaphore(&victim->lock);
+            item = (struct WalkItem *)RemHead((struct List *)&victim->queue);
+            ReleaseSemaphore(&victim->lock);
+            
+            if (item) w->steals++;
+        }
+    }
+    
+    return item;
+}
+
+static void RunWorker(struct ParWorker *w)
+{
+    struct ParWalk *pw = w->pw;
+    struct ParDevice *dev = w->device;
+    struct DirWalk *walk = w->walk;
+    struct WalkItem *item;
+    char *name;
+    LONG children;
+    LONG sig;
+    BOOL queued;
+    ULONG wait;
+    BOOL done, ok;
+    BPTR lock;
+    
+    // Any signal will do if none is free, waking early is harmless
+    sig = AllocSignal(-1);
+    
+    ObtainSemaphore(&pw->lock);
+    w->wake = (sig != -1) ? (1L << sig) : SIGBREAKF_CTRL_F;
+    w->task = FindTask(NULL);
+    ReleaseSemaphore(&pw->lock);
+    
+    wait = w->wake;
+    if (w->task == pw->owner)
+        wait |= SIGBREAKF_CTRL_C;
+    
+    if (pw->func(walk, DWE_START, NULL, w->userData) == WALK_ABORT)
+    {
+        ObtainSemaphore(&pw->lock);
+        pw->abort = TRUE;
+        ReleaseSemaphore(&pw->lock);
+    }
+    
+    for (;;)
+    {
+        if (!(item = TakeItem(w)))
+        {
+            ObtainSemaphore(&pw->lock);
+            done = (dev->pending == 0);
+            ReleaseSemaphore(&pw->lock);
+            
+            if (done)
+                break;
+            
+            // A sibling is still reading a directory that may yield work.
+            // A wake sent since TakeItem() is still pending, none is lost.
+            if (Wait(wait) & SIGBREAKF_CTRL_C)
+                BreakWalk(pw);
+            continue;
+        }
+        
+        queued = FALSE;
+        if (!pw->abort)
+        {
+            if ((lock = LockItem(item)))
+            {
+                ok = VisitDirectory(walk, item->path, lock, pw->recursive);
+            }
+            else
+            {
+                // Gone or unreadable, as for any directory the walk meets
+                walk->namesLen = 0;
+                walk->error = IoErr();
+                ok = TRUE;
+            }
+            
+            // Count the children before the parent is retired, so pending
+            // never drops to zero while work is still to come
+            children = 0;
+            for (name = walk->names; ok && name < walk->names + walk->namesLen;
+                 name += strlen(name) + 1)
+            {
+                children++;
+            }
+            
+            ObtainSemaphore(&pw->lock);
+            dev->pending += children;
+            if (!ok) pw->abort = TRUE;
+            ReleaseSemaphore(&pw->lock);
+            queued = children > 0;
+            
+            for (name = walk->names; children > 0; name += strlen(name) + 1, children--)
+            {
+                if (!PushItem(w, item->path, name, lock))
+                {
+                    ObtainSemaphore(&pw->lock);
+                    dev->pending -= children;
+                    pw->abort = TRUE;
+                    ReleaseSemaphore(&pw->lock);
+                    break;
+                }
+            }
+            
+            if (lock) UnLock(lock);
+        }
+        
+        if (item->parent) UnLock(item->parent);
+        FreeVec(item);
+        
+        // Siblings waiting may steal the children now, or stop
+        ObtainSemaphore(&pw->lock);
+        dev->pending--;
+        if (queued || dev->pending == 0)
+            WakeWorkers(pw, dev);
+        ReleaseSemaphore(&pw->lock);
+    }
+    
+    ObtainSemaphore(&pw->lock);
+    w->task = NULL;
+    ReleaseSemaphore(&pw->lock);
+    if (sig != -1) FreeSignal(sig);
+    
+    pw->func(walk, DWE_END, NULL, w->userData);
+    DateStamp(&w->end);
+}
+
+static __saveds void WorkerEntry(void)
+{
+    struct Process *me = (struct Process *)FindTask(NULL);
+    struct ParWorker *w;
+    
+    WaitPort(&me->pr_MsgPort);
+    w = (struct ParWorker *)GetMsg(&me->pr_MsgPort);
+    
+    RunWorker(w);
+    
+    // Our code lives in the parent's seglist, stay in Forbid() until gone
+    Forbid();
+    ReplyMsg(&w->msg);
+}
+
+static ULONG Ticks(const struct DateStamp *ds)
+{
+    return ((ULONG)ds->ds_Days * 1440 + ds->ds_Minute) * TICKS_PER_SECOND * 60 + ds->ds_Tick;
+}
+
+// Worker 0 runs in the calling process. The others get their own
+// processes; if one cannot be started its queue is run here afterwards.
+BOOL RunParWalk(struct ParWalk *pw, BOOL recursive)
+{
+    struct MsgPort *port;
+    struct Process *proc;
+    struct ParWorker *w;
+    struct ParDevice *dev;
+    ULONG running = 0;
+    ULONG i, ticks;
+    
+    pw->recursive = recursive;
+    pw->abort = FALSE;
+    pw->broken = FALSE;
+    pw->owner = FindTask(NULL);
+    
+    for (i = 0; i < pw->numDevices; i++)
+    {
+        DateStamp(&pw->devices[i].start);
+    }
+    
+    if ((port = CreateMsgPort()))
+    {
+        for (i = 1; i < pw->numWorkers; i++)
+        {
+            w = &pw->workers[i];
+            w->msg.mn_ReplyPort = port;
+            w->msg.mn_Length = sizeof(struct ParWorker);
+            
+            proc = CreateNewProcTags(NP_Entry, (ULONG)WorkerEntry,
+                                     NP_Name, (ULONG)w->name,
+                                     NP_StackSize, PARWALK_STACK,
+                                     NP_Output, (ULONG)Output(),
+                                     NP_CloseOutput, FALSE,
+                                     TAG_DONE);
+            if (proc)
+            {
+                PutMsg(&proc->pr_MsgPort, &w->msg);
+                w->started = TRUE;
+                running++;
+            }
+        }
+    }
+    
+    RunWorker(&pw->workers[0]);
+    
+    for (i = 1; i < pw->numWorkers; i++)
+    {
+        if (!pw->workers[i].started)
+        {
+            RunWorker(&pw->workers[i]);
+        }
+    }
+    
+    while (running > 0)
+    {
+        if (Wait((1L << port->mp_SigBit) | SIGBREAKF_CTRL_C) & SIGBREAKF_CTRL_C)
+        {
+            BreakWalk(pw);
+        }
+        while (GetMsg(port))
+        {
+            running--;
+        }
+    }
+    if (port) DeleteMsgPort(port);
+    
+    // Per device totals
+    for (i = 0; i < pw->numWorkers; i++)
+    {
+        w = &pw->workers[i];
+        dev = w->device;
+        dev->dirs += w->dirs;
+        dev->files += w->files;
+        dev->bytes += w->bytes;
+        dev->steals += w->steals;
+        
+        ticks = Ticks(&w->end) - Ticks(&dev->start);
+        if (ticks > dev->ticks) dev->ticks = ticks;
+    }
+    
+    return !pw->abort;
+}
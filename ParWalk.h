@@ -0,0 +1,84 @@
+#ifndef PARWALK_H
+#define PARWALK_H
+
+#include "DirWalk.h"
+#include <exec/lists.h>
+#include <exec/ports.h>
+#include <exec/semaphores.h>
+
+#define PARWALK_MAX_DEVICES 16
+#define PARWALK_MAX_WORKERS 32
+#define PARWALK_STACK       24576   // Callbacks hash and parse files on this stack
+
+// A directory waiting to be visited. Below the roots it is locked relative
+// to its parent, so the volume is not searched from the root for every one.
+struct WalkItem {
+    struct MinNode node;
+    BPTR parent;        // DupLock() of the parent, 0 for a root
+    char path[1];       // Allocated to length
+};
+
+struct ParDevice;
+struct ParWalk;
+
+// One worker process. Its queue is a deque: the owner adds and takes at
+// the tail (depth first, warm caches), thieves take the oldest item, which
+// is usually the largest subtree, from the head.
+struct ParWorker {
+    struct Message msg;             // Startup message, replied on exit
+    struct ParWalk *pw;
+    struct ParDevice *device;
+    struct DirWalk *walk;           // Path buffer, ExAll buffer and FIB
+    APTR userData;                  // Passed to the callback
+    struct SignalSemaphore lock;    // Guards queue
+    struct Task *task;              // Set while running, under pw->lock
+    ULONG wake;                     // Signal sent when there may be work
+    struct MinList queue;
+    char name[32];
+    BOOL started;                   // Running as its own process
+    struct DateStamp end;
+    ULONG dirs;
+    ULONG files;
+    ULONG bytes;
+    ULONG steals;
+};
+
+// Roots on the same physical drive share a group of workers, which only
+// steal from each other, so a spindle is never driven by two groups
+struct ParDevice {
+    char name[64];                  // "scsi.device/0" or the DOS device name
+    ULONG first;                    // Workers
+    ULONG count;
+    LONG pending;                   // Directories queued or being visited
+    struct DateStamp start;
+    ULONG ticks;                    // Time until the last worker finished
+    ULONG dirs;
+    ULONG files;
+    ULONG bytes;
+    ULONG steals;
+};
+
+struct ParWalk {
+    struct SignalSemaphore lock;    // Guards pending counts, abort, broken and tasks
+    char *pattern;
+    DirWalkFunc func;
+    LONG perDevice;
+    struct ParDevice devices[PARWALK_MAX_DEVICES];
+    ULONG numDevices;
+    struct ParWorker workers[PARWALK_MAX_WORKERS];
+    ULONG numWorkers;
+    struct Task *owner;             // Receives CTRL-C for the walk
+    BOOL recursive;
+    BOOL abort;
+    BOOL broken;                    // Aborted by CTRL-C
+};
+
+// The callback runs concurrently in several processes; walk->userData is
+// the worker, the callback's userData is that worker's userData field.
+// CTRL-C sent to the calling process stops every worker at its next entry.
+struct ParWalk *CreateParWalk(const char *pattern, DirWalkFunc func, LONG perDevice);
+void DeleteParWalk(struct ParWalk *pw);
+BOOL AddParWalkRoot(struct ParWalk *pw, const char *root);
+BOOL RunParWalk(struct ParWalk *pw, BOOL recursive);
+
+#endif /* PARWALK_H */
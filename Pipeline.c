@@ -0,0 +1,144 @@
+#include "Pipeline.h"
+
+#include <exec/memory.h>
+#include <dos/dosextens.h>
+#include <dos/dostags.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+
+static __saveds void StageEntry(void)
+{
+    struct Process *me = (struct Process *)FindTask(NULL);
+    struct PipeStage *stage;
+    struct PipeJob *jobs[PIPE_MAX_BATCH];
+    struct PipeJob *job, *quit = NULL;
+    struct MsgPort *port;
+    ULONG count, i;
+    
+    WaitPort(&me->pr_MsgPort);
+    stage = (struct PipeStage *)GetMsg(&me->pr_MsgPort);
+    
+    // Not pr_MsgPort, DOS uses that for the packets of our own I/O
+    port = CreateMsgPort();
+    stage->port = port;
+    
+    if (!port)
+    {
+        Forbid();
+        ReplyMsg(&stage->msg);
+        return;
+    }
+    ReplyMsg(&stage->msg);
+    
+    while (!quit)
+    {
+        WaitPort(port);
+        
+        // Everything that has arrived forms one batch
+        count = 0;
+        while (count < PIPE_MAX_BATCH && (job = (struct PipeJob *)GetMsg(port)))
+        {
+            if (job->quit)
+            {
+                quit = job;
+                break;
+            }
+            jobs[count++] = job;
+        }
+        
+        if (stage->batch && count > 1)
+        {
+            stage->batch(stage, jobs, count);
+        }
+        
+        for (i = 0; i < count; i++)
+        {
+            stage->func(stage, jobs[i]);
+            stage->jobs++;
+            
+            if (stage->next)
+                PutMsg(stage->next->port, &jobs[i]->msg);
+            else
+                ReplyMsg(&jobs[i]->msg);
+        }
+    }
+    
+    // Our code lives in the parent's seglist, stay in Forbid() until gone
+    DeleteMsgPort(port);
+    Forbid();
+    ReplyMsg(&quit->msg);
+}
+
+struct PipeStage *StartPipeStage(const char *name, PipeStageFunc func, APTR userData,
+                                 struct PipeStage *next)
+{
+    struct PipeStage *stage;
+    struct MsgPort *reply;
+    struct Process *proc;
+    
+    if (!(stage = AllocVec(sizeof(struct PipeStage), MEMF_CLEAR)))
+        return NULL;
+    
+    if (!(reply = CreateMsgPort()))
+    {
+        FreeVec(stage);
+        return NULL;
+    }
+    
+    strncpy(stage->name, name, sizeof(stage->name) - 1);
+    stage->func = func;
+    stage->userData = userData;
+    stage->next = next;
+    stage->msg.mn_ReplyPort = reply;
+    stage->msg.mn_Length = sizeof(struct PipeStage);
+    
+    proc = CreateNewProcTags(NP_Entry, (ULONG)StageEntry,
+                             NP_Name, (ULONG)stage->name,
+                             NP_StackSize, PIPE_STACK,
+                             NP_Output, (ULONG)Output(),
+                             NP_CloseOutput, FALSE,
+                             TAG_DONE);
+    if (proc)
+    {
+        // Wait until the stage has its port
+        PutMsg(&proc->pr_MsgPort, &stage->msg);
+        WaitPort(reply);
+        GetMsg(reply);
+    }
+    
+    if (!proc || !stage->port)
+    {
+        DeleteMsgPort(reply);
+        FreeVec(stage);
+        return NULL;
+    }
+    
+    // Everything stopping needs is allocated now
+    stage->reply = reply;
+    stage->quit.msg.mn_ReplyPort = reply;
+    stage->quit.msg.mn_Length = sizeof(struct PipeJob);
+    stage->quit.quit = TRUE;
+    
+    return stage;
+}
+
+// Call only when no jobs are left in the pipeline
+void StopPipeStage(struct PipeStage *stage)
+{
+    if (!stage)
+        return;
+    
+    PutMsg(stage->port, &stage->quit.msg);
+    WaitPort(stage->reply);
+    GetMsg(stage->reply);
+    
+    DeleteMsgPort(stage->reply);
+    FreeVec(stage);
+}
+
+void SendPipeJob(struct PipeStage *stage, struct PipeJob *job)
+{
+    job->quit = FALSE;
+    PutMsg(stage->port, &job->msg);
+}
@@ -0,0 +1,43 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <exec/types.h>
+#include <exec/ports.h>
+
+#define PIPE_STACK     16384
+#define PIPE_MAX_BATCH 32       // Jobs a batch function sees at once
+
+// Every job starts with this. The producer sets mn_ReplyPort; the job
+// travels from stage to stage and the last stage replies it, so a producer
+// with a fixed number of jobs can never run more than that far ahead.
+struct PipeJob {
+    struct Message msg;
+    BOOL quit;          // Internal: ends the stage process
+};
+
+struct PipeStage;
+
+typedef void (*PipeStageFunc)(struct PipeStage *stage, struct PipeJob *job);
+typedef void (*PipeBatchFunc)(struct PipeStage *stage, struct PipeJob **jobs, ULONG count);
+
+// One stage runs in its own process and handles jobs in arrival order,
+// unless its batch function reorders the jobs that were waiting together
+struct PipeStage {
+    struct Message msg;         // Startup handshake
+    struct MsgPort *port;       // Jobs arrive here
+    struct MsgPort *reply;      // Of the starting process, for startup and quit
+    struct PipeJob quit;        // Sent by StopPipeStage(), which cannot fail
+    PipeStageFunc func;
+    PipeBatchFunc batch;        // Optional, set before the first job is sent
+    APTR userData;
+    struct PipeStage *next;     // NULL: reply the job when done
+    ULONG jobs;                 // Jobs handled
+    char name[32];
+};
+
+struct PipeStage *StartPipeStage(const char *name, PipeStageFunc func, APTR userData,
+                                 struct PipeStage *next);
+void StopPipeStage(struct PipeStage *stage);     // From the process that started it
+void SendPipeJob(struct PipeStage *stage, struct PipeJob *job);
+
+#endif /* PIPELINE_H */
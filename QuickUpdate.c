@@ -14,6 +14,16 @@
 #include <stdio.h>
 #include "Shared.h"
 #include "QuickUpdate.h"
+#include "Database.h"
+#include "Scan.h"
+#include "Shadow.h"
+#include "Classify.h"
+#include "CopyEngine.h"
+#include "Batch.h"
+#include "Backup.h"
+#include "Delta.h"
+#include "Sync.h"
+#include "DirIter.h"
 
 // Global variable definitions
 struct DosLibrary *DOSBase = NULL;
@@ -31,14 +41,31 @@ struct VersionInfo {
 struct DiskObject *AppIcon = NULL;
 struct MsgPort *AppPort = NULL;
 
+// Checksum database, opened once at startup
+struct Database *ChecksumDB = NULL;
+
+// Copy engine, created when first needed and reused for every file
+static struct CopyEngine *CopyEng = NULL;
+
 // Function prototypes
+static BOOL NeedCopyEngine(void);
 BOOL OpenLibraries(void);
 void CloseLibraries(void);
 BOOL HandleWorkbench(void);
 BOOL HandleCLI(int argc, char **argv);
+BOOL HandleScan(void);
+BOOL HandleShadows(void);
+BOOL HandlePack(void);
+BOOL HandleRollback(void);
+BOOL HandlePatch(void);
+BOOL HandleMakePatch(void);
+BOOL HandleSign(void);
+BOOL HandleSync(void);
+static BOOL PruneStore(void);
 BOOL CheckFileVersion(const char *filename, struct VersionInfo *info);
 BOOL InstallFile(const char *source, const char *dest);
 BOOL VerifyChecksum(const char *filename);
+static BOOL KnownChecksum(const char *filename, ULONG actual_checksum);
 BOOL HandleGUI(void);
 void ShowFileRequester(void);
 void ShowAboutRequester(void);
@@ -50,8 +77,6 @@ BOOL GetInstalledVersion(const char *filename, struct VersionInfo *info);
 BOOL ParseVersionString(const char *verStr, struct VersionInfo *info);
 LONG CompareVersions(const struct VersionInfo *current, const struct VersionInfo *new);
 BOOL GetUserResponse(void);
-BOOL Copy(const char *source, const char *dest);
-BOOL BackupFile(const char *filepath);
 void SetStatusText(const char *text);
 
 // Menu IDs
@@ -61,28 +86,43 @@ void SetStatusText(const char *text);
 #define ID_CHECK 4
 
 struct RDArgs *rdargs = NULL;
-static const char template[] = "FILE/A,NONINTERACTIVE/S,QUIET/S,FORCE/S";
+static const char template[] = "FILE,NONINTERACTIVE/S,QUIET/S,FORCE/S,SCAN/S,WORKERS/K/N,SHADOWS/S,ALL/S,COPYBUF/K/N,VERIFY/S,PACK/K,COMPRESS/S,ROLLBACK/S,VERSION/K/N,PRUNE/S,KEEP/K/N,MAXAGE/K/N,BUDGET/K/N,PATCH/K,MAKEPATCH/K,FROM/K,SIGN/K,SYNC/K,INTO/K,ROOTS/M";
 static const char version[] = "$VER: QuickUpdate 1.0 (2024-03-20)";
 
 struct {
-    char *file;          // Required argument (/A)
+    char *file;          // File to check, unless SCAN is given
     LONG noninteractive; // Switch (/S)
     LONG quiet;          // Switch (/S)
     LONG force;          // Switch (/S)
-} args = { NULL, FALSE, FALSE, FALSE };
+    LONG scan;           // Check every installed component
+    LONG *workers;       // Scan processes per physical drive
+    LONG shadows;        // Find components installed more than once
+    LONG all;            // Search the roots recursively
+    LONG *copybuf;       // KB per copy buffer
+    LONG verify;         // Read installed files back
+    char *pack;          // Directory of components to install as one batch
+    LONG compress;       // Compress the backups once installed
+    LONG rollback;       // Restore FILE from the backups
+    LONG *version;       // Backup to restore, 0 for the most recent
+    LONG prune;          // Apply the retention limits only
+    LONG *keep;          // Backups kept per file
+    LONG *maxage;        // Days a backup is kept
+    LONG *budget;        // KB the backups may take, unpacked
+    char *patch;         // Delta to apply to the installed file
+    char *makepatch;     // Delta to write from FROM to FILE
+    char *from;          // Release the delta applies to
+    char *sign;          // Directory to write signatures for
+    char *sync;          // Master directory to bring the installed files up to
+    char *into;          // Local directory SYNC updates instead of the system
+    char **roots;        // Searched after the system locations
+} args = { NULL, FALSE, FALSE, FALSE, FALSE, NULL, FALSE, FALSE, NULL, FALSE, NULL, FALSE, FALSE, NULL, FALSE, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
 
 #define CHECKSUM_DB "PROGDIR:QuickUpdate.db"
 #define BACKUP_DIR "SYS:Backups/QuickUpdate/"
-#define BUFFER_SIZE 8192
-
-struct ChecksumEntry {
-    ULONG checksum;
-    char filename[108];  // Matches standard Amiga filename length
-    UWORD version;
-    UWORD revision;
-    ULONG date;
-    char origin[64];
-};
+#define BACKUP_PACK_PRI -1     // Compression runs behind everything else
+#define ROLLBACK_TEMP "T:QuickUpdate.restore"   // See TempName()
+#define PATCH_TEMP "T:QuickUpdate.patched"
+#define SYNC_TEMP "T:QuickUpdate.sync"
 
 // Window-related globals
 static struct Window *MainWindow = NULL;
@@ -111,315 +151,1065 @@ const struct SystemLocation stdLocations[] = {
     { "SYS:Classes/MUI", ".mcp", "MUI custom public classes" }
 };
 
-BOOL CalculateChecksum(const char *filename)
+BOOL VerifyChecksum(const char *filename)
 {
-    BPTR fh;
-    ULONG crc = 0xFFFFFFFF;
-    UBYTE buffer[BUFFER_SIZE];
-    LONG bytes_read;
-    LONG i;
+    if (!ChecksumDB)
+        return FALSE;
     
-    // Initialize CRC32 table if not already done
-    static BOOL table_initialized = FALSE;
-    if (!table_initialized) {
-        InitCRC32Table();
-        table_initialized = TRUE;
-    }
+    return KnownChecksum(filename, CalculateChecksum(filename));
+}
+
+// Is this a release of the file the database knows?
+static BOOL KnownChecksum(const char *filename, ULONG actual_checksum)
+{
+    struct DBCursor cursor;
+    struct ChecksumEntry entry;
+    BOOL found;
     
-    if ((fh = Open(filename, MODE_OLDFILE)))
+    if (!ChecksumDB)
+        return FALSE;
+    
+    for (found = FindFirstEntry(ChecksumDB, filename, &cursor, &entry);
+         found;
+         found = FindNextEntry(ChecksumDB, &cursor, &entry))
     {
-        while ((bytes_read = Read(fh, buffer, BUFFER_SIZE)) > 0)
+        if (actual_checksum == entry.checksum)
         {
-            for (i = 0; i < bytes_read; i++)
-            {
-                crc = (crc >> 8) ^ crc32_table[(crc & 0xFF) ^ buffer[i]];
-            }
+            // Match found
+            break;
         }
-        Close(fh);
-        crc ^= 0xFFFFFFFF;
+    }
+    
+    return found;
+}
+
+// T: is shared by every QuickUpdate running, the task address keeps their
+// files apart. n tells the files of one run apart.
+static void TempName(const char *base, ULONG n, char *buffer)
+{
+    sprintf(buffer, "%s.%08lx.%lu", base, (ULONG)FindTask(NULL), n);
+}
+
+// A one-file batch: the new file is copied next to the destination and
+// swapped in with renames, so a failed copy leaves the installed file as
+// it was. The replaced file is renamed into the backup store when that is
+// on the same volume. A non-zero expect is the checksum the copy must have.
+static BOOL ReplaceFile(const char *source, const char *dest, ULONG expect, ULONG *checksum)
+{
+    struct Batch *batch;
+    BOOL success = FALSE;
+    
+    if (!NeedCopyEngine() || !(batch = CreateBatch(CopyEng, args.verify)))
+    {
+        PrintFault(ERROR_NO_FREE_STORE, "QuickUpdate");
+        return FALSE;
+    }
+    
+    if (AddBatchFile(batch, source, dest))
+    {
+        batch->entries[0].expect = expect;
+        success = RunBatch(batch, BACKUP_DIR);
+    }
+    
+    if (success)
+    {
+        if (checksum)
+            *checksum = batch->entries[0].checksum;
+    }
+    
+    DeleteBatch(batch);
+    return success;
+}
+
+BOOL InstallFile(const char *source, const char *dest)
+{
+    ULONG checksum;
+    BPTR lock;
+    
+    // GetDestPath() knows no location for the file's name
+    if (!dest)
+    {
+        Printf("Error: %s is not a known component type\n", (LONG)source);
+        return FALSE;
+    }
+    
+    // First verify the source file exists and is readable
+    if (!(lock = Lock(source, ACCESS_READ)))
+    {
+        Printf("Error: Cannot access source file\n");
+        return FALSE;
+    }
+    UnLock(lock);
+    
+    if (!NeedCopyEngine())
+    {
+        PrintFault(ERROR_NO_FREE_STORE, "QuickUpdate");
+        return FALSE;
+    }
+    
+    // Nothing to back up or copy when only the dates differ
+    if (SameContent(CopyEng, source, dest))
+    {
+        Printf("%s is already installed\n", (LONG)dest);
         return TRUE;
     }
-    return FALSE;
+    
+    // The engine hashes the source on the way
+    if (!ReplaceFile(source, dest, 0, &checksum))
+    {
+        Printf("Error: Failed to install file\n");
+        return FALSE;
+    }
+    
+    if (ChecksumDB && !KnownChecksum(source, checksum))
+    {
+        Printf("Warning: %s matches no release in the database\n", (LONG)FilePart(source));
+    }
+    
+    // Set proper protection bits
+    SetProtection(dest, FIBF_READ|FIBF_EXECUTE|FIBF_WRITE);
+    return TRUE;
 }
 
-BOOL VerifyChecksum(const char *filename)
+static BOOL NeedCopyEngine(void)
 {
-    BPTR fh;
-    BOOL found = FALSE;
-    struct ChecksumEntry entry;
-    ULONG actual_checksum;
+    if (!CopyEng)
+    {
+        if (!(CopyEng = CreateCopyEngine(args.copybuf ? *args.copybuf * 1024 : 0, 0)))
+        {
+            SetIoErr(ERROR_NO_FREE_STORE);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// A batch install cut short by a crash or reset is finished or undone
+// before anything else is looked at. One another QuickUpdate is still
+// running is left to it.
+static void RecoverInstall(BOOL verbose)
+{
+    struct Batch *batch;
+    LONG result;
+    
+    if (!BatchPending() || !NeedCopyEngine() || !(batch = CreateBatch(CopyEng, FALSE)))
+        return;
+    
+    result = RecoverBatch(batch, BACKUP_DIR);
+    DeleteBatch(batch);
+    
+    if (verbose)
+    {
+        if (result == BATCH_FORWARD)
+            Printf("Finished the interrupted batch install\n");
+        else if (result == BATCH_BACK)
+            Printf("Undid the interrupted batch install\n");
+        else if (result == BATCH_FAILED)
+            Printf("Error: Cannot recover the batch install, see %s\n", (LONG)BATCH_JOURNAL);
+    }
+}
+
+// After the installs, so the backups they took are included. The pass
+// is below normal priority and stops at Ctrl-C; blobs left raw are packed
+// next time.
+static void CompressBackupStore(BOOL report)
+{
+    struct Task *me = FindTask(NULL);
+    ULONG files;
+    LONG saved, pri;
     
-    actual_checksum = CalculateChecksum(filename);
+    pri = SetTaskPri(me, BACKUP_PACK_PRI);
+    if (!CompressBackups(BACKUP_DIR, &files, &saved))
+        Printf("Warning: Some backups were not compressed\n");
+    SetTaskPri(me, pri);
+    
+    if (report && files)
+        Printf("Compressed %lu backups, %ld KB saved\n", files, saved / 1024);
+}
+
+int main(int argc, char **argv)
+{
+    BOOL success = FALSE;
     
-    if ((fh = Open(CHECKSUM_DB, MODE_OLDFILE)))
+    if (OpenLibraries())
     {
-        while (Read(fh, &entry, sizeof(entry)) == sizeof(entry))
+        struct WBStartup *wbmsg = NULL;
+        
+        // Only the index is read here, records are faulted in per lookup
+        ChecksumDB = OpenDatabase();
+        RecoverInstall(argc != 0);
+        
+        // Check if we're started from Workbench
+        if (argc == 0)
+        {
+            wbmsg = (struct WBStartup *)argv;
+            success = HandleWorkbench();
+        }
+        else
         {
-            if (stricmp(FilePart(filename), entry.filename) == 0)
+            success = HandleCLI(argc, argv);
+        }
+        
+        CloseDatabase(ChecksumDB);
+        
+        if (argc != 0 && args.compress)
+            CompressBackupStore(!args.quiet);
+        
+        if (CopyEng)
+        {
+            if (argc != 0 && !args.quiet)
+                PrintCopyStats(CopyEng);
+            DeleteCopyEngine(CopyEng);
+            CloseStatsTimer();
+        }
+        CloseLibraries();
+    }
+    
+    return success ? RETURN_OK : RETURN_FAIL;
+}
+
+BOOL OpenLibraries(void)
+{
+    if (!(IntuitionBase = (struct Library *)OpenLibrary("intuition.library", 37)))
+        return FALSE;
+    
+    if (!(AslBase = (struct Library *)OpenLibrary("asl.library", 37)))
+    {
+        CloseLibrary((struct Library *)IntuitionBase);
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+void CloseLibraries(void)
+{
+    if (AslBase) CloseLibrary((struct Library *)AslBase);
+    if (IntuitionBase) CloseLibrary((struct Library *)IntuitionBase);
+}
+
+BOOL HandleCLI(int argc, char **argv)
+{
+    BOOL success = FALSE;
+    
+    // Parse command line arguments
+    rdargs = ReadArgs(template, (LONG *)&args, NULL);
+    if (!rdargs)
+    {
+        PrintFault(IoErr(), "QuickUpdate");
+        return FALSE;
+    }
+    
+    if (args.scan)
+    {
+        success = HandleScan();
+    }
+    else if (args.shadows)
+    {
+        success = HandleShadows();
+    }
+    else if (args.pack)
+    {
+        success = HandlePack();
+    }
+    else if (args.prune)
+    {
+        success = PruneStore();
+    }
+    else if (args.patch)
+    {
+        success = HandlePatch();
+    }
+    else if (args.makepatch)
+    {
+        success = HandleMakePatch();
+    }
+    else if (args.sign)
+    {
+        success = HandleSign();
+    }
+    else if (args.sync)
+    {
+        success = HandleSync();
+    }
+    else if (!args.file)
+    {
+        Printf("Error: FILE, PACK, PATCH, SYNC, SIGN, SCAN, SHADOWS or PRUNE is required\n");
+        Printf("Usage: QuickUpdate FILE=<file> [NONINTERACTIVE/S] [QUIET/S] [FORCE/S] [COPYBUF=<KB>] [VERIFY/S] [COMPRESS/S] | SCAN/S [QUIET/S] [WORKERS=<n>] |\n"
+               "       PACK=<dir> [NONINTERACTIVE/S] [FORCE/S] [VERIFY/S] [COMPRESS/S] |\n"
+               "       SHADOWS/S [ALL/S] [QUIET/S] [WORKERS=<n>] [ROOTS=<path>...] |\n"
+               "       ROLLBACK/S FILE=<file> [VERSION=<n>] [NONINTERACTIVE/S] |\n"
+               "       PATCH=<delta> [NONINTERACTIVE/S] [VERIFY/S] |\n"
+               "       MAKEPATCH=<delta> FROM=<old file> FILE=<new file> |\n"
+               "       SYNC=<dir> [INTO=<dir>] [NONINTERACTIVE/S] [QUIET/S] [VERIFY/S] | SIGN=<dir> |\n"
+               "       PRUNE/S [KEEP=<n>] [MAXAGE=<days>] [BUDGET=<KB>]\n");
+    }
+    else if (args.rollback)
+    {
+        success = HandleRollback();
+    }
+    else
+    {
+        struct VersionInfo currentInfo, newInfo;
+        BOOL hasCurrentVersion;
+        
+        Printf("Checking file: %s\n", (LONG)args.file);
+        
+        // Get version info of the new file
+        if (!CheckFileVersion(args.file, &newInfo))
+        {
+            Printf("Error: Unable to read version information from file\n");
+            FreeArgs(rdargs);
+            return FALSE;
+        }
+        
+        // Try to find current version in system
+        if (!GetInstalledVersion(args.file, &currentInfo))
+        {
+            Printf("Error accessing version database\n");
+            FreeArgs(rdargs);
+            return FALSE;
+        }
+        
+        hasCurrentVersion = TRUE;
+        
+        if (hasCurrentVersion)
+        {
+            Printf("Current version: %ld.%ld (Date: %ld)\n", 
+                currentInfo.version, currentInfo.revision, currentInfo.date);
+            Printf("New version: %ld.%ld (Date: %ld)\n",
+                newInfo.version, newInfo.revision, newInfo.date);
+            
+            if (newInfo.version > currentInfo.version ||
+                (newInfo.version == currentInfo.version && 
+                 newInfo.revision > currentInfo.revision))
             {
-                if (actual_checksum == entry.checksum)
+                if (!args.noninteractive)
                 {
-                    // Match found, update version info
-                    found = TRUE;
-                    break;
+                    Printf("Would you like to install the newer version? (y/n): ");
+                    if (GetUserResponse())
+                    {
+                        success = InstallFile(args.file, GetDestPath(args.file));
+                        if (success)
+                            Printf("Update completed successfully.\n");
+                        else
+                            Printf("Update failed!\n");
+                    }
                 }
+                else
+                {
+                    Printf("Newer version available.\n");
+                    success = TRUE;
+                }
+            }
+            else
+            {
+                Printf("No newer version available.\n");
+                success = TRUE;
+            }
+        }
+        else
+        {
+            Printf("No existing version found. New installation.\n");
+            if (!args.noninteractive)
+            {
+                Printf("Would you like to install this file? (y/n): ");
+                if (GetUserResponse())
+                {
+                    success = InstallFile(args.file, GetDestPath(args.file));
+                    if (success)
+                        Printf("Installation completed successfully.\n");
+                    else
+                        Printf("Installation failed!\n");
+                }
+            }
+            else
+            {
+                Printf("Installation possible.\n");
+                success = TRUE;
             }
         }
-        Close(fh);
     }
     
-    return found;
+    // Retention limits also apply after any other command
+    if (success && !args.prune && (args.keep || args.maxage || args.budget))
+        success = PruneStore();
+    
+    FreeArgs(rdargs);
+    return success;
 }
 
-BOOL BackupFile(const char *filepath)
+// SCAN mode: every installed component is hashed once and looked up in the
+// database opened at startup
+static ULONG classCounts[NUM_CLASSES];
+static const char *classNames[NUM_CLASSES] = { "Current", "Outdated", "Modified", "Unknown" };
+
+static LONG ClassifyComponent(const struct ScanResult *r, struct VersionInfo *installed,
+                              struct VersionInfo *newest)
 {
-    char backup_path[256];
-    char datestamp[32];
-    struct DateTime dt;
+    struct DBCursor cursor;
+    struct ChecksumEntry entry;
+    struct VersionInfo v;
+    BOOL named = FALSE;
+    BOOL known = FALSE;
+    BOOL more;
+    
+    for (more = FindFirstEntry(ChecksumDB, r->name, &cursor, &entry);
+         more;
+         more = FindNextEntry(ChecksumDB, &cursor, &entry))
+    {
+        v.version = entry.version;
+        v.revision = entry.revision;
+        v.date = entry.date;
+        strcpy(v.origin, entry.origin);
+        
+        if (!named || CompareVersions(newest, &v) > 0)
+        {
+            *newest = v;
+        }
+        named = TRUE;
+        
+        if (!known && entry.checksum == r->checksum && entry.filesize == r->size)
+        {
+            *installed = v;
+            known = TRUE;
+        }
+    }
     
-    // Get current date/time
-    DateStamp(&dt.dat_Stamp);
-    dt.dat_Format = FORMAT_DOS;
-    dt.dat_Flags = 0;
-    dt.dat_StrDay = NULL;
-    dt.dat_StrDate = datestamp;
-    dt.dat_StrTime = NULL;
-    
-    // Format backup path
-    strcpy(backup_path, BACKUP_DIR);
-    AddPart(backup_path, FilePart(filepath), sizeof(backup_path));
-    strcat(backup_path, ".");
-    strcat(backup_path, datestamp);
-    
-    return Copy(filepath, backup_path, NULL) ? TRUE : FALSE;
+    if (!named)
+        return CLASS_UNKNOWN;
+    if (!known)
+        return CLASS_MODIFIED;
+    return CompareVersions(installed, newest) > 0 ? CLASS_OUTDATED : CLASS_CURRENT;
 }
 
-BOOL InstallFile(const char *source, const char *dest)
+// Scan committer, one component at a time
+static BOOL ReportComponent(struct Scan *scan, struct ScanResult *r)
+{
+    struct VersionInfo installed, newest;
+    LONG kind;
+    
+    kind = ClassifyComponent(r, &installed, &newest);
+    classCounts[kind]++;
+    
+    if (kind == CLASS_OUTDATED)
+    {
+        Printf("%-9s %-10s %s v%ld.%ld, database has v%ld.%ld (%s)\n", (LONG)classNames[kind],
+               (LONG)FileTypeName(r->type), (LONG)r->path, (LONG)installed.version, (LONG)installed.revision,
+               (LONG)newest.version, (LONG)newest.revision, (LONG)newest.origin);
+    }
+    else if (kind == CLASS_MODIFIED || !args.quiet)
+    {
+        Printf("%-9s %-10s %s v%ld.%ld\n", (LONG)classNames[kind],
+               (LONG)FileTypeName(r->type), (LONG)r->path, (LONG)r->info.version, (LONG)r->info.revision);
+    }
+    
+    return TRUE;
+}
+
+BOOL HandleScan(void)
 {
+    struct Scan scan;
+    char *roots[NUM_STD_LOCATIONS + 1];
+    LONG numRoots = 0;
+    LONG i, j;
     BPTR lock;
+    BOOL complete;
+    
+    if (!ChecksumDB)
+    {
+        Printf("Error: No checksum database\n");
+        return FALSE;
+    }
+    
+    // Each directory once; locations that do not exist here are skipped
+    for (i = 0; i < NUM_STD_LOCATIONS; i++)
+    {
+        for (j = 0; j < numRoots; j++)
+        {
+            if (stricmp(roots[j], stdLocations[i].path) == 0)
+                break;
+        }
+        
+        if (j == numRoots && (lock = Lock(stdLocations[i].path, ACCESS_READ)))
+        {
+            UnLock(lock);
+            roots[numRoots++] = (char *)stdLocations[i].path;
+        }
+    }
+    roots[numRoots] = NULL;
+    
+    if (numRoots == 0)
+    {
+        Printf("Error: No system locations found\n");
+        return FALSE;
+    }
+    
+    memset(classCounts, 0, sizeof(classCounts));
+    InitScan(&scan, ReportComponent, NULL);
+    scan.quiet = args.quiet;
+    if (args.workers) scan.perDevice = *args.workers;
+    
+    complete = RunScan(&scan, roots, FALSE);
+    
+    if (scan.broken)
+    {
+        Printf("\n*** Break received - aborting ***\n");
+    }
+    
+    Printf("\n%ld current, %ld outdated, %ld modified, %ld unknown components\n",
+           classCounts[CLASS_CURRENT], classCounts[CLASS_OUTDATED],
+           classCounts[CLASS_MODIFIED], classCounts[CLASS_UNKNOWN]);
+    
+    return complete;
+}
+
+// SHADOWS mode: every copy of every component is hashed once and indexed
+// by name, then the copies of each name are listed in search order
+static struct ShadowIndex shadowIndex;
+
+static BOOL CollectComponent(struct Scan *scan, struct ScanResult *r)
+{
+    if (!AddComponent(&shadowIndex, r))
+    {
+        Printf("Error: Out of memory\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL HandleShadows(void)
+{
+    struct Scan scan;
+    BOOL complete = FALSE;
+    LONG i;
+    
+    InitShadowIndex(&shadowIndex);
+    
+    // System locations that do not exist here are skipped quietly
+    for (i = 0; i < NUM_STD_LOCATIONS; i++)
+    {
+        AddShadowRoot(&shadowIndex, stdLocations[i].path);
+    }
+    for (i = 0; args.roots && args.roots[i]; i++)
+    {
+        if (!AddShadowRoot(&shadowIndex, args.roots[i]))
+        {
+            PrintFault(IoErr(), args.roots[i]);
+        }
+    }
+    
+    if (shadowIndex.numRoots > 0)
+    {
+        InitScan(&scan, CollectComponent, NULL);
+        scan.quiet = args.quiet;
+        if (args.workers) scan.perDevice = *args.workers;
+        
+        complete = RunScan(&scan, ShadowWalkRoots(&shadowIndex, args.all), args.all);
+        
+        if (scan.broken)
+        {
+            Printf("\n*** Break received - aborting ***\n");
+        }
+        else if (complete)
+        {
+            ReportShadows(&shadowIndex, args.quiet);
+        }
+    }
+    else
+    {
+        Printf("Error: No locations to search\n");
+    }
+    
+    FreeShadowIndex(&shadowIndex);
+    return complete;
+}
+
+// PACK mode: every component in the directory that is newer than the one
+// installed, or all with FORCE, is installed as one transaction
+BOOL HandlePack(void)
+{
+    struct VersionInfo currentInfo, newInfo;
+    struct DirIter *it;
+    struct ExAllData *ed;
+    struct Batch *batch;
+    char source[MAX_PATH];
+    const char *dest;
+    BOOL installed;
+    BOOL full = FALSE;
     BOOL success = FALSE;
+    BPTR lock;
     
-    // First verify the source file exists and is readable
-    if (!(lock = Lock(source, ACCESS_READ)))
+    if (!(lock = Lock(args.pack, ACCESS_READ)))
     {
-        Printf("Error: Cannot access source file\n");
+        PrintFault(IoErr(), args.pack);
         return FALSE;
     }
-    UnLock(lock);
     
-    // Check if destination exists
-    if ((lock = Lock(dest, ACCESS_READ)))
+    if (!NeedCopyEngine() || !(batch = CreateBatch(CopyEng, args.verify)))
     {
         UnLock(lock);
-        // Backup existing file
-        if (!BackupFile(dest))
+        PrintFault(ERROR_NO_FREE_STORE, "QuickUpdate");
+        return FALSE;
+    }
+    
+    if ((it = CreateDirIter(COMPONENT_PATTERN, DIRITER_BUFFER_SIZE)))
+    {
+        StartDirIter(it, lock);
+        while ((ed = NextDirEntry(it)))
         {
-            Printf("Warning: Could not create backup\n");
-            return FALSE;
+            if (ed->ed_Type >= 0)
+                continue;
+            
+            strcpy(source, args.pack);
+            AddPart(source, ed->ed_Name, sizeof(source));
+            
+            if (!(dest = GetDestPath(source)) || !CheckFileVersion(source, &newInfo))
+            {
+                Printf("Skipping %s: no version information\n", (LONG)ed->ed_Name);
+                continue;
+            }
+            
+            installed = GetInstalledVersion(dest, &currentInfo) || CheckFileVersion(dest, &currentInfo);
+            if (installed && !args.force && CompareVersions(&currentInfo, &newInfo) <= 0)
+                continue;
+            
+            if (installed && SameContent(CopyEng, source, dest))
+            {
+                Printf("  %-30s already installed\n", (LONG)dest);
+                continue;
+            }
+            
+            if (installed)
+                Printf("  %-30s %ld.%ld -> %ld.%ld\n", (LONG)dest, currentInfo.version,
+                       currentInfo.revision, newInfo.version, newInfo.revision);
+            else
+                Printf("  %-30s new    -> %ld.%ld\n", (LONG)dest, newInfo.version, newInfo.revision);
+            
+            if (!AddBatchFile(batch, source, dest))
+            {
+                Printf("Error: Too many files in %s\n", (LONG)args.pack);
+                full = TRUE;
+                break;
+            }
         }
-        
-        // Delete existing file
-        if (!DeleteFile(dest))
+        DeleteDirIter(it);
+    }
+    UnLock(lock);
+    
+    if (full)
+    {
+        success = FALSE;
+    }
+    else if (batch->count == 0)
+    {
+        Printf("Nothing to install.\n");
+        success = TRUE;
+    }
+    else if (args.noninteractive)
+    {
+        Printf("%ld updates available.\n", batch->count);
+        success = TRUE;
+    }
+    else
+    {
+        Printf("Install these %ld files? (y/n): ", batch->count);
+        if (GetUserResponse())
         {
-            Printf("Error: Could not remove existing file\n");
-            return FALSE;
+            success = RunBatch(batch, BACKUP_DIR);
+            Printf(success ? "Update completed successfully.\n" : "Update failed, nothing was changed.\n");
         }
     }
     
-    // Copy new file
-    if (Copy(source, dest))
-    {
-        // Set proper protection bits
+    DeleteBatch(batch);
+    return success;
+}
+
+// ROLLBACK mode: one pass over the backup index finds the version, which
+// is unpacked to T: and installed from there
+BOOL HandleRollback(void)
+{
+    struct BackupEntry entry;
+    struct DateTime dt;
+    char date[LEN_DATSTRING];
+    char time[LEN_DATSTRING];
+    char path[MAX_PATH];
+    char temp[MAX_PATH];
+    ULONG skip = (args.version && *args.version > 0) ? *args.version : 0;
+    BOOL success;
+    
+    BackupPathName(args.file, path);
+    
+    if (!FindBackup(BACKUP_DIR, path, skip, &entry))
+    {
+        Printf("Error: No backup %lu of %s\n", skip, (LONG)path);
+        return FALSE;
+    }
+    
+    memset(&dt, 0, sizeof(dt));
+    dt.dat_Stamp = entry.date;
+    dt.dat_Format = FORMAT_DOS;
+    dt.dat_StrDate = date;
+    dt.dat_StrTime = time;
+    if (!DateToStr(&dt))
+    {
+        strcpy(date, "?");
+        strcpy(time, "?");
+    }
+    Printf("Backup %lu of %s: %s %s, %lu bytes\n", skip, (LONG)path, (LONG)date, (LONG)time,
+           entry.size);
+    
+    if (args.noninteractive)
+        return TRUE;
+    
+    Printf("Restore this version? (y/n): ");
+    if (!GetUserResponse())
+        return FALSE;
+    
+    if (!NeedCopyEngine())
+    {
+        PrintFault(IoErr(), "QuickUpdate");
+        return FALSE;
+    }
+    
+    // Installed like an update, so the current file becomes a backup too
+    TempName(ROLLBACK_TEMP, 0, temp);
+    success = RestoreBackup(CopyEng, BACKUP_DIR, &entry, temp) &&
+              ReplaceFile(temp, path, entry.checksum, NULL);
+    DeleteFile(temp);
+    
+    Printf(success ? "Rollback completed successfully.\n" : "Rollback failed!\n");
+    return success;
+}
+
+// PATCH mode: the delta is checked against the installed file before
+// anything is written, and the rebuilt file against the release it names
+// before it is installed like any other
+BOOL HandlePatch(void)
+{
+    struct DeltaHeader header;
+    char dest[MAX_PATH];
+    char temp[MAX_PATH];
+    const char *location;
+    ULONG checksum, size;
+    BOOL success;
+    
+    if (!ReadDeltaHeader(args.patch, &header))
+    {
+        Printf("Error: %s is not a delta\n", (LONG)args.patch);
+        return FALSE;
+    }
+    
+    if (!(location = GetDestPath(header.name)))
+    {
+        Printf("Error: Unknown file type %s\n", (LONG)header.name);
+        return FALSE;
+    }
+    strcpy(dest, location);
+    
+    if (!NeedCopyEngine() || !ChecksumEngineFile(CopyEng, dest, &checksum, &size))
+    {
+        PrintFault(IoErr(), dest);
+        return FALSE;
+    }
+    
+    if (checksum == header.targetChecksum && size == header.targetSize)
+    {
+        Printf("%s is already installed\n", (LONG)dest);
+        return TRUE;
+    }
+    
+    if (checksum != header.baseChecksum || size != header.baseSize)
+    {
+        Printf("Error: %s does not apply to the installed %s\n", (LONG)args.patch, (LONG)dest);
+        return FALSE;
+    }
+    
+    if (ChecksumDB && !KnownChecksum(dest, header.targetChecksum))
+        Printf("Warning: %s makes a release not in the database\n", (LONG)args.patch);
+    
+    Printf("%s applies to %s, %lu bytes after\n", (LONG)args.patch, (LONG)dest, header.targetSize);
+    
+    if (args.noninteractive)
+        return TRUE;
+    
+    Printf("Would you like to install the patched version? (y/n): ");
+    if (!GetUserResponse())
+        return FALSE;
+    
+    TempName(PATCH_TEMP, 0, temp);
+    success = ApplyDelta(dest, args.patch, temp) &&
+              ReplaceFile(temp, dest, header.targetChecksum, NULL);
+    DeleteFile(temp);
+    
+    if (success)
         SetProtection(dest, FIBF_READ|FIBF_EXECUTE|FIBF_WRITE);
-        success = TRUE;
-    }
-    else
-    {
-        Printf("Error: Failed to copy file\n");
-    }
     
+    Printf(success ? "Update completed successfully.\n" : "Update failed!\n");
     return success;
 }
 
-BOOL Copy(const char *source, const char *dest)
+BOOL HandleMakePatch(void)
 {
-    BPTR src_fh, dst_fh;
-    BOOL success = FALSE;
-    UBYTE buffer[BUFFER_SIZE];
-    LONG bytes_read;
+    ULONG written;
     
-    if ((src_fh = Open(source, MODE_OLDFILE)))
+    if (!args.file || !args.from)
     {
-        if ((dst_fh = Open(dest, MODE_NEWFILE)))
-        {
-            success = TRUE;
-            
-            while ((bytes_read = Read(src_fh, buffer, BUFFER_SIZE)) > 0)
-            {
-                if (Write(dst_fh, buffer, bytes_read) != bytes_read)
-                {
-                    success = FALSE;
-                    break;
-                }
-            }
-            
-            Close(dst_fh);
-            
-            if (!success)
-            {
-                DeleteFile(dest);  // Clean up failed copy
-            }
-        }
-        Close(src_fh);
+        Printf("Error: MAKEPATCH needs FROM and FILE\n");
+        return FALSE;
     }
     
-    return success;
+    if (!CreateDelta(args.from, args.file, args.makepatch, &written))
+    {
+        Printf("Error: Could not write %s\n", (LONG)args.makepatch);
+        return FALSE;
+    }
+    
+    if (!args.quiet)
+        Printf("Wrote %s, %lu bytes\n", (LONG)args.makepatch, written);
+    return TRUE;
 }
 
-int main(int argc, char **argv)
+// SIGN mode, run on the master: a signature is saved next to every
+// component in the directory, so SYNC need not read them whole
+BOOL HandleSign(void)
 {
-    BOOL success = FALSE;
+    struct Signature sig;
+    struct DirIter *it;
+    struct ExAllData *ed;
+    char path[MAX_PATH];
+    ULONG count = 0;
+    BOOL success = TRUE;
+    BPTR lock;
     
-    if (OpenLibraries())
+    if (!(lock = Lock(args.sign, ACCESS_READ)))
     {
-        struct WBStartup *wbmsg = NULL;
-        
-        // Check if we're started from Workbench
-        if (argc == 0)
+        PrintFault(IoErr(), args.sign);
+        return FALSE;
+    }
+    
+    if (!NeedCopyEngine() || !(it = CreateDirIter(COMPONENT_PATTERN, DIRITER_BUFFER_SIZE)))
+    {
+        UnLock(lock);
+        PrintFault(ERROR_NO_FREE_STORE, "QuickUpdate");
+        return FALSE;
+    }
+    
+    StartDirIter(it, lock);
+    while ((ed = NextDirEntry(it)))
+    {
+        if (ed->ed_Type >= 0)
+            continue;
+    
+        strcpy(path, args.sign);
+        AddPart(path, ed->ed_Name, sizeof(path));
+    
+        if (!SignFile(CopyEng, path, &sig) || !SaveSignature(path, &sig))
         {
-            wbmsg = (struct WBStartup *)argv;
-            success = HandleWorkbench();
+            Printf("Error: Could not sign %s\n", (LONG)path);
+            success = FALSE;
         }
         else
         {
-            success = HandleCLI(argc, argv);
+            if (!args.quiet)
+                Printf("  %-30s %lu blocks\n", (LONG)ed->ed_Name, sig.header.blocks);
+            count++;
         }
-        
-        CloseLibraries();
+        FreeSignature(&sig);
     }
+    DeleteDirIter(it);
+    UnLock(lock);
     
-    return success ? RETURN_OK : RETURN_FAIL;
+    Printf("%lu files signed\n", count);
+    return success;
 }
 
-BOOL OpenLibraries(void)
+// SYNC mode: every component of the master directory that differs from
+// the installed one is rebuilt in T: from the blocks the installed file
+// already has and the master's other regions, then all are installed as
+// one batch, as with PACK
+BOOL HandleSync(void)
 {
-    if (!(IntuitionBase = (struct Library *)OpenLibrary("intuition.library", 37)))
-        return FALSE;
+    struct Signature *sigs, *sig;
+    struct DirIter *it;
+    struct ExAllData *ed;
+    struct BatchEntry *e;
+    struct Batch *batch = NULL;
+    char source[MAX_PATH];
+    char dest[MAX_PATH];
+    char temp[MAX_PATH];
+    const char *location;
+    ULONG checksum, size, fetched, i;
+    ULONG total = 0, fromMaster = 0;
+    BOOL full = FALSE;
+    BOOL success = FALSE;
+    BPTR lock;
     
-    if (!(AslBase = (struct Library *)OpenLibrary("asl.library", 37)))
+    if (!(lock = Lock(args.sync, ACCESS_READ)))
     {
-        CloseLibrary((struct Library *)IntuitionBase);
+        PrintFault(IoErr(), args.sync);
         return FALSE;
     }
     
-    return TRUE;
-}
-
-void CloseLibraries(void)
-{
-    if (AslBase) CloseLibrary((struct Library *)AslBase);
-    if (IntuitionBase) CloseLibrary((struct Library *)IntuitionBase);
-}
-
-BOOL HandleCLI(int argc, char **argv)
-{
-    BOOL success = FALSE;
-    
-    // Parse command line arguments
-    rdargs = ReadArgs(template, (LONG *)&args, NULL);
-    if (!rdargs)
+    // One signature per batch entry, kept from the comparison for the rebuild
+    if (!NeedCopyEngine() || !(batch = CreateBatch(CopyEng, args.verify)) ||
+        !(sigs = AllocVec(BATCH_MAX_FILES * sizeof(struct Signature), MEMF_CLEAR)))
     {
-        PrintFault(IoErr(), "QuickUpdate");
+        DeleteBatch(batch);
+        UnLock(lock);
+        PrintFault(ERROR_NO_FREE_STORE, "QuickUpdate");
         return FALSE;
     }
     
-    if (args.file)
+    if ((it = CreateDirIter(COMPONENT_PATTERN, DIRITER_BUFFER_SIZE)))
     {
-        struct VersionInfo currentInfo, newInfo;
-        BOOL hasCurrentVersion;
-        
-        Printf("Checking file: %s\n", (LONG)args.file);
-        
-        // Get version info of the new file
-        if (!CheckFileVersion(args.file, &newInfo))
-        {
-            Printf("Error: Unable to read version information from file\n");
-            FreeArgs(rdargs);
-            return FALSE;
-        }
-        
-        // Try to find current version in system
-        if (!GetInstalledVersion(args.file, &currentInfo))
-        {
-            Printf("Error accessing version database\n");
-            FreeArgs(rdargs);
-            return FALSE;
-        }
-        
-        hasCurrentVersion = TRUE;
-        
-        if (hasCurrentVersion)
+        StartDirIter(it, lock);
+        while ((ed = NextDirEntry(it)))
         {
-            Printf("Current version: %ld.%ld (Date: %ld)\n", 
-                currentInfo.version, currentInfo.revision, currentInfo.date);
-            Printf("New version: %ld.%ld (Date: %ld)\n",
-                newInfo.version, newInfo.revision, newInfo.date);
-            
-            if (newInfo.version > currentInfo.version ||
-                (newInfo.version == currentInfo.version && 
-                 newInfo.revision > currentInfo.revision))
+            if (ed->ed_Type >= 0)
+                continue;
+    
+            strcpy(source, args.sync);
+            AddPart(source, ed->ed_Name, sizeof(source));
+    
+            if (args.into)
             {
-                if (!args.noninteractive)
-                {
-                    Printf("Would you like to install the newer version? (y/n): ");
-                    if (GetUserResponse())
-                    {
-                        success = InstallFile(args.file, GetDestPath(args.file));
-                        if (success)
-                            Printf("Update completed successfully.\n");
-                        else
-                            Printf("Update failed!\n");
-                    }
-                }
-                else
+                strcpy(dest, args.into);
+                AddPart(dest, ed->ed_Name, sizeof(dest));
+            }
+            else if ((location = GetDestPath(source)))
+            {
+                strcpy(dest, location);
+            }
+            else
+            {
+                Printf("Skipping %s: unknown file type\n", (LONG)ed->ed_Name);
+                continue;
+            }
+    
+            if (batch->count >= BATCH_MAX_FILES)
+            {
+                Printf("Error: Too many files in %s\n", (LONG)args.sync);
+                full = TRUE;
+                break;
+            }
+            sig = &sigs[batch->count];
+            if (!FindSignature(CopyEng, source, sig))
+            {
+                Printf("Skipping %s: cannot be read\n", (LONG)ed->ed_Name);
+                continue;
+            }
+    
+            if (ChecksumEngineFile(CopyEng, dest, &checksum, &size))
+            {
+                if (checksum == sig->header.checksum && size == sig->header.size)
                 {
-                    Printf("Newer version available.\n");
-                    success = TRUE;
+                    FreeSignature(sig);
+                    if (!args.quiet)
+                        Printf("  %-30s up to date\n", (LONG)dest);
+                    continue;
                 }
+                Printf("  %-30s differs\n", (LONG)dest);
             }
             else
             {
-                Printf("No newer version available.\n");
-                success = TRUE;
+                Printf("  %-30s new\n", (LONG)dest);
+            }
+    
+            if (!AddBatchFile(batch, source, dest))
+            {
+                FreeSignature(sig);
+                Printf("Error: Too many files in %s\n", (LONG)args.sync);
+                full = TRUE;
+                break;
             }
         }
-        else
+        DeleteDirIter(it);
+    }
+    UnLock(lock);
+    
+    if (full)
+    {
+        success = FALSE;
+    }
+    else if (batch->count == 0)
+    {
+        Printf("Nothing to sync.\n");
+        success = TRUE;
+    }
+    else if (args.noninteractive)
+    {
+        Printf("%ld files differ.\n", batch->count);
+        success = TRUE;
+    }
+    else
+    {
+        Printf("Sync these %ld files? (y/n): ", batch->count);
+        if (GetUserResponse())
         {
-            Printf("No existing version found. New installation.\n");
-            if (!args.noninteractive)
+            // A file that cannot be rebuilt, because it is new or the
+            // master changed since it was compared, is copied whole
+            for (i = 0; i < batch->count; i++)
             {
-                Printf("Would you like to install this file? (y/n): ");
-                if (GetUserResponse())
+                e = &batch->entries[i];
+                TempName(SYNC_TEMP, i, temp);
+    
+                if (SyncFile(CopyEng, &sigs[i], e->source, e->dest, temp, &fetched))
                 {
-                    success = InstallFile(args.file, GetDestPath(args.file));
-                    if (success)
-                        Printf("Installation completed successfully.\n");
-                    else
-                        Printf("Installation failed!\n");
+                    strcpy(e->source, temp);
+                    e->expect = sigs[i].header.checksum;
+                    total += sigs[i].header.size;
+                    fromMaster += fetched;
                 }
             }
-            else
+    
+            success = RunBatch(batch, BACKUP_DIR);
+    
+            for (i = 0; i < batch->count; i++)
             {
-                Printf("Installation possible.\n");
-                success = TRUE;
+                TempName(SYNC_TEMP, i, temp);
+                DeleteFile(temp);
             }
+    
+            if (success && total && !args.quiet)
+                Printf("Read %lu of %lu bytes from %s\n", fromMaster, total, (LONG)args.sync);
+            Printf(success ? "Sync completed successfully.\n" : "Sync failed, nothing was changed.\n");
         }
     }
     
-    FreeArgs(rdargs);
+    for (i = 0; i < batch->count; i++)
+        FreeSignature(&sigs[i]);
+    FreeVec(sigs);
+    DeleteBatch(batch);
     return success;
 }
 
+static BOOL PruneStore(void)
+{
+    struct BackupPolicy policy;
+    ULONG entries, blobs;
+    
+    policy.keep = (args.keep && *args.keep > 0) ? *args.keep : 0;
+    policy.maxDays = (args.maxage && *args.maxage > 0) ? *args.maxage : 0;
+    policy.budget = (args.budget && *args.budget > 0) ? *args.budget * 1024 : 0;
+    
+    if (!policy.keep && !policy.maxDays && !policy.budget)
+    {
+        Printf("Error: KEEP, MAXAGE or BUDGET is required\n");
+        return FALSE;
+    }
+    
+    if (!PruneBackups(BACKUP_DIR, &policy, &entries, &blobs))
+    {
+        Printf("Error: Could not prune %s\n", (LONG)BACKUP_DIR);
+        return FALSE;
+    }
+    
+    if (!args.quiet)
+        Printf("Pruned %lu backups, %lu files deleted\n", entries, blobs);
+    return TRUE;
+}
+
 BOOL GetUserResponse(void)
 {
     char buffer[2];
@@ -438,24 +1228,13 @@ BOOL GetUserResponse(void)
 const char *GetDestPath(const char *filename)
 {
     static char destpath[256];
-    const char *basename = FilePart(filename);
-    const char *ext = strrchr(basename, '.');
+    const char *location = FileTypeLocation(ClassifyName(filename));
     
-    if (!ext) return NULL;
-    ext++; // Skip the dot
-    
-    // Find matching standard location
-    for (int i = 0; i < NUM_STD_LOCATIONS; i++)
-    {
-        if (stricmp(ext, stdLocations[i].extensions + 1) == 0)
-        {
-            strcpy(destpath, stdLocations[i].path);
-            AddPart(destpath, basename, sizeof(destpath));
-            return destpath;
-        }
-    }
+    if (!location) return NULL;
     
-    return NULL;
+    strcpy(destpath, location);
+    AddPart(destpath, FilePart(filename), sizeof(destpath));
+    return destpath;
 }
 
 BOOL IsStandardSystemLocation(const char *path)
@@ -839,68 +1618,66 @@ BOOL CreateAppIcon(void)
 
 BOOL IsValidFileType(const char *filename)
 {
-    const char *ext = FilePart(filename);
-    
-    // Find the last dot in filename
-    while (*ext && *ext != '.') ext++;
-    if (*ext == '.')
-    {
-        ext++;  // Skip the dot
-        if (stricmp(ext, "library") == 0 ||
-            stricmp(ext, "device") == 0 ||
-            stricmp(ext, "datatype") == 0 ||
-            stricmp(ext, "class") == 0 ||
-            stricmp(ext, "gadget") == 0 ||
-            stricmp(ext, "resource") == 0 ||
-            stricmp(ext, "mcc") == 0 ||
-            stricmp(ext, "mcp") == 0)
-        {
-            return TRUE;
-        }
-    }
-    return FALSE;
+    return ClassifyName(filename) != FT_UNKNOWN;
 }
 
 BOOL GetInstalledVersion(const char *filename, struct VersionInfo *info)
 {
-    BPTR fh;
-    BOOL found = FALSE;
+    struct DBCursor cursor;
     struct ChecksumEntry entry;
-    char *baseName = FilePart(filename);
+    struct FileInfoBlock *fib;
+    BPTR lock;
+    LONG filesize = -1;
+    ULONG checksum = 0;
+    BOOL haveChecksum = FALSE;
+    BOOL found = FALSE;
+    BOOL more;
+    
+    if (!ChecksumDB)
+        return FALSE;
     
-    if ((fh = Open(CHECKSUM_DB, MODE_OLDFILE)))
+    for (more = FindFirstEntry(ChecksumDB, filename, &cursor, &entry);
+         more;
+         more = FindNextEntry(ChecksumDB, &cursor, &entry))
     {
-        while (Read(fh, &entry, sizeof(entry)) == sizeof(entry))
+        // Verify the file still exists and matches
+        if (filesize < 0)
         {
-            if (stricmp(baseName, entry.filename) == 0)
+            if (!(lock = Lock(filename, ACCESS_READ)))
+                break;
+            if ((fib = AllocDosObject(DOS_FIB, NULL)))
             {
-                // Verify the file still exists and matches
-                BPTR lock;
-                if ((lock = Lock(filename, ACCESS_READ)))
+                if (Examine(lock, fib))
                 {
-                    struct FileInfoBlock *fib;
-                    if ((fib = AllocDosObject(DOS_FIB, NULL)))
-                    {
-                        if (Examine(lock, fib))
-                        {
-                            if (fib->fib_Size == entry.filesize &&
-                                CalculateChecksum(filename) == entry.checksum)
-                            {
-                                info->version = entry.version;
-                                info->revision = entry.revision;
-                                info->date = entry.date;
-                                strncpy(info->origin, entry.origin, sizeof(info->origin)-1);
-                                found = TRUE;
-                            }
-                        }
-                        FreeDosObject(DOS_FIB, fib);
-                    }
-                    UnLock(lock);
+                    filesize = fib->fib_Size;
                 }
-                break;
+                FreeDosObject(DOS_FIB, fib);
             }
+            UnLock(lock);
+            if (filesize < 0)
+                break;
+        }
+        
+        if ((ULONG)filesize != entry.filesize)
+            continue;
+        
+        // Hash at most once, however many records share the name
+        if (!haveChecksum)
+        {
+            checksum = CalculateChecksum(filename);
+            haveChecksum = TRUE;
+        }
+        
+        if (checksum == entry.checksum)
+        {
+            info->version = entry.version;
+            info->revision = entry.revision;
+            info->date = entry.date;
+            strncpy(info->origin, entry.origin, sizeof(info->origin)-1);
+            info->origin[sizeof(info->origin)-1] = '\0';
+            found = TRUE;
+            break;
         }
-        Close(fh);
     }
     
     return found;
@@ -1231,14 +2008,9 @@ BOOL CreateMainWindow(void)
 
 BOOL IsLibrary(const char *filename)
 {
-    const char *ext = FilePart(filename);
-    
-    if (strstr(ext, ".library"))
-        return TRUE;
-    else if (strstr(ext, ".device"))
-        return TRUE;
+    LONG type = ClassifyName(filename);
     
-    return FALSE;
+    return type == FT_LIBRARY || type == FT_DEVICE;
 }
 
 // Update PathsMatch to ensure case-insensitive comparison
@@ -1281,50 +2053,23 @@ BOOL PathsMatch(const char *path1, const char *path2)
     return (strcmp(lower1, lower2) == 0);
 }
 
-// Update GetCorrectSystemLocation to handle datatype files specially
+// The name decides, except that the first bytes of a .datatype file tell
+// a descriptor from a class. Other files are not read.
 const char *GetCorrectSystemLocation(const char *filename)
 {
-    const char *ext = strrchr(FilePart(filename), '.');
-    if (!ext) return NULL;
-    ext++; // Skip the dot
+    UBYTE head[CLASSIFY_HEAD];
+    LONG type = ClassifyName(filename);
+    LONG len = 0;
+    BPTR fh;
     
-    // Special handling for datatype files
-    if (stricmp(ext, "datatype") == 0)
+    if (type == FT_DATATYPE && (fh = Open(filename, MODE_OLDFILE)))
     {
-        // Check if it's a descriptor file (usually small, < 1KB)
-        BPTR lock = Lock(filename, ACCESS_READ);
-        if (lock)
-        {
-            struct FileInfoBlock *fib = AllocDosObject(DOS_FIB, NULL);
-            if (fib)
-            {
-                if (Examine(lock, fib))
-                {
-                    // If it's a small file, it's likely a descriptor
-                    if (fib->fib_Size < 1024)
-                    {
-                        FreeDosObject(DOS_FIB, fib);
-                        UnLock(lock);
-                        return "DEVS:Datatypes";
-                    }
-                }
-                FreeDosObject(DOS_FIB, fib);
-            }
-            UnLock(lock);
-        }
-        // If it's not a descriptor, it's a datatype class
-        return "SYS:Classes/Datatypes";
+        if ((len = Read(fh, head, sizeof(head))) < 0) len = 0;
+        Close(fh);
+        type = ClassifyFile(filename, head, len);
     }
     
-    // Handle other file types
-    for (int i = 0; i < NUM_STD_LOCATIONS; i++)
-    {
-        if (stricmp(ext, stdLocations[i].extensions + 1) == 0)
-        {
-            return stdLocations[i].path;
-        }
-    }
-    return NULL;
+    return FileTypeLocation(type);
 }
 
 // Add after the existing system location definitions
@@ -15,6 +15,13 @@
 #define ID_QUIT  3
 #define ID_CHECK 4
 
+// What SCAN found an installed component to be
+#define CLASS_CURRENT  0    // Known release, nothing newer in the database
+#define CLASS_OUTDATED 1    // Known release, the database has a newer one
+#define CLASS_MODIFIED 2    // Name known, contents match no release
+#define CLASS_UNKNOWN  3    // Name not in the database
+#define NUM_CLASSES    4
+
 // Global variables
 extern struct DosLibrary *DOSBase;
 extern struct Library *AslBase;
@@ -27,8 +34,6 @@ const char *GetDestPath(const char *filename);
 BOOL IsValidFileType(const char *filename);
 void ShowFileRequester(void);
 BOOL GetUserResponse(void);
-BOOL Copy(const char *source, const char *dest);
-BOOL BackupFile(const char *filepath);
 void SetStatusText(const char *text);
 void RA_Iconify(Object *obj);
 Object *RA_OpenWindow(Object *obj);
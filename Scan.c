@@ -0,0 +1,665 @@
+#include "Scan.h"
+
+#include <exec/memory.h>
+#include <dos/dosextens.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+
+void InitScan(struct Scan *scan, ScanCommitFunc commit, APTR userData)
+{
+    memset(scan, 0, sizeof(struct Scan));
+    scan->commit = commit;
+    scan->userData = userData;
+    scan->perDevice = 1;
+    scan->depth = SCAN_DEFAULT_DEPTH;
+    InitSemaphore(&scan->dirLock);
+}
+
+static struct ScanDir *NewScanDir(const char *path, const struct DateStamp *date)
+{
+    struct ScanDir *dir;
+    
+    if ((dir = AllocVec(sizeof(struct ScanDir) + strlen(path), MEMF_CLEAR)))
+    {
+        dir->refs = 1;
+        dir->date = *date;
+        strcpy(dir->path, path);
+    }
+    return dir;
+}
+
+static void ReleaseScanDir(struct Scan *scan, struct ScanDir *dir)
+{
+    LONG refs;
+    
+    ObtainSemaphore(&scan->dirLock);
+    refs = --dir->refs;
+    ReleaseSemaphore(&scan->dirLock);
+    
+    // A partial group would hide the missing files from the next run
+    if (refs == 0)
+    {
+        if (scan->mw && !dir->partial)
+        {
+            WriteManifestDir(scan->mw, &dir->group, dir->path, &dir->date);
+        }
+        FreeManifestGroup(&dir->group);
+        FreeVec(dir);
+    }
+}
+
+// Without a manifest writer the groups stay empty, so memory does not
+// grow with the size of a directory
+static void AddFileLine(struct Scan *scan, struct ScanDir *dir, const char *name,
+                        ULONG size, const struct DateStamp *date)
+{
+    if (!scan->mw)
+        return;
+    
+    ObtainSemaphore(&scan->dirLock);
+    AddManifestFile(&dir->group, name, size, date);
+    ReleaseSemaphore(&scan->dirLock);
+}
+
+// Unchanged directory: carry its old entries forward and visit the
+// subdirectories we know about without reading it again
+static void ReuseDirectory(struct DirWalk *walk, struct ScanContext *ctx)
+{
+    struct Manifest *m = ctx->from;
+    struct ManifestEntry *e;
+    char *name;
+    ULONG i;
+    
+    // No jobs refer to the directory yet, the group is ours alone
+    for (i = 0; i < ctx->old->children; i++)
+    {
+        e = &m->entries[ctx->old->first + i];
+        name = ManifestName(m, e->name);
+        
+        if (e->size == MANIFEST_SUBDIR)
+        {
+            AddManifestSubdir(&ctx->dir->group, name);
+            DirWalkQueue(walk, name);
+        }
+        else
+        {
+            AddManifestFile(&ctx->dir->group, name, e->size, &e->date);
+            ctx->stats.fileHits++;
+        }
+    }
+    
+    ctx->stats.dirHits++;
+}
+
+// What an interrupted scan saw is newer than the previous run
+static struct ManifestDir *FindOldDir(struct Scan *scan, const char *path,
+                                      struct Manifest **from)
+{
+    struct ManifestDir *dir;
+    
+    if ((*from = scan->resume) && (dir = FindManifestDir(*from, path)))
+        return dir;
+    
+    if ((*from = scan->old) && (dir = FindManifestDir(*from, path)))
+        return dir;
+    
+    *from = NULL;
+    return NULL;
+}
+
+static BOOL StartContext(struct ScanContext *ctx)
+{
+    LONG i;
+    
+    // Created here so its signal belongs to the walker's process
+    if (!(ctx->port = CreateMsgPort()))
+        return FALSE;
+    
+    if (!(ctx->jobs = AllocVec(ctx->scan->depth * sizeof(struct ScanJob), MEMF_CLEAR)))
+        return FALSE;
+    
+    NewList((struct List *)&ctx->free);
+    for (i = 0; i < ctx->scan->depth; i++)
+    {
+        ctx->jobs[i].job.msg.mn_ReplyPort = ctx->port;
+        ctx->jobs[i].job.msg.mn_Length = sizeof(struct ScanJob);
+        AddTail((struct List *)&ctx->free, (struct Node *)&ctx->jobs[i]);
+    }
+    
+    return TRUE;
+}
+
+static void CollectJobs(struct ScanContext *ctx)
+{
+    struct ScanJob *job;
+    
+    while ((job = (struct ScanJob *)GetMsg(ctx->port)))
+    {
+        AddTail((struct List *)&ctx->free, (struct Node *)job);
+        ctx->busy--;
+    }
+}
+
+// Backpressure: with all our jobs in the pipeline, wait for one to return
+static struct ScanJob *GetJob(struct ScanContext *ctx)
+{
+    struct ScanJob *job;
+    struct timeval start;
+    
+    CollectJobs(ctx);
+    if (!(job = (struct ScanJob *)RemHead((struct List *)&ctx->free)))
+    {
+        StatStart(&start);
+        do
+        {
+            WaitPort(ctx->port);
+            CollectJobs(ctx);
+        }
+        while (!(job = (struct ScanJob *)RemHead((struct List *)&ctx->free)));
+        StatStop(&ctx->stats.stall, &start);
+    }
+    return job;
+}
+
+static void EndContext(struct ScanContext *ctx)
+{
+    LONG i;
+    
+    if (ctx->port)
+    {
+        while (ctx->busy > 0)
+        {
+            WaitPort(ctx->port);
+            CollectJobs(ctx);
+        }
+        DeleteMsgPort(ctx->port);
+        ctx->port = NULL;
+    }
+    
+    // An aborted walk never reports DWE_DONE for the last directory
+    if (ctx->dir)
+    {
+        ctx->dir->partial = TRUE;
+        ReleaseScanDir(ctx->scan, ctx->dir);
+        ctx->dir = NULL;
+    }
+    
+    if (ctx->jobs)
+    {
+        for (i = 0; i < ctx->scan->depth; i++)
+        {
+            if (ctx->jobs[i].path) FreeVec(ctx->jobs[i].path);
+        }
+        FreeVec(ctx->jobs);
+        ctx->jobs = NULL;
+    }
+}
+
+static BOOL SetJobPath(struct ScanJob *job, const char *path)
+{
+    ULONG len = strlen(path) + 1;
+    
+    if (len > job->pathSize)
+    {
+        if (job->path) FreeVec(job->path);
+        job->pathSize = (len + 63) & ~63;
+        if (!(job->path = AllocVec(job->pathSize, MEMF_ANY)))
+        {
+            job->pathSize = 0;
+            return FALSE;
+        }
+    }
+    strcpy(job->path, path);
+    return TRUE;
+}
+
+// Enumerator: runs in each walker, sends every file that needs looking at
+// down the pipeline
+static LONG ScanEvent(struct DirWalk *walk, LONG event, struct ExAllData *ed, APTR userData)
+{
+    struct ScanContext *ctx = (struct ScanContext *)userData;
+    struct Scan *scan = ctx->scan;
+    struct ManifestEntry *old;
+    struct DateStamp date;
+    struct ScanJob *job;
+    
+    switch (event)
+    {
+        case DWE_START:
+            return StartContext(ctx) ? WALK_CONTINUE : WALK_ABORT;
+        
+        case DWE_END:
+            ctx->stats.entriesSeen = walk->iter->seen;
+            ctx->stats.exAllCalls = walk->iter->calls;
+            EndContext(ctx);
+            return WALK_CONTINUE;
+        
+        case DWE_ENTER:
+            if (scan->stop || !(ctx->dir = NewScanDir(walk->path, &walk->fib->fib_Date)))
+                return WALK_ABORT;
+            
+            StatStart(&ctx->dirStart);
+            ctx->old = FindOldDir(scan, walk->path, &ctx->from);
+            
+            if (ctx->old && CompareDates(&ctx->old->date, &ctx->dir->date) == 0)
+            {
+                ReuseDirectory(walk, ctx);
+                return WALK_NOSCAN;
+            }
+            
+            ctx->stats.dirMisses++;
+            ctx->stats.dirsRead++;
+            return WALK_CONTINUE;
+        
+        case DWE_DONE:
+            StatStop(&ctx->stats.enumerate, &ctx->dirStart);
+            ReleaseScanDir(scan, ctx->dir);
+            ctx->dir = NULL;
+            return WALK_CONTINUE;
+        
+        case DWE_DIR:
+            if (scan->mw)
+            {
+                ObtainSemaphore(&scan->dirLock);
+                AddManifestSubdir(&ctx->dir->group, (char *)ed->ed_Name);
+                ReleaseSemaphore(&scan->dirLock);
+            }
+            return WALK_CONTINUE;
+    }
+    
+    if (scan->stop)
+        return WALK_ABORT;
+    
+    ctx->stats.filesMatched++;
+    date.ds_Days = ed->ed_Days;
+    date.ds_Minute = ed->ed_Mins;
+    date.ds_Tick = ed->ed_Ticks;
+    
+    // Same size and date as last time: already in the database or unversioned
+    if (ctx->old && (old = FindManifestEntry(ctx->from, ctx->old, (char *)ed->ed_Name)) &&
+        old->size == ed->ed_Size && CompareDates(&old->date, &date) == 0)
+    {
+        AddFileLine(scan, ctx->dir, (char *)ed->ed_Name, ed->ed_Size, &date);
+        ctx->stats.fileHits++;
+        return WALK_CONTINUE;
+    }
+    ctx->stats.fileMisses++;
+    
+    job = GetJob(ctx);
+    if (!SetJobPath(job, walk->path))
+    {
+        AddTail((struct List *)&ctx->free, (struct Node *)job);
+        return WALK_ABORT;
+    }
+    
+    ObtainSemaphore(&scan->dirLock);
+    ctx->dir->refs++;
+    ReleaseSemaphore(&scan->dirLock);
+    
+    job->dir = ctx->dir;
+    job->data = NULL;
+    job->lock = 0;
+    job->unreadable = FALSE;
+    memset(&job->result, 0, sizeof(struct ScanResult));
+    job->result.path = job->path;
+    job->result.name = FilePart(job->path);
+    job->result.size = ed->ed_Size;
+    job->result.date = date;
+    
+    ctx->busy++;
+    SendPipeJob(ctx->reader, &job->job);
+    
+    return WALK_CONTINUE;
+}
+
+// Reader batch: lock the files to be read and read them in the order of
+// their keys. On OFS and FFS the key is the file header block, which sits
+// just before the file's data, so the head sweeps across the disk instead
+// of seeking back and forth. Equal keys, as some file systems report,
+// keep directory order.
+static void OrderReads(struct PipeStage *stage, struct PipeJob **jobs, ULONG count)
+{
+    struct ScanJob *job;
+    struct PipeJob *pj;
+    ULONG i, j;
+    
+    for (i = 0; i < count; i++)
+    {
+        job = (struct ScanJob *)jobs[i];
+        job->key = 0;
+        
+        if (job->result.size > 0 && job->result.size <= SCAN_MAX_BUFFER &&
+            (job->lock = Lock(job->path, ACCESS_READ)))
+        {
+            job->key = ((struct FileLock *)BADDR(job->lock))->fl_Key;
+        }
+    }
+    
+    // Insertion sort, stable and quick for a handful of jobs
+    for (i = 1; i < count; i++)
+    {
+        pj = jobs[i];
+        job = (struct ScanJob *)pj;
+        for (j = i; j > 0 && ((struct ScanJob *)jobs[j - 1])->key > job->key; j--)
+        {
+            jobs[j] = jobs[j - 1];
+        }
+        jobs[j] = pj;
+    }
+}
+
+// Reader: one per drive, loads the whole file with a few large reads
+static void ReadJob(struct PipeStage *stage, struct PipeJob *pj)
+{
+    struct ScanJob *job = (struct ScanJob *)pj;
+    struct ScanStats *stats = (struct ScanStats *)stage->userData;
+    struct timeval start;
+    ULONG size = job->result.size;
+    ULONG got = 0;
+    LONG len;
+    UBYTE extra;
+    BPTR fh;
+    
+    if (size == 0 || size > SCAN_MAX_BUFFER)
+        return;
+    
+    // The lock from the batch saves looking the file up again
+    if (job->lock)
+    {
+        if (!(fh = OpenFromLock(job->lock)))
+            UnLock(job->lock);
+        job->lock = 0;
+    }
+    else
+    {
+        fh = Open(job->path, MODE_OLDFILE);
+    }
+    
+    if (!fh)
+    {
+        job->unreadable = TRUE;
+        return;
+    }
+    
+    if ((job->data = AllocVec(size, MEMF_ANY)))
+    {
+        StatStart(&start);
+        while (got < size &&
+               (len = Read(fh, job->data + got,
+                           size - got > SCAN_READ_BLOCK ? SCAN_READ_BLOCK : size - got)) > 0)
+        {
+            got += len;
+        }
+        
+        // The file changed since ExAll saw it, the analyzer reads it itself
+        if (got != size || Read(fh, &extra, 1) != 0)
+        {
+            FreeVec(job->data);
+            job->data = NULL;
+        }
+        else
+        {
+            stats->filesRead++;
+        }
+        StatStop(&stats->read, &start);
+    }
+    Close(fh);
+}
+
+// Files too large for the reader: one pass with large reads computes the
+// checksum, finds the version and keeps the first bytes for ClassifyFile()
+static void AnalyzeFromDisk(struct ScanJob *job, UBYTE *head)
+{
+    struct ScanResult *r = &job->result;
+    struct VersionScan vs;
+    UBYTE *buffer;
+    ULONG crc = 0xFFFFFFFF;
+    ULONG got = 0;
+    LONG len = 0;
+    BPTR fh;
+    
+    if (!(buffer = AllocVec(SCAN_READ_BLOCK, MEMF_ANY)))
+        return;
+    
+    if ((fh = Open(job->path, MODE_OLDFILE)))
+    {
+        InitVersionScan(&vs);
+        while ((len = Read(fh, buffer, SCAN_READ_BLOCK)) > 0)
+        {
+            if (got == 0)
+            {
+                memcpy(head, buffer, len < CLASSIFY_HEAD ? len : CLASSIFY_HEAD);
+            }
+            crc = UpdateCRC32(crc, buffer, len);
+            FeedVersionScan(&vs, job->path, buffer, len, &r->info);
+            got += len;
+        }
+        Close(fh);
+        
+        if (len == 0)
+        {
+            r->checksum = crc ^ 0xFFFFFFFF;
+            r->haveVersion = EndVersionScan(&vs, job->path, &r->info);
+        }
+    }
+    FreeVec(buffer);
+}
+
+// Analyzer: checksum and version, from memory when the reader had the file
+static void AnalyzeJob(struct PipeStage *stage, struct PipeJob *pj)
+{
+    struct ScanJob *job = (struct ScanJob *)pj;
+    struct ScanStats *stats = (struct ScanStats *)stage->userData;
+    struct ScanResult *r = &job->result;
+    struct timeval start;
+    UBYTE head[CLASSIFY_HEAD];
+    
+    if (job->unreadable)
+        return;
+    
+    if (job->data)
+    {
+        StatStart(&start);
+        r->checksum = UpdateCRC32(0xFFFFFFFF, job->data, r->size) ^ 0xFFFFFFFF;
+        StatStop(&stats->hash, &start);
+        
+        r->type = ClassifyFile(r->name, job->data, r->size);
+        
+        StatStart(&start);
+        r->haveVersion = CheckBufferVersion(job->path, job->data, r->size, &r->info);
+        StatStop(&stats->parse, &start);
+        FreeVec(job->data);
+        job->data = NULL;
+    }
+    else
+    {
+        // Includes the reading and the version search
+        StatStart(&start);
+        memset(head, 0, sizeof(head));
+        AnalyzeFromDisk(job, head);
+        StatStop(&stats->hash, &start);
+        
+        r->type = ClassifyFile(r->name, head, r->checksum ? sizeof(head) : 0);
+    }
+    
+    // Without a version string CheckFileVersion() uses the file date
+    r->haveVerString = r->haveVersion;
+    if (r->checksum && !r->haveVersion)
+    {
+        r->info.version = 0;
+        r->info.revision = 0;
+        r->info.date = (r->date.ds_Days << 16) | (r->date.ds_Minute << 8) | r->date.ds_Tick;
+        r->haveVersion = TRUE;
+    }
+    
+    if (r->checksum)
+    {
+        stats->filesHashed++;
+        stats->bytesHashed += r->size;
+    }
+}
+
+// Committer: hands results to the caller in pipeline order
+static void CommitJob(struct PipeStage *stage, struct PipeJob *pj)
+{
+    struct ScanJob *job = (struct ScanJob *)pj;
+    struct Scan *scan = (struct Scan *)stage->userData;
+    struct ScanResult *r = &job->result;
+    struct timeval start;
+    struct DateStamp now;
+    ULONG minute;
+    
+    // A component suffix on a file without a hunk header, as the analyzer
+    // found from the bytes it had. Listed, so the next run skips it.
+    if (r->checksum && r->type == FT_UNKNOWN)
+    {
+        AddFileLine(scan, job->dir, r->name, r->size, &r->date);
+    }
+    // Unreadable files, and files arriving after a stop, keep their
+    // directory out of the manifest so the next run looks at them again
+    else if (r->checksum && !scan->stop)
+    {
+        StatStart(&start);
+        if (!scan->commit(scan, r))
+        {
+            scan->stop = TRUE;
+        }
+        StatStop(&scan->stats.commit, &start);
+        
+        AddFileLine(scan, job->dir, r->name, r->size, &r->date);
+    }
+    else
+    {
+        job->dir->partial = TRUE;
+    }
+    
+    ReleaseScanDir(scan, job->dir);
+    job->dir = NULL;
+    
+    // Bound what a crash can lose
+    if (scan->mw)
+    {
+        DateStamp(&now);
+        minute = now.ds_Days * 1440 + now.ds_Minute;
+        if (minute - scan->checkpoint >= SCAN_CHECKPOINT_MINUTES)
+        {
+            CheckpointManifest(scan->mw);
+            scan->checkpoint = minute;
+        }
+    }
+}
+
+static void PrintDeviceStats(struct ParWalk *pw)
+{
+    struct ParDevice *dev;
+    ULONG i, ticks;
+    
+    for (i = 0; i < pw->numDevices; i++)
+    {
+        dev = &pw->devices[i];
+        ticks = dev->ticks ? dev->ticks : 1;
+        
+        Printf("%-20s %ld workers, %ld dirs, %ld files, %ld KB in %ld.%02ld s (%ld KB/s, %ld steals)\n",
+               dev->name, dev->count, dev->dirs, dev->files, dev->bytes / 1024,
+               dev->ticks / TICKS_PER_SECOND,
+               (dev->ticks % TICKS_PER_SECOND) * 100 / TICKS_PER_SECOND,
+               (dev->bytes / 1024) * TICKS_PER_SECOND / ticks,
+               dev->steals);
+    }
+}
+
+// Returns FALSE if the scan stopped early, the manifest is then incomplete
+BOOL RunScan(struct Scan *scan, char **folders, BOOL recursive)
+{
+    struct ParWalk *pw;
+    struct ScanContext *ctx = NULL;
+    struct PipeStage *readers[PARWALK_MAX_DEVICES];
+    struct ScanStats readerStats[PARWALK_MAX_DEVICES];
+    struct ScanStats analyzerStats;
+    struct PipeStage *analyzer = NULL;
+    struct PipeStage *committer = NULL;
+    struct DateStamp now;
+    BOOL complete = FALSE;
+    BOOL ok;
+    ULONG i;
+    
+    if (!(pw = CreateParWalk(COMPONENT_PATTERN, ScanEvent, scan->perDevice)))
+    {
+        Printf("Error: Out of memory\n");
+        return FALSE;
+    }
+    
+    for (i = 0; folders[i]; i++)
+    {
+        if (!AddParWalkRoot(pw, folders[i]))
+        {
+            PrintFault(IoErr(), folders[i]);
+            DeleteParWalk(pw);
+            return FALSE;
+        }
+    }
+    
+    // Stages hash files; make sure none of them builds the CRC table
+    InitCRC32Table();
+    
+    // A reader per drive keeps every drive busy while the CPU hashes
+    memset(readers, 0, sizeof(readers));
+    memset(readerStats, 0, sizeof(readerStats));
+    memset(&analyzerStats, 0, sizeof(analyzerStats));
+    ok = (committer = StartPipeStage("Scan committer", CommitJob, scan, NULL)) &&
+         (analyzer = StartPipeStage("Scan analyzer", AnalyzeJob, &analyzerStats, committer));
+    for (i = 0; ok && i < pw->numDevices; i++)
+    {
+        ok = (readers[i] = StartPipeStage("Scan reader", ReadJob, &readerStats[i], analyzer)) != NULL;
+        if (ok) readers[i]->batch = OrderReads;
+    }
+    
+    if (ok && (ctx = AllocVec(pw->numWorkers * sizeof(struct ScanContext), MEMF_CLEAR)))
+    {
+        for (i = 0; i < pw->numWorkers; i++)
+        {
+            ctx[i].scan = scan;
+            ctx[i].reader = readers[pw->workers[i].device - pw->devices];
+            pw->workers[i].userData = &ctx[i];
+        }
+        
+        DateStamp(&now);
+        scan->checkpoint = now.ds_Days * 1440 + now.ds_Minute;
+        
+        complete = RunParWalk(pw, recursive) && !scan->stop;
+        scan->broken = pw->broken;
+        
+        // Every process kept its own counters
+        for (i = 0; i < pw->numWorkers; i++)
+        {
+            AddScanStats(&scan->stats, &ctx[i].stats);
+        }
+        for (i = 0; i < pw->numDevices; i++)
+        {
+            AddScanStats(&scan->stats, &readerStats[i]);
+        }
+        AddScanStats(&scan->stats, &analyzerStats);
+        FreeVec(ctx);
+        
+        if (!scan->quiet)
+        {
+            PrintDeviceStats(pw);
+        }
+    }
+    else
+    {
+        Printf("Error: Could not start the scan pipeline\n");
+    }
+    
+    // Every walker waited for its jobs, the stages are idle
+    for (i = 0; i < pw->numDevices; i++)
+    {
+        StopPipeStage(readers[i]);
+    }
+    StopPipeStage(analyzer);
+    StopPipeStage(committer);
+    
+    DeleteParWalk(pw);
+    return complete;
+}
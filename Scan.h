@@ -0,0 +1,93 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "ParWalk.h"
+#include "Pipeline.h"
+#include "Manifest.h"
+#include "Stats.h"
+#include "Classify.h"
+#include "Tuning.h"
+
+#define SCAN_DEFAULT_DEPTH 4                // Jobs in flight per walker
+#define SCAN_MAX_BUFFER    TUNE_SCAN_BUFFER // Larger files are hashed from disk
+#define SCAN_READ_BLOCK    TUNE_SCAN_BLOCK
+#define SCAN_CHECKPOINT_MINUTES 1           // Flush the manifest this often
+
+struct Scan;
+
+// What the pipeline learned about one file
+struct ScanResult {
+    const char *path;
+    const char *name;
+    ULONG size;
+    struct DateStamp date;
+    ULONG checksum;             // 0: the file could not be read
+    struct VersionInfo info;
+    BOOL haveVersion;
+    BOOL haveVerString;         // FALSE: info is 0.0 and the file date
+    LONG type;                  // FT_ from the name and the first bytes
+};
+
+// Called in the committer process, one file at a time. FALSE stops the scan.
+typedef BOOL (*ScanCommitFunc)(struct Scan *scan, struct ScanResult *result);
+
+// A directory lives until its last file is committed, then its manifest
+// group is written
+struct ScanDir {
+    LONG refs;
+    BOOL partial;               // Some files were not committed, no group
+    struct DateStamp date;
+    struct ManifestGroup group;
+    char path[1];               // Allocated to length
+};
+
+struct ScanJob {
+    struct PipeJob job;
+    struct ScanDir *dir;
+    char *path;
+    ULONG pathSize;
+    UBYTE *data;                // Whole file from the reader, NULL: hash from disk
+    BPTR lock;                  // Taken by the reader's batch, for OpenFromLock()
+    ULONG key;                  // Its fl_Key, the reader's read order
+    BOOL unreadable;
+    struct ScanResult result;
+};
+
+// Per walker state, used only in the walker's process
+struct ScanContext {
+    struct Scan *scan;
+    struct PipeStage *reader;   // Reader of our drive
+    struct ScanDir *dir;        // Directory being read
+    struct ManifestDir *old;    // Its record from the previous run
+    struct Manifest *from;      // Manifest old belongs to
+    struct MsgPort *port;       // Our jobs come back here
+    struct ScanJob *jobs;
+    struct MinList free;
+    LONG busy;                  // Jobs in the pipeline
+    struct timeval dirStart;
+    struct ScanStats stats;
+};
+
+// Walkers (one group per drive) feed every file that needs looking at
+// through a reader per drive, one analyzer and one committer. Each walker
+// owns depth jobs, so it stalls when the stages behind it fall behind.
+struct Scan {
+    ScanCommitFunc commit;
+    APTR userData;
+    struct Manifest *old;       // Previous run, NULL reads every file
+    struct Manifest *resume;    // Interrupted scan, consulted before old
+    struct ManifestWriter *mw;  // NULL: no manifest is written
+    LONG perDevice;             // Walkers per physical drive
+    LONG depth;                 // Jobs in flight per walker
+    BOOL stop;                  // Set by the committer
+    BOOL broken;                // Stopped by CTRL-C
+    BOOL quiet;                 // No drive report, Output() carries results
+    ULONG checkpoint;           // Minute of the last manifest flush
+    struct SignalSemaphore dirLock;  // Guards ScanDir refs and groups
+    struct ScanStats stats;     // Committer's own, all stages after RunScan()
+};
+
+void InitScan(struct Scan *scan, ScanCommitFunc commit, APTR userData);
+BOOL RunScan(struct Scan *scan, char **folders, BOOL recursive);
+
+#endif /* SCAN_H */
@@ -0,0 +1,307 @@
+#include "Shadow.h"
+
+#include <exec/memory.h>
+#include <dos/dosextens.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+#include <stdlib.h>
+
+void InitShadowIndex(struct ShadowIndex *idx)
+{
+    memset(idx, 0, sizeof(struct ShadowIndex));
+}
+
+void FreeShadowIndex(struct ShadowIndex *idx)
+{
+    struct Component *c, *next;
+    LONG i;
+    
+    for (i = 0; i < SHADOW_BUCKETS; i++)
+    {
+        for (c = idx->buckets[i]; c; c = next)
+        {
+            next = c->next;
+            FreeVec(c);
+        }
+        idx->buckets[i] = NULL;
+    }
+    
+    for (i = 0; i < idx->numRoots; i++)
+    {
+        FreeVec(idx->roots[i]);
+        idx->roots[i] = NULL;
+    }
+    idx->numRoots = 0;
+    idx->components = 0;
+}
+
+// Roots are stored by their full name, which is also how the walker
+// reports the paths below them
+static BOOL AddRootLock(struct ShadowIndex *idx, BPTR lock)
+{
+    char name[MAX_PATH];
+    LONG i;
+    
+    if (!NameFromLock(lock, name, sizeof(name)))
+        return FALSE;
+    
+    // An assign may list a directory that is also given on its own
+    for (i = 0; i < idx->numRoots; i++)
+    {
+        if (stricmp(idx->roots[i], name) == 0)
+            return TRUE;
+    }
+    
+    if (idx->numRoots == SHADOW_MAX_ROOTS)
+    {
+        SetIoErr(ERROR_NO_FREE_STORE);
+        return FALSE;
+    }
+    
+    if (!(idx->roots[idx->numRoots] = AllocVec(strlen(name) + 1, MEMF_ANY)))
+    {
+        SetIoErr(ERROR_NO_FREE_STORE);
+        return FALSE;
+    }
+    strcpy(idx->roots[idx->numRoots], name);
+    idx->numRoots++;
+    idx->roots[idx->numRoots] = NULL;
+    
+    return TRUE;
+}
+
+BOOL AddShadowRoot(struct ShadowIndex *idx, const char *path)
+{
+    struct DosList *dl;
+    struct AssignList *al;
+    BPTR locks[SHADOW_MAX_ROOTS];
+    char name[32];
+    LONG len = strlen(path);
+    LONG numLocks = 0;
+    LONG i;
+    BOOL ok = TRUE;
+    BPTR lock;
+    
+    if (len > 1 && len < sizeof(name) && strchr(path, ':') == path + len - 1)
+    {
+        strncpy(name, path, len - 1);
+        name[len - 1] = '\0';
+        
+        // Only copy the locks while the list is locked, names are
+        // resolved afterwards
+        dl = LockDosList(LDF_ASSIGNS | LDF_READ);
+        if ((dl = FindDosEntry(dl, name, LDF_ASSIGNS)) && dl->dol_Type == DLT_DIRECTORY)
+        {
+            if ((locks[numLocks] = DupLock(dl->dol_Lock)))
+                numLocks++;
+            
+            for (al = dl->dol_misc.dol_assign.dol_List;
+                 al && numLocks < SHADOW_MAX_ROOTS;
+                 al = al->al_Next)
+            {
+                if ((locks[numLocks] = DupLock(al->al_Lock)))
+                    numLocks++;
+            }
+        }
+        UnLockDosList(LDF_ASSIGNS | LDF_READ);
+        
+        if (numLocks > 0)
+        {
+            for (i = 0; i < numLocks; i++)
+            {
+                if (ok) ok = AddRootLock(idx, locks[i]);
+                UnLock(locks[i]);
+            }
+            return ok;
+        }
+    }
+    
+    if (!(lock = Lock(path, ACCESS_READ)))
+        return FALSE;
+    
+    ok = AddRootLock(idx, lock);
+    UnLock(lock);
+    return ok;
+}
+
+static BOOL IsBelow(const char *path, const char *root)
+{
+    ULONG len = strlen(root);
+    
+    return len < strlen(path) && strnicmp(path, root, len) == 0 &&
+           (root[len - 1] == ':' || path[len] == '/');
+}
+
+char **ShadowWalkRoots(struct ShadowIndex *idx, BOOL recursive)
+{
+    LONG i, j, n = 0;
+    
+    if (!recursive)
+        return idx->roots;
+    
+    for (i = 0; i < idx->numRoots; i++)
+    {
+        for (j = 0; j < idx->numRoots; j++)
+        {
+            if (j != i && IsBelow(idx->roots[i], idx->roots[j]))
+                break;
+        }
+        if (j == idx->numRoots)
+            idx->walk[n++] = idx->roots[i];
+    }
+    idx->walk[n] = NULL;
+    
+    return idx->walk;
+}
+
+// The innermost root a path lies under decides its search position
+static LONG RootOrder(struct ShadowIndex *idx, const char *path)
+{
+    LONG best = idx->numRoots;
+    ULONG bestLen = 0;
+    ULONG len;
+    LONG i;
+    
+    for (i = 0; i < idx->numRoots; i++)
+    {
+        len = strlen(idx->roots[i]);
+        if (len > bestLen && IsBelow(path, idx->roots[i]))
+        {
+            best = i;
+            bestLen = len;
+        }
+    }
+    return best;
+}
+
+BOOL AddComponent(struct ShadowIndex *idx, const struct ScanResult *r)
+{
+    struct Component *c;
+    ULONG hash = HashName(r->name);
+    struct Component **bucket = &idx->buckets[hash % SHADOW_BUCKETS];
+    
+    // Overlapping roots reach the same file twice
+    for (c = *bucket; c; c = c->next)
+    {
+        if (c->hash == hash && stricmp(c->path, r->path) == 0)
+            return TRUE;
+    }
+    
+    if (!(c = AllocVec(sizeof(struct Component) + strlen(r->path), MEMF_CLEAR)))
+        return FALSE;
+    
+    c->hash = hash;
+    c->checksum = r->checksum;
+    c->size = r->size;
+    c->version = r->haveVersion ? r->info.version : 0;
+    c->revision = r->haveVersion ? r->info.revision : 0;
+    c->order = RootOrder(idx, r->path);
+    strcpy(c->path, r->path);
+    
+    c->next = *bucket;
+    *bucket = c;
+    idx->components++;
+    return TRUE;
+}
+
+static int CompareOrder(const void *a, const void *b)
+{
+    const struct Component *ca = *(const struct Component **)a;
+    const struct Component *cb = *(const struct Component **)b;
+    
+    if (ca->order != cb->order) return (ca->order < cb->order) ? -1 : 1;
+    return stricmp(ca->path, cb->path);
+}
+
+// First the copy that loads, then the others: identical copies only waste
+// space, different ones are what actually gets shadowed
+static void ReportName(struct Component **copies, ULONG count, BOOL quiet)
+{
+    struct Component *first = copies[0];
+    ULONG different = 0;
+    ULONG i;
+    
+    for (i = 1; i < count; i++)
+    {
+        if (copies[i]->checksum != first->checksum)
+            different++;
+    }
+    
+    if (quiet && different == 0)
+        return;
+    
+    Printf("\n%s: %ld copies, %ld different\n", (LONG)FilePart(first->path), count, different);
+    Printf("  loads     %s v%ld.%ld (%08lx)\n", (LONG)first->path,
+           (LONG)first->version, (LONG)first->revision, first->checksum);
+    
+    for (i = 1; i < count; i++)
+    {
+        Printf("  %-9s %s v%ld.%ld (%08lx)\n",
+               (LONG)(copies[i]->checksum == first->checksum ? "duplicate" : "shadowed"),
+               (LONG)copies[i]->path,
+               (LONG)copies[i]->version, (LONG)copies[i]->revision, copies[i]->checksum);
+    }
+}
+
+ULONG ReportShadows(struct ShadowIndex *idx, BOOL quiet)
+{
+    struct Component **copies = NULL;
+    struct Component *c, *d;
+    ULONG maxCopies = 0;
+    ULONG count, names = 0, wasted = 0;
+    LONG i;
+    
+    for (i = 0; i < SHADOW_BUCKETS; i++)
+    {
+        for (c = idx->buckets[i]; c; c = c->next)
+        {
+            if (c->reported)
+                continue;
+            
+            // Gather every copy of this name from the bucket
+            count = 0;
+            for (d = c; d; d = d->next)
+            {
+                if (d->hash == c->hash && stricmp(FilePart(d->path), FilePart(c->path)) == 0)
+                {
+                    if (count == maxCopies)
+                    {
+                        struct Component **more;
+                        
+                        if (!(more = AllocVec((maxCopies + 16) * sizeof(struct Component *), MEMF_ANY)))
+                            break;
+                        if (copies)
+                        {
+                            CopyMem(copies, more, maxCopies * sizeof(struct Component *));
+                            FreeVec(copies);
+                        }
+                        copies = more;
+                        maxCopies += 16;
+                    }
+                    copies[count++] = d;
+                    d->reported = TRUE;
+                }
+            }
+            
+            if (count > 1)
+            {
+                qsort(copies, count, sizeof(struct Component *), CompareOrder);
+                ReportName(copies, count, quiet);
+                names++;
+                
+                for (d = copies[0]; count > 1; count--)
+                {
+                    if (copies[count - 1]->checksum == d->checksum)
+                        wasted += copies[count - 1]->size;
+                }
+            }
+        }
+    }
+    
+    if (copies) FreeVec(copies);
+    
+    Printf("\n%ld components, %ld found more than once, %ld KB in identical copies\n",
+           idx->components, names, wasted / 1024);
+    return names;
+}
@@ -0,0 +1,50 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include "Scan.h"
+
+#define SHADOW_BUCKETS   256
+#define SHADOW_MAX_ROOTS 32
+
+// One copy of a component found by the scan
+struct Component {
+    struct Component *next;     // Same bucket
+    ULONG hash;                 // HashName() of the file name
+    ULONG checksum;
+    ULONG size;
+    UWORD version;
+    UWORD revision;
+    LONG order;                 // Search position of the root it lies under
+    BOOL reported;
+    char path[1];               // Allocated to length
+};
+
+// Copies indexed by name. Roots are kept in search order, so the copy
+// under the earliest root is the one that gets loaded.
+struct ShadowIndex {
+    struct Component *buckets[SHADOW_BUCKETS];
+    char *roots[SHADOW_MAX_ROOTS + 1];  // NULL terminated, for RunScan()
+    char *walk[SHADOW_MAX_ROOTS + 1];   // Those not below another, see ShadowWalkRoots()
+    LONG numRoots;
+    ULONG components;
+};
+
+void InitShadowIndex(struct ShadowIndex *idx);
+void FreeShadowIndex(struct ShadowIndex *idx);
+
+// A bare "NAME:" that is a multi-directory assign adds each of its
+// directories in assign order
+BOOL AddShadowRoot(struct ShadowIndex *idx, const char *path);
+
+// The roots to pass to RunScan(). A recursive scan leaves out roots that
+// lie below another root, which would walk and hash them twice; roots
+// still gives the search order of everything found.
+char **ShadowWalkRoots(struct ShadowIndex *idx, BOOL recursive);
+
+// Called from the scan committer
+BOOL AddComponent(struct ShadowIndex *idx, const struct ScanResult *r);
+
+// Lists every name found more than once; returns the number of such names
+ULONG ReportShadows(struct ShadowIndex *idx, BOOL quiet);
+
+#endif /* SHADOW_H */
@@ -2,10 +2,12 @@
 #include <proto/dos.h>
 #include <proto/utility.h>
 #include <string.h>
+#include <stdlib.h>
 #include <ctype.h>
 
-// CRC-32-IEEE 802.3 polynomial (0xEDB88320)
-static ULONG crc32_table[256];
+// CRC-32-IEEE 802.3 polynomial (0xEDB88320). With TUNE_CRC_SLICES 4 the
+// further tables advance the CRC by 2, 3 and 4 bytes at once.
+static ULONG crc32_table[TUNE_CRC_SLICES][256];
 static BOOL crc_table_initialized = FALSE;
 
 void InitCRC32Table(void)
@@ -23,30 +25,71 @@ void InitCRC32Table(void)
                 rem >>= 1;
             }
         }
-        crc32_table[i] = rem;
+        crc32_table[0][i] = rem;
+    }
+    
+    for(j = 1; j < TUNE_CRC_SLICES; j++) {
+        for(i = 0; i < 256; i++) {
+            rem = crc32_table[j - 1][i];
+            crc32_table[j][i] = (rem >> 8) ^ crc32_table[0][rem & 0xFF];
+        }
     }
     crc_table_initialized = TRUE;
 }
 
+#define CRC_BYTE(crc, p) ((crc) = ((crc) >> 8) ^ crc32_table[0][((crc) & 0xFF) ^ *(p)++])
+
+// Running CRC over a buffer; start with 0xFFFFFFFF and invert the result.
+// The kernel is picked per build variant, see Tuning.h.
+ULONG UpdateCRC32(ULONG crc, const UBYTE *buffer, ULONG length)
+{
+    if (!crc_table_initialized) {
+        InitCRC32Table();
+    }
+    
+#if TUNE_CRC_SLICES == 4
+    // Four bytes per step; assembled byte by byte, so any alignment works
+    while (length >= 4)
+    {
+        crc ^= (ULONG)buffer[0] | ((ULONG)buffer[1] << 8) |
+               ((ULONG)buffer[2] << 16) | ((ULONG)buffer[3] << 24);
+        crc = crc32_table[3][crc & 0xFF] ^
+              crc32_table[2][(crc >> 8) & 0xFF] ^
+              crc32_table[1][(crc >> 16) & 0xFF] ^
+              crc32_table[0][crc >> 24];
+        buffer += 4;
+        length -= 4;
+    }
+#elif TUNE_CRC_UNROLL == 4
+    while (length >= 4)
+    {
+        CRC_BYTE(crc, buffer);
+        CRC_BYTE(crc, buffer);
+        CRC_BYTE(crc, buffer);
+        CRC_BYTE(crc, buffer);
+        length -= 4;
+    }
+#endif
+    
+    while (length--)
+    {
+        CRC_BYTE(crc, buffer);
+    }
+    return crc;
+}
+
 ULONG CalculateChecksum(const char *filename)
 {
     BPTR fh;
     ULONG crc = 0xFFFFFFFF;
     UBYTE buffer[BUFFER_SIZE];
     LONG bytes_read;
-    LONG i;
-    
-    if (!crc_table_initialized) {
-        InitCRC32Table();
-    }
     
     if ((fh = Open(filename, MODE_OLDFILE)))
     {
         while ((bytes_read = Read(fh, buffer, BUFFER_SIZE)) > 0)
         {
-            for (i = 0; i < bytes_read; i++) {
-                crc = (crc >> 8) ^ crc32_table[(crc & 0xFF) ^ buffer[i]];
-            }
+            crc = UpdateCRC32(crc, buffer, bytes_read);
         }
         Close(fh);
         // Final XOR value
@@ -214,14 +257,93 @@ BOOL CheckFileVersion(const char *filename, struct VersionInfo *info)
     return found;
 }
 
-BOOL LoadDatabaseEntry(const char *line, ULONG lineNum)
+void InitVersionScan(struct VersionScan *vs)
+{
+    vs->len = 0;
+    vs->state = VS_SEARCHING;
+}
+
+static void CheckVersionLine(struct VersionScan *vs, const char *filename,
+                             struct VersionInfo *info)
+{
+    vs->line[vs->len] = '\0';
+    
+    if (strnicmp(vs->line, "$VER:", 5) == 0)
+    {
+        if (ParseVersionString(vs->line, info))
+        {
+            vs->state = VS_FOUND;
+        }
+        else
+        {
+            Printf("Warning: Invalid version string in %s\n", filename);
+            vs->state = VS_INVALID;
+        }
+    }
+}
+
+// Lines are split where FGets() with a 256 byte buffer would split them.
+// Only lines starting with '$' are copied.
+void FeedVersionScan(struct VersionScan *vs, const char *filename,
+                     const UBYTE *buffer, ULONG length, struct VersionInfo *info)
+{
+    const UBYTE *end = buffer + length;
+    UBYTE c;
+    
+    while (buffer < end && vs->state == VS_SEARCHING)
+    {
+        c = *buffer++;
+        
+        if (vs->len == 0)
+        {
+            vs->copy = (c == '$');
+        }
+        if (vs->copy)
+        {
+            vs->line[vs->len] = c;
+        }
+        vs->len++;
+        
+        if (c == '\n' || vs->len == sizeof(vs->line) - 1)
+        {
+            if (vs->copy)
+            {
+                CheckVersionLine(vs, filename, info);
+            }
+            vs->len = 0;
+        }
+    }
+}
+
+// The last line may lack a newline, FGets() returns it all the same
+BOOL EndVersionScan(struct VersionScan *vs, const char *filename, struct VersionInfo *info)
+{
+    if (vs->state == VS_SEARCHING && vs->len > 0 && vs->copy)
+    {
+        CheckVersionLine(vs, filename, info);
+    }
+    return vs->state == VS_FOUND;
+}
+
+// Version string of a file already in memory. Lines are cut the way
+// CheckFileVersion() reads them with FGets(), so both find the same string.
+BOOL CheckBufferVersion(const char *filename, const UBYTE *buffer, ULONG length,
+                        struct VersionInfo *info)
+{
+    struct VersionScan vs;
+    
+    InitVersionScan(&vs);
+    FeedVersionScan(&vs, filename, buffer, length, info);
+    return EndVersionScan(&vs, filename, info);
+}
+
+BOOL LoadDatabaseEntry(const char *line, ULONG lineNum, struct ChecksumEntry *entry)
 {
     LONG separators = 0;
     const char *p;
-    struct ChecksumEntry entry;
     char *endptr;
     
-    if (strlen(line) > 512)
+    if (strlen(line) > MAX_DB_LINE)
     {
         Printf("Error: Line %ld too long\n", lineNum);
         return FALSE;
@@ -238,7 +360,7 @@ BOOL LoadDatabaseEntry(const char *line, ULONG lineNum)
     }
     
     // Parse checksum (hex)
-    entry.checksum = strtoul(line, &endptr, 16);
+    entry->checksum = strtoul(line, &endptr, 16);
     if (*endptr != '|')
     {
         Printf("Error: Invalid checksum at line %ld\n", lineNum);
@@ -246,7 +368,7 @@ BOOL LoadDatabaseEntry(const char *line, ULONG lineNum)
     }
     
     // Parse filesize
-    entry.filesize = strtoul(endptr + 1, &endptr, 10);
+    entry->filesize = strtoul(endptr + 1, &endptr, 10);
     if (*endptr != '|')
     {
         Printf("Error: Invalid filesize at line %ld\n", lineNum);
@@ -256,23 +378,23 @@ BOOL LoadDatabaseEntry(const char *line, ULONG lineNum)
     // Parse filename
     p = endptr + 1;
     endptr = strchr(p, '|');
-    if (!endptr || (endptr - p) >= sizeof(entry.filename))
+    if (!endptr || (endptr - p) >= sizeof(entry->filename))
     {
         Printf("Error: Invalid filename at line %ld\n", lineNum);
         return FALSE;
     }
-    strncpy(entry.filename, p, endptr - p);
-    entry.filename[endptr - p] = '\0';
+    strncpy(entry->filename, p, endptr - p);
+    entry->filename[endptr - p] = '\0';
     
     // Parse version.revision
     p = endptr + 1;
-    entry.version = (UWORD)strtoul(p, &endptr, 10);
+    entry->version = (UWORD)strtoul(p, &endptr, 10);
     if (*endptr != '.')
     {
         Printf("Error: Invalid version format at line %ld\n", lineNum);
         return FALSE;
     }
-    entry.revision = (UWORD)strtoul(endptr + 1, &endptr, 10);
+    entry->revision = (UWORD)strtoul(endptr + 1, &endptr, 10);
     if (*endptr != '|')
     {
         Printf("Error: Invalid revision format at line %ld\n", lineNum);
@@ -280,7 +402,7 @@ BOOL LoadDatabaseEntry(const char *line, ULONG lineNum)
     }
     
     // Parse date
-    entry.date = strtoul(endptr + 1, &endptr, 10);
+    entry->date = strtoul(endptr + 1, &endptr, 10);
     if (*endptr != '|')
     {
         Printf("Error: Invalid date at line %ld\n", lineNum);
@@ -291,13 +413,26 @@ BOOL LoadDatabaseEntry(const char *line, ULONG lineNum)
     p = endptr + 1;
     endptr = strchr(p, '\n');
     if (!endptr) endptr = p + strlen(p);
-    if ((endptr - p) >= sizeof(entry.origin))
+    if ((endptr - p) >= sizeof(entry->origin))
     {
         Printf("Error: Origin too long at line %ld\n", lineNum);
         return FALSE;
     }
-    strncpy(entry.origin, p, endptr - p);
-    entry.origin[endptr - p] = '\0';
+    strncpy(entry->origin, p, endptr - p);
+    entry->origin[endptr - p] = '\0';
     
     return TRUE;
-} 
\ No newline at end of file
+}
+
+// Case-insensitive filename hash, orders and indexes database records
+ULONG HashName(const char *name)
+{
+    ULONG hash = 5381;
+    
+    while (*name)
+    {
+        hash = ((hash << 5) + hash) + (UBYTE)tolower((UBYTE)*name);
+        name++;
+    }
+    return hash;
+}
@@ -4,10 +4,15 @@
 #include <exec/types.h>
 #include <libraries/dos.h>
 #include <proto/dos.h>
+#include "Tuning.h"
 
 #define CHECKSUM_DB "PROGDIR:QuickUpdate.db"
-#define BUFFER_SIZE 8192
+#define BUFFER_SIZE TUNE_BUFFER_SIZE
 #define MAX_PATH 256
+#define MAX_DB_LINE 512
+
+// File names CreateDB and QuickUpdate treat as system components
+#define COMPONENT_PATTERN "#?.(library|device|datatype|class|gadget|resource|mcc|mcp)"
 
 // Version information structure
 struct VersionInfo {
@@ -17,6 +22,18 @@ struct VersionInfo {
     char origin[64];
 };
 
+// Version string search over a file read in pieces
+#define VS_SEARCHING 0
+#define VS_FOUND     1
+#define VS_INVALID   2
+
+struct VersionScan {
+    char line[256];
+    ULONG len;          // Bytes of the current line seen
+    BOOL copy;          // The line starts with '$', keep it
+    LONG state;
+};
+
 // Database entry structure
 struct ChecksumEntry {
     ULONG checksum;
@@ -28,15 +45,20 @@ struct ChecksumEntry {
     char origin[64];
 };
 
-// CRC32 lookup table
-extern const ULONG crc32_table[256];
-
 // Shared function prototypes
 ULONG CalculateChecksum(const char *filename);
+ULONG UpdateCRC32(ULONG crc, const UBYTE *buffer, ULONG length);
 void InitCRC32Table(void);  // Internal use only
 BOOL ParseVersionString(const char *verStr, struct VersionInfo *info);
 LONG CompareVersions(const struct VersionInfo *current, const struct VersionInfo *new);
 BOOL CheckFileVersion(const char *filename, struct VersionInfo *info);
-BOOL LoadDatabaseEntry(const char *line, ULONG lineNum);
+BOOL CheckBufferVersion(const char *filename, const UBYTE *buffer, ULONG length,
+                        struct VersionInfo *info);
+void InitVersionScan(struct VersionScan *vs);
+void FeedVersionScan(struct VersionScan *vs, const char *filename,
+                     const UBYTE *buffer, ULONG length, struct VersionInfo *info);
+BOOL EndVersionScan(struct VersionScan *vs, const char *filename, struct VersionInfo *info);
+BOOL LoadDatabaseEntry(const char *line, ULONG lineNum, struct ChecksumEntry *entry);
+ULONG HashName(const char *name);
 
 #endif /* SHARED_H */ 
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "Stats.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <proto/timer.h>
+#include <string.h>
+#include <stdio.h>
+
+struct Device *TimerBase = NULL;
+static struct timerequest timerReq;
+
+// Without timer.device the timers simply stay at zero
+BOOL OpenStatsTimer(void)
+{
+    if (!TimerBase)
+    {
+        memset(&timerReq, 0, sizeof(timerReq));
+        if (OpenDevice(TIMERNAME, UNIT_MICROHZ, (struct IORequest *)&timerReq, 0) == 0)
+        {
+            TimerBase = timerReq.tr_node.io_Device;
+        }
+    }
+    return TimerBase ? TRUE : FALSE;
+}
+
+void CloseStatsTimer(void)
+{
+    if (TimerBase)
+    {
+        CloseDevice((struct IORequest *)&timerReq);
+        TimerBase = NULL;
+    }
+}
+
+void StatStart(struct timeval *start)
+{
+    if (TimerBase)
+    {
+        GetSysTime(start);
+    }
+    else
+    {
+        start->tv_secs = start->tv_micro = 0;
+    }
+}
+
+void StatStop(struct StatTimer *t, const struct timeval *start)
+{
+    struct timeval now;
+    LONG secs, micro;
+    
+    t->count++;
+    
+    if (!TimerBase)
+        return;
+    
+    GetSysTime(&now);
+    secs = now.tv_secs - start->tv_secs;
+    micro = now.tv_micro - start->tv_micro;
+    if (micro < 0)
+    {
+        micro += 1000000;
+        secs--;
+    }
+    
+    t->micro += micro;
+    t->secs += secs + t->micro / 1000000;
+    t->micro %= 1000000;
+}
+
+static void AddTimer(struct StatTimer *total, const struct StatTimer *part)
+{
+    total->count += part->count;
+    total->micro += part->micro;
+    total->secs += part->secs + total->micro / 1000000;
+    total->micro %= 1000000;
+}
+
+void AddScanStats(struct ScanStats *total, const struct ScanStats *part)
+{
+    total->entriesSeen += part->entriesSeen;
+    total->exAllCalls += part->exAllCalls;
+    total->filesMatched += part->filesMatched;
+    total->dirsRead += part->dirsRead;
+    total->dirHits += part->dirHits;
+    total->dirMisses += part->dirMisses;
+    total->fileHits += part->fileHits;
+    total->fileMisses += part->fileMisses;
+    total->filesRead += part->filesRead;
+    total->filesHashed += part->filesHashed;
+    total->bytesHashed += part->bytesHashed;
+    AddTimer(&total->enumerate, &part->enumerate);
+    AddTimer(&total->stall, &part->stall);
+    AddTimer(&total->read, &part->read);
+    AddTimer(&total->hash, &part->hash);
+    AddTimer(&total->parse, &part->parse);
+    AddTimer(&total->commit, &part->commit);
+    AddTimer(&total->load, &part->load);
+    AddTimer(&total->save, &part->save);
+    AddTimer(&total->total, &part->total);
+}
+
+static ULONG Millis(const struct StatTimer *t)
+{
+    return t->secs * 1000 + t->micro / 1000;
+}
+
+// Walker time without the time spent waiting for the pipeline
+static ULONG EnumerateMillis(const struct ScanStats *s)
+{
+    ULONG all = Millis(&s->enumerate);
+    ULONG stall = Millis(&s->stall);
+    
+    return all > stall ? all - stall : 0;
+}
+
+static void PrintTimer(const char *name, ULONG ms, ULONG count)
+{
+    Printf("  %-12s %6ld.%03ld s  %6ld\n", name, ms / 1000, ms % 1000, count);
+}
+
+void PrintScanStats(const struct ScanStats *s)
+{
+    ULONG hashMs = Millis(&s->hash);
+    
+    Printf("\nScan statistics:\n");
+    Printf("  Entries seen      %ld (%ld ExAll calls)\n", s->entriesSeen, s->exAllCalls);
+    Printf("  Files matched     %ld\n", s->filesMatched);
+    Printf("  Directories read  %ld\n", s->dirsRead);
+    Printf("  Manifest dirs     %ld hits, %ld misses\n", s->dirHits, s->dirMisses);
+    Printf("  Manifest files    %ld hits, %ld misses\n", s->fileHits, s->fileMisses);
+    Printf("  Files read        %ld whole\n", s->filesRead);
+    Printf("  Files hashed      %ld, %ld KB", s->filesHashed, s->bytesHashed / 1024);
+    if (hashMs > 0)
+    {
+        Printf(" (%ld KB/s)", (s->bytesHashed / 1024) * 1000 / hashMs);
+    }
+    Printf("\n\n  %-12s %10s  %6s\n", "Stage", "Time", "Count");
+    PrintTimer("Enumerate", EnumerateMillis(s), s->enumerate.count);
+    PrintTimer("Stalled", Millis(&s->stall), s->stall.count);
+    PrintTimer("Read", Millis(&s->read), s->read.count);
+    PrintTimer("Hash", hashMs, s->hash.count);
+    PrintTimer("Parse", Millis(&s->parse), s->parse.count);
+    PrintTimer("Commit", Millis(&s->commit), s->commit.count);
+    PrintTimer("Load DB", Millis(&s->load), s->load.count);
+    PrintTimer("Save DB", Millis(&s->save), s->save.count);
+    PrintTimer("Total", Millis(&s->total), s->total.count);
+}
+
+// Append one line of key=value pairs, so runs on different machines and
+// settings can be compared with any text tool
+BOOL WriteStatsRecord(const char *filename, const struct ScanStats *s, const char *settings)
+{
+    struct DateStamp now;
+    char line[640];
+    BPTR fh;
+    LONG len;
+    BOOL success = FALSE;
+    
+    if (!(fh = Open(filename, MODE_READWRITE)))
+        return FALSE;
+    
+    DateStamp(&now);
+    
+    len = sprintf(line,
+                  "time=%lu %.200s seen=%lu exall=%lu matched=%lu dirs=%lu "
+                  "dirhits=%lu dirmisses=%lu filehits=%lu filemisses=%lu "
+                  "read=%lu hashed=%lu bytes=%lu enum_ms=%lu stall_ms=%lu read_ms=%lu "
+                  "hash_ms=%lu parse_ms=%lu commit_ms=%lu load_ms=%lu save_ms=%lu total_ms=%lu\n",
+                  (ULONG)now.ds_Days * 86400 + now.ds_Minute * 60 + now.ds_Tick / TICKS_PER_SECOND,
+                  settings,
+                  s->entriesSeen, s->exAllCalls, s->filesMatched, s->dirsRead,
+                  s->dirHits, s->dirMisses, s->fileHits, s->fileMisses,
+                  s->filesRead, s->filesHashed, s->bytesHashed,
+                  EnumerateMillis(s), Millis(&s->stall), Millis(&s->read),
+                  Millis(&s->hash), Millis(&s->parse), Millis(&s->commit),
+                  Millis(&s->load), Millis(&s->save), Millis(&s->total));
+    
+    if (Seek(fh, 0, OFFSET_END) != -1 && Write(fh, line, len) == len)
+    {
+        success = TRUE;
+    }
+    
+    if (!Close(fh))
+    {
+        success = FALSE;
+    }
+    return success;
+}
@@ -0,0 +1,47 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <exec/types.h>
+#include <devices/timer.h>
+
+// Accumulated time of one activity
+struct StatTimer {
+    ULONG secs;
+    ULONG micro;
+    ULONG count;
+};
+
+// Counters and timers of one CreateDB run. Every process of the scan
+// fills its own copy; they are added up when the scan is over.
+struct ScanStats {
+    ULONG entriesSeen;          // Directory entries ExAll() returned
+    ULONG exAllCalls;
+    ULONG filesMatched;         // Passed the component pattern
+    ULONG dirsRead;
+    ULONG dirHits;              // Manifest: directory unchanged, not read
+    ULONG dirMisses;
+    ULONG fileHits;             // Manifest: file unchanged, not hashed
+    ULONG fileMisses;
+    ULONG filesRead;            // Loaded whole by a reader
+    ULONG filesHashed;
+    ULONG bytesHashed;
+    struct StatTimer enumerate; // Walkers, including stalls
+    struct StatTimer stall;     // Walkers waiting for a free job
+    struct StatTimer read;
+    struct StatTimer hash;
+    struct StatTimer parse;
+    struct StatTimer commit;
+    struct StatTimer load;      // Reading the existing database
+    struct StatTimer save;
+    struct StatTimer total;
+};
+
+BOOL OpenStatsTimer(void);
+void CloseStatsTimer(void);
+void StatStart(struct timeval *start);
+void StatStop(struct StatTimer *t, const struct timeval *start);
+void AddScanStats(struct ScanStats *total, const struct ScanStats *part);
+void PrintScanStats(const struct ScanStats *s);
+BOOL WriteStatsRecord(const char *filename, const struct ScanStats *s, const char *settings);
+
+#endif /* STATS_H */
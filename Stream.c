@@ -0,0 +1,155 @@
+#include "Stream.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+#include <stdio.h>
+
+struct ScanStream *OpenScanStream(const char *name, const char *format, const char *origin)
+{
+    struct ScanStream *s;
+    LONG type = STREAM_NDJSON;
+    
+    if (format)
+    {
+        if (stricmp(format, "DB") == 0)
+        {
+            type = STREAM_DBLINE;
+        }
+        else if (stricmp(format, "NDJSON") != 0)
+        {
+            SetIoErr(ERROR_BAD_TEMPLATE);
+            return NULL;
+        }
+    }
+    
+    if (!(s = AllocVec(sizeof(struct ScanStream), MEMF_CLEAR)))
+    {
+        SetIoErr(ERROR_NO_FREE_STORE);
+        return NULL;
+    }
+    
+    s->format = type;
+    s->origin = origin ? origin : "";
+    
+    // Output() follows shell redirection, so the stream can be piped
+    if (strcmp(name, "*") == 0)
+    {
+        s->fh = Output();
+    }
+    else if ((s->fh = Open(name, MODE_NEWFILE)))
+    {
+        s->own = TRUE;
+        SetVBuf(s->fh, NULL, BUF_FULL, 8192);
+    }
+    else
+    {
+        FreeVec(s);
+        return NULL;
+    }
+    
+    return s;
+}
+
+// JSON wants UTF-8; Amiga names are Latin-1, whose codes are the
+// Unicode ones, so everything outside ASCII is written as \u00XX
+static BOOL PutJSONString(BPTR fh, const char *str)
+{
+    char buffer[128];
+    LONG len = 0;
+    UBYTE c;
+    
+    buffer[len++] = '"';
+    while ((c = (UBYTE)*str++))
+    {
+        if (len > sizeof(buffer) - 8)
+        {
+            if (FWrite(fh, buffer, 1, len) != len)
+                return FALSE;
+            len = 0;
+        }
+        
+        if (c == '"' || c == '\\')
+        {
+            buffer[len++] = '\\';
+            buffer[len++] = c;
+        }
+        else if (c < 0x20 || c >= 0x7F)
+        {
+            len += sprintf(buffer + len, "\\u%04x", (ULONG)c);
+        }
+        else
+        {
+            buffer[len++] = c;
+        }
+    }
+    buffer[len++] = '"';
+    
+    return FWrite(fh, buffer, 1, len) == len;
+}
+
+BOOL WriteScanRecord(struct ScanStream *s, const struct ScanResult *r)
+{
+    char line[MAX_DB_LINE + 1];
+    BOOL ok;
+    
+    if (s->error)
+        return FALSE;
+    
+    if (s->format == STREAM_DBLINE)
+    {
+        // Same line as the database, the name may be cut to fit
+        sprintf(line, "%08lx|%lu|%.107s|%lu.%lu|%lu|%.63s\n",
+                r->checksum, r->size, r->name,
+                (ULONG)r->info.version, (ULONG)r->info.revision, r->info.date,
+                s->origin);
+        ok = FPuts(s->fh, line) != -1;
+    }
+    else
+    {
+        ok = FPuts(s->fh, "{\"path\":") != -1 && PutJSONString(s->fh, r->path);
+        if (ok)
+        {
+            if (r->haveVerString)
+            {
+                sprintf(line, ",\"size\":%lu,\"crc\":\"%08lx\",\"version\":%lu,\"revision\":%lu,\"date\":%lu,\"origin\":",
+                        r->size, r->checksum,
+                        (ULONG)r->info.version, (ULONG)r->info.revision, r->info.date);
+            }
+            else
+            {
+                sprintf(line, ",\"size\":%lu,\"crc\":\"%08lx\",\"version\":null,\"revision\":null,\"date\":null,\"origin\":",
+                        r->size, r->checksum);
+            }
+            ok = FPuts(s->fh, line) != -1 && PutJSONString(s->fh, s->origin) &&
+                 FPuts(s->fh, "}\n") != -1;
+        }
+    }
+    
+    if (!ok)
+    {
+        s->error = TRUE;
+        return FALSE;
+    }
+    
+    s->records++;
+    return TRUE;
+}
+
+BOOL CloseScanStream(struct ScanStream *s)
+{
+    BOOL success = !s->error;
+    
+    if (s->own)
+    {
+        if (!Close(s->fh)) success = FALSE;
+    }
+    else
+    {
+        Flush(s->fh);
+    }
+    
+    FreeVec(s);
+    return success;
+}
@@ -0,0 +1,25 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "Scan.h"
+
+#define STREAM_NDJSON 0     // One JSON object per line
+#define STREAM_DBLINE 1     // CHECKSUM|FILESIZE|FILENAME|VERSION.REVISION|DATE|ORIGIN
+
+// Scan results written as they are committed, nothing is kept in memory.
+// Records come in pipeline order; sort them outside if order matters.
+struct ScanStream {
+    BPTR fh;
+    BOOL own;               // Opened by us, "*" writes to Output()
+    LONG format;
+    const char *origin;
+    ULONG records;
+    BOOL error;
+};
+
+// format is "NDJSON" (default) or "DB"; NULL with IoErr() set on failure
+struct ScanStream *OpenScanStream(const char *name, const char *format, const char *origin);
+BOOL WriteScanRecord(struct ScanStream *s, const struct ScanResult *r);
+BOOL CloseScanStream(struct ScanStream *s);
+
+#endif /* STREAM_H */
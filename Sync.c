@@ -0,0 +1,358 @@
+#include "Sync.h"
+
+#include <exec/memory.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <string.h>
+
+static BOOL SignatureName(const char *path, char *buffer)
+{
+    if (strlen(path) + strlen(SYNC_SUFFIX) >= MAX_PATH)
+        return FALSE;
+    
+    strcpy(buffer, path);
+    strcat(buffer, SYNC_SUFFIX);
+    return TRUE;
+}
+
+void FreeSignature(struct Signature *sig)
+{
+    if (sig->blocks) FreeVec(sig->blocks);
+    sig->blocks = NULL;
+}
+
+static BOOL AllocBlocks(struct Signature *sig)
+{
+    // One spare entry, so an empty file still gets an array
+    sig->blocks = AllocVec((sig->header.blocks + 1) * sizeof(struct SyncBlock), MEMF_ANY);
+    return sig->blocks != NULL;
+}
+
+// The file is read through the engine's first buffer, cut down to whole
+// blocks, so no block straddles two reads
+BOOL SignFile(struct CopyEngine *ce, const char *path, struct Signature *sig)
+{
+    struct FileInfoBlock *fib;
+    struct RollSum rs;
+    UBYTE *buffer = ce->buffers[0].data;
+    ULONG chunk = ce->bufferSize - ce->bufferSize % SYNC_BLOCK;
+    ULONG crc = 0xFFFFFFFF;
+    ULONG size = 0, block = 0;
+    ULONG i, n;
+    LONG got = 0;
+    BOOL ok = FALSE;
+    BPTR fh;
+    
+    memset(sig, 0, sizeof(*sig));
+    if (!(fh = Open(path, MODE_OLDFILE)))
+        return FALSE;
+    
+    if ((fib = AllocDosObject(DOS_FIB, NULL)))
+    {
+        if (ExamineFH(fh, fib))
+        {
+            sig->header.magic = SYNC_MAGIC;
+            sig->header.size = fib->fib_Size;
+            sig->header.date = fib->fib_Date;
+            sig->header.blocks = (fib->fib_Size + SYNC_BLOCK - 1) / SYNC_BLOCK;
+            ok = AllocBlocks(sig);
+        }
+        FreeDosObject(DOS_FIB, fib);
+    }
+    
+    while (ok && (got = Read(fh, buffer, chunk)) > 0)
+    {
+        // Only the last read may end inside a block
+        if (got % SYNC_BLOCK && size + got != sig->header.size)
+        {
+            ok = FALSE;
+            break;
+        }
+    
+        for (i = 0; i < got && block < sig->header.blocks; i += n, block++)
+        {
+            n = got - i < SYNC_BLOCK ? got - i : SYNC_BLOCK;
+            RollSumInit(&rs, buffer + i, n);
+            sig->blocks[block].weak = RollSumDigest(&rs);
+            sig->blocks[block].strong = UpdateCRC32(0xFFFFFFFF, buffer + i, n) ^ 0xFFFFFFFF;
+        }
+        crc = UpdateCRC32(crc, buffer, got);
+        size += got;
+    }
+    Close(fh);
+    
+    ok = ok && got == 0 && size == sig->header.size;
+    sig->header.checksum = crc ^ 0xFFFFFFFF;
+    
+    if (!ok)
+        FreeSignature(sig);
+    return ok;
+}
+
+// Reads <path>.sig as it is; FindSignature() decides if it is current
+BOOL LoadSignature(const char *path, struct Signature *sig)
+{
+    char name[MAX_PATH];
+    LONG length;
+    BOOL ok = FALSE;
+    BPTR fh;
+    
+    memset(sig, 0, sizeof(*sig));
+    if (!SignatureName(path, name) || !(fh = Open(name, MODE_OLDFILE)))
+        return FALSE;
+    
+    if (Read(fh, &sig->header, sizeof(sig->header)) == sizeof(sig->header) &&
+        sig->header.magic == SYNC_MAGIC &&
+        sig->header.blocks == (sig->header.size + SYNC_BLOCK - 1) / SYNC_BLOCK &&
+        AllocBlocks(sig))
+    {
+        length = sig->header.blocks * sizeof(struct SyncBlock);
+        ok = Read(fh, sig->blocks, length) == length;
+    }
+    Close(fh);
+    
+    if (!ok)
+        FreeSignature(sig);
+    return ok;
+}
+
+BOOL SaveSignature(const char *path, const struct Signature *sig)
+{
+    char name[MAX_PATH];
+    LONG length = sig->header.blocks * sizeof(struct SyncBlock);
+    BOOL ok;
+    BPTR fh;
+    
+    if (!SignatureName(path, name) || !(fh = Open(name, MODE_NEWFILE)))
+        return FALSE;
+    
+    ok = Write(fh, &sig->header, sizeof(sig->header)) == sizeof(sig->header) &&
+         Write(fh, sig->blocks, length) == length;
+    
+    if (!Close(fh))
+        ok = FALSE;
+    if (!ok)
+        DeleteFile(name);
+    return ok;
+}
+
+// The saved signature is used while the file keeps the size and date it
+// was signed with. Otherwise the file is signed again and the signature
+// saved if the directory allows; a read-only master is signed every time.
+BOOL FindSignature(struct CopyEngine *ce, const char *path, struct Signature *sig)
+{
+    struct FileInfoBlock *fib;
+    BOOL current = FALSE;
+    BPTR lock;
+    
+    if (LoadSignature(path, sig))
+    {
+        if ((fib = AllocDosObject(DOS_FIB, NULL)))
+        {
+            if ((lock = Lock(path, ACCESS_READ)))
+            {
+                current = Examine(lock, fib) && fib->fib_Size == sig->header.size &&
+                          CompareDates(&fib->fib_Date, &sig->header.date) == 0;
+                UnLock(lock);
+            }
+            FreeDosObject(DOS_FIB, fib);
+        }
+    
+        if (current)
+            return TRUE;
+        FreeSignature(sig);
+    }
+    
+    if (!SignFile(ce, path, sig))
+        return FALSE;
+    
+    SaveSignature(path, sig);
+    return TRUE;
+}
+
+// Slides a block-sized window over the local file a buffer at a time and
+// notes, for each block of the signature, where the local file has it
+static BOOL MatchBlocks(struct CopyEngine *ce, const struct Signature *sig, BPTR fh,
+                        ULONG *found)
+{
+    struct RollSum rs;
+    UBYTE *buffer = ce->buffers[0].data;
+    ULONG full = sig->header.size / SYNC_BLOCK;
+    ULONG *heads, *next;
+    ULONG mask, weak, i;
+    ULONG strong = 0;
+    ULONG start = 0, p = 0, len = 0;
+    ULONG left = full;
+    LONG got;
+    BOOL fresh = TRUE, eof = FALSE, ok = TRUE;
+    BOOL matched, hashed;
+    
+    for (i = 0; i < sig->header.blocks; i++)
+        found[i] = SYNC_NONE;
+    
+    if (!full)
+        return TRUE;
+    
+    for (mask = 256; mask < full; mask <<= 1)
+        ;
+    mask--;
+    
+    if (!(heads = AllocVec((mask + 1) * sizeof(ULONG), MEMF_CLEAR)))
+        return FALSE;
+    if (!(next = AllocVec(full * sizeof(ULONG), MEMF_ANY)))
+    {
+        FreeVec(heads);
+        return FALSE;
+    }
+    
+    // Chains hold block numbers plus one, lowest first
+    for (i = full; i > 0; i--)
+    {
+        next[i - 1] = heads[sig->blocks[i - 1].weak & mask];
+        heads[sig->blocks[i - 1].weak & mask] = i;
+    }
+    
+    while (left)
+    {
+        // Keep the window and the byte after it in the buffer
+        if (p + SYNC_BLOCK >= len && !eof)
+        {
+            memmove(buffer, buffer + p, len - p);
+            start += p;
+            len -= p;
+            p = 0;
+    
+            if ((got = Read(fh, buffer + len, ce->bufferSize - len)) < 0)
+            {
+                ok = FALSE;
+                break;
+            }
+            eof = got == 0;
+            len += got;
+            continue;
+        }
+        if (p + SYNC_BLOCK > len)
+            break;
+    
+        if (fresh)
+        {
+            RollSumInit(&rs, buffer + p, SYNC_BLOCK);
+            fresh = FALSE;
+        }
+    
+        weak = RollSumDigest(&rs);
+        matched = hashed = FALSE;
+        for (i = heads[weak & mask]; i; i = next[i - 1])
+        {
+            if (sig->blocks[i - 1].weak != weak)
+                continue;
+    
+            if (!hashed)
+            {
+                strong = UpdateCRC32(0xFFFFFFFF, buffer + p, SYNC_BLOCK) ^ 0xFFFFFFFF;
+                hashed = TRUE;
+            }
+    
+            // The same block may occur more than once in the new file
+            if (sig->blocks[i - 1].strong == strong)
+            {
+                if (found[i - 1] == SYNC_NONE)
+                {
+                    found[i - 1] = start + p;
+                    left--;
+                }
+                matched = TRUE;
+            }
+        }
+    
+        if (matched)
+        {
+            p += SYNC_BLOCK;
+            fresh = TRUE;
+        }
+        else
+        {
+            if (p + SYNC_BLOCK < len)
+                RollSumRotate(&rs, buffer[p], buffer[p + SYNC_BLOCK]);
+            p++;
+        }
+    }
+    
+    FreeVec(next);
+    FreeVec(heads);
+    return ok;
+}
+
+// Rebuilds the file the signature describes into dest from the blocks the
+// local file already has, reading only the rest from master. Runs of
+// blocks that follow on in their source are moved with one read. dest is
+// deleted unless it comes out with the signature's size and checksum.
+BOOL SyncFile(struct CopyEngine *ce, const struct Signature *sig, const char *master,
+              const char *local, const char *dest, ULONG *fetched)
+{
+    UBYTE *buffer = ce->buffers[0].data;
+    ULONG *found;
+    ULONG crc = 0xFFFFFFFF;
+    ULONG size = 0;
+    ULONG k, run, offset, length;
+    BPTR fl = 0, fm = 0, fd = 0;
+    BPTR from;
+    BOOL ok = FALSE;
+    
+    *fetched = 0;
+    
+    if (!(found = AllocVec((sig->header.blocks + 1) * sizeof(ULONG), MEMF_ANY)))
+        return FALSE;
+    
+    if ((fl = Open(local, MODE_OLDFILE)) && (fm = Open(master, MODE_OLDFILE)) &&
+        (fd = Open(dest, MODE_NEWFILE)))
+    {
+        ok = MatchBlocks(ce, sig, fl, found);
+    
+        for (k = 0; ok && k < sig->header.blocks; k += run)
+        {
+            if (found[k] != SYNC_NONE)
+            {
+                from = fl;
+                offset = found[k];
+            }
+            else
+            {
+                from = fm;
+                offset = k * SYNC_BLOCK;
+            }
+    
+            for (run = 1; k + run < sig->header.blocks && (run + 1) * SYNC_BLOCK <= ce->bufferSize; run++)
+            {
+                if (found[k] == SYNC_NONE ? found[k + run] != SYNC_NONE :
+                                            found[k + run] != offset + run * SYNC_BLOCK)
+                    break;
+            }
+    
+            length = run * SYNC_BLOCK;
+            if (length > sig->header.size - k * SYNC_BLOCK)
+                length = sig->header.size - k * SYNC_BLOCK;
+    
+            ok = Seek(from, offset, OFFSET_BEGINNING) != -1 &&
+                 Read(from, buffer, length) == length &&
+                 Write(fd, buffer, length) == length;
+    
+            crc = UpdateCRC32(crc, buffer, length);
+            size += length;
+            if (from == fm)
+                *fetched += length;
+        }
+    }
+    
+    ok = ok && size == sig->header.size && (crc ^ 0xFFFFFFFF) == sig->header.checksum;
+    
+    if (fd && !Close(fd))
+        ok = FALSE;
+    if (fm) Close(fm);
+    if (fl) Close(fl);
+    if (fd && !ok)
+        DeleteFile(dest);
+    
+    FreeVec(found);
+    return ok;
+}
@@ -0,0 +1,43 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "Shared.h"
+#include "Delta.h"
+#include "CopyEngine.h"
+
+#define SYNC_MAGIC   0x51555331     // "QUS1"
+#define SYNC_SUFFIX  ".sig"         // Signature file, next to the file signed
+#define SYNC_BLOCK   DELTA_BLOCK    // Bytes per signed block
+#define SYNC_NONE    0xFFFFFFFF     // Block not found in the local file
+
+// A file's signature: its checksum, size and date, then for every
+// SYNC_BLOCK bytes the rolling sum of Delta.h and a CRC32. A short last
+// block is signed too but never matched. Kept as <file>.sig, so a master
+// tree is read in full once per release and not once per machine.
+struct SyncHeader {
+    ULONG magic;
+    ULONG checksum;
+    ULONG size;
+    struct DateStamp date;          // Of the file when it was signed
+    ULONG blocks;
+};
+
+struct SyncBlock {
+    ULONG weak;
+    ULONG strong;
+};
+
+struct Signature {
+    struct SyncHeader header;
+    struct SyncBlock *blocks;
+};
+
+BOOL SignFile(struct CopyEngine *ce, const char *path, struct Signature *sig);
+BOOL LoadSignature(const char *path, struct Signature *sig);
+BOOL SaveSignature(const char *path, const struct Signature *sig);
+BOOL FindSignature(struct CopyEngine *ce, const char *path, struct Signature *sig);
+void FreeSignature(struct Signature *sig);
+BOOL SyncFile(struct CopyEngine *ce, const struct Signature *sig, const char *master,
+              const char *local, const char *dest, ULONG *fetched);
+
+#endif /* SYNC_H */
@@ -0,0 +1,57 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+// Build variant settings. The SMakefile builds every tool once per CPU
+// class with TUNE_CPU set to match the compiler's CPU= option; Launch.c
+// starts the variant that suits the machine. A plain build without
+// TUNE_CPU gets the 68000 variant, which runs everywhere.
+//
+//   .000  68000/68010, no caches, often 512 KB to 2 MB of memory
+//   .020  68020/68030, 256 byte instruction and data caches
+//   .060  68040/68060, 4 KB or 8 KB caches and fast memory
+
+#ifndef TUNE_CPU
+#define TUNE_CPU 68000
+#endif
+
+#if TUNE_CPU >= 68040
+
+#define TUNE_VARIANT        ".060"
+#define TUNE_CRC_SLICES     4               // 4 KB of tables stay in the data cache
+#define TUNE_BUFFER_SIZE    8192            // Stack buffers
+#define TUNE_SCAN_BUFFER    (512 * 1024)    // Whole files the scan reader loads
+#define TUNE_SCAN_BLOCK     (128 * 1024)
+#define TUNE_DIR_BUFFER     16384
+#define TUNE_DB_CACHE       8
+#define TUNE_COPY_BUFFER    (128 * 1024)
+#define TUNE_COPY_BUFFERS   3
+
+#elif TUNE_CPU >= 68020
+
+#define TUNE_VARIANT        ".020"
+#define TUNE_CRC_SLICES     1
+#define TUNE_CRC_UNROLL     4               // Loop still fits the instruction cache
+#define TUNE_BUFFER_SIZE    8192
+#define TUNE_SCAN_BUFFER    (256 * 1024)
+#define TUNE_SCAN_BLOCK     (64 * 1024)
+#define TUNE_DIR_BUFFER     8192
+#define TUNE_DB_CACHE       4
+#define TUNE_COPY_BUFFER    (64 * 1024)
+#define TUNE_COPY_BUFFERS   3
+
+#else
+
+#define TUNE_VARIANT        ".000"
+#define TUNE_CRC_SLICES     1
+#define TUNE_CRC_UNROLL     1
+#define TUNE_BUFFER_SIZE    4096
+#define TUNE_SCAN_BUFFER    (32 * 1024)
+#define TUNE_SCAN_BLOCK     (16 * 1024)
+#define TUNE_DIR_BUFFER     4096
+#define TUNE_DB_CACHE       2
+#define TUNE_COPY_BUFFER    (16 * 1024)
+#define TUNE_COPY_BUFFERS   2
+
+#endif
+
+#endif /* TUNING_H */
@@ -124,6 +124,7 @@
 #include <dos/dosextens.h>
 #include <dos/filehandler.h>
 #include <proto/dos.h>
+#include "DirIter.h"
 
 /* ---------- minimal hash structures ----------------------------------- */
 #define MAX_FUNC   32
@@ -228,11 +229,13 @@ static int parse_fd_line(const char *line, char *func, int *neg)
 static void load_fd_dir(void)
 {
     BPTR lock;
-    struct FileInfoBlock *fib;
+    struct DirIter *it;
+    struct ExAllData *ed;
     char path[MAX_LINE];
     char line[MAX_LINE];
     char func[MAX_FUNC];
     int neg;
+    int i;
     BPTR fd;
     
     /* Initialize hash table */
@@ -246,40 +249,35 @@ static void load_fd_dir(void)
         return; 
     }
 
-    fib = (struct FileInfoBlock *)AllocDosObject(DOS_FIB, NULL);
-    if (!fib) { 
+    /* ExAll batches the directory and filters on .fd for us */
+    it = CreateDirIter("#?.fd", DIRITER_BUFFER_SIZE);
+    if (!it) { 
         UnLock(lock); 
         return; 
     }
 
-    if (Examine(lock, fib))
+    StartDirIter(it, lock);
+    while ((ed = NextDirEntry(it)))
     {
-        while (ExNext(lock, fib))
-        {
-            /* Skip directories */
-            if (fib->fib_DirEntryType < 0) continue;
-            
-            /* Check for .fd extension */
-            i = strlen(fib->fib_FileName);
-            if (i < 3 || stricmp(fib->fib_FileName+i-3, ".fd")) continue;
+        /* Skip directories */
+        if (ed->ed_Type > 0) continue;
 
-            /* Build path */
-            strcpy(path, "FD:");
-            strcat(path, fib->fib_FileName);
+        /* Build path */
+        strcpy(path, "FD:");
+        strcat(path, (char *)ed->ed_Name);
 
-            fd = Open(path, MODE_OLDFILE);
-            if (!fd) continue;
+        fd = Open(path, MODE_OLDFILE);
+        if (!fd) continue;
 
-            while (FGets(fd, line, sizeof(line)-1))
-            {
-                if (parse_fd_line(line, func, &neg)) {
-                    insert_fd(-neg, func);
-                }
+        while (FGets(fd, line, sizeof(line)-1))
+        {
+            if (parse_fd_line(line, func, &neg)) {
+                insert_fd(-neg, func);
             }
-            Close(fd);
         }
+        Close(fd);
     }
-    FreeDosObject(DOS_FIB, fib);
+    DeleteDirIter(it);
     UnLock(lock);
 }
 